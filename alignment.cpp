@@ -0,0 +1,300 @@
+#ifndef alignmentsources
+#define alignmentsources
+
+#include "alignment.h"
+#include "hitjoin.h"
+#include "hitsort.h"
+#include "fileoperations.h"
+
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <atomic>
+
+std::vector<AlignmentPair> AlignmentFunctions::CollectPairs(const std::vector<Dataset>& reference,
+                                                            const std::vector<Dataset>& layer,
+                                                            const AlignmentSettings& settings)
+{
+    std::vector<AlignmentPair> pairs;
+
+    //a subset of a sorted array is still sorted:
+    std::vector<Dataset> sampled;
+    const std::vector<Dataset>* refhits = &reference;
+    if(settings.samplestep > 1)
+    {
+        sampled.reserve(reference.size() / settings.samplestep + 1);
+        for(uint64_t i = 0; i < reference.size(); i += settings.samplestep)
+            sampled.push_back(reference[i]);
+        refhits = &sampled;
+    }
+
+    JoinHits(*refhits, layer, settings.timedist,
+        [&](const Dataset& refhit, const Dataset& hit, long long)
+        {
+            if(pairs.size() >= settings.maxpairs)
+                return;
+
+            AlignmentPair pair;
+            pair.xref = (refhit.column - centrecolumn) * columnpitch;
+            pair.yref = (refhit.row - centrerow) * rowpitch;
+            pair.x    = (hit.column - centrecolumn) * columnpitch;
+            pair.y    = (hit.row - centrerow) * rowpitch;
+            pairs.push_back(pair);
+        });
+
+    return pairs;
+}
+
+AlignmentResult AlignmentFunctions::FitAlignment(const std::vector<AlignmentPair>& pairs,
+                                                 const AlignmentSettings& settings)
+{
+    AlignmentResult result;
+    result.numpairs = pairs.size();
+    if(pairs.size() < 10)
+        return result;
+
+    //start value: the most frequent position difference (random pairs are spread out evenly):
+    const int numcolbins = 2 * 132 + 1;
+    const int numrowbins = 2 * 372 + 1;
+    std::vector<uint32_t> differences(numcolbins * numrowbins, 0);
+    for(auto& it : pairs)
+    {
+        int dcol = int(std::floor((it.xref - it.x) / columnpitch + 0.5)) + 132;
+        int drow = int(std::floor((it.yref - it.y) / rowpitch + 0.5)) + 372;
+        if(dcol >= 0 && dcol < numcolbins && drow >= 0 && drow < numrowbins)
+            ++differences[dcol * numrowbins + drow];
+    }
+    uint64_t mode = std::max_element(differences.begin(), differences.end())
+                        - differences.begin();
+
+    double shiftx   = (int(mode / numrowbins) - 132) * columnpitch;
+    double shifty   = (int(mode % numrowbins) - 372) * rowpitch;
+    double rotation = 0;
+
+    //cut for Tukey's biweight, starting with a few pixels around the start value. The residuals
+    //of correct pairs are dominated by the pixel size, so the cut is kept above two column
+    //pitches to avoid locking onto the pairs that happen to have no residual:
+    double cut = 3 * columnpitch;
+    const double mincut = 2 * columnpitch;
+
+    std::vector<double> residuals(pairs.size());
+    std::vector<double> inliers;
+    inliers.reserve(pairs.size());
+
+    for(result.iterations = 1; result.iterations <= settings.maxiterations; ++result.iterations)
+    {
+        const double cosine = std::cos(rotation);
+        const double sine   = std::sin(rotation);
+
+        //weighted normal equations for the change of (shift x, shift y, rotation):
+        double matrix[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        double vector[3]    = {0, 0, 0};
+        inliers.clear();
+
+        for(uint64_t i = 0; i < pairs.size(); ++i)
+        {
+            const AlignmentPair& pair = pairs[i];
+            double ex = pair.xref - (cosine * pair.x - sine * pair.y + shiftx);
+            double ey = pair.yref - (sine * pair.x + cosine * pair.y + shifty);
+            double r  = std::sqrt(ex * ex + ey * ey);
+            residuals[i] = r;
+
+            if(r >= cut)
+                continue;
+            inliers.push_back(r);
+
+            double weight = 1 - (r / cut) * (r / cut);
+            weight *= weight;
+
+            //derivatives of the predicted position by the rotation:
+            double dxdrot = -sine * pair.x - cosine * pair.y;
+            double dydrot =  cosine * pair.x - sine * pair.y;
+
+            matrix[0][0] += weight;
+            matrix[0][2] += weight * dxdrot;
+            matrix[1][1] += weight;
+            matrix[1][2] += weight * dydrot;
+            matrix[2][2] += weight * (dxdrot * dxdrot + dydrot * dydrot);
+            vector[0]    += weight * ex;
+            vector[1]    += weight * ey;
+            vector[2]    += weight * (dxdrot * ex + dydrot * ey);
+        }
+        matrix[2][0] = matrix[0][2];
+        matrix[2][1] = matrix[1][2];
+
+        if(inliers.size() < 3)
+            break;
+
+        //solve the symmetric system by eliminating the shifts:
+        double reduced = matrix[2][2] - matrix[2][0] * matrix[0][2] / matrix[0][0]
+                            - matrix[2][1] * matrix[1][2] / matrix[1][1];
+        double drotation = 0;
+        if(std::abs(reduced) > 1e-12 * matrix[2][2])
+            drotation = (vector[2] - matrix[2][0] * vector[0] / matrix[0][0]
+                            - matrix[2][1] * vector[1] / matrix[1][1]) / reduced;
+        double dshiftx = (vector[0] - matrix[0][2] * drotation) / matrix[0][0];
+        double dshifty = (vector[1] - matrix[1][2] * drotation) / matrix[1][1];
+
+        shiftx   += dshiftx;
+        shifty   += dshifty;
+        rotation += drotation;
+
+        //new cut from the robust width of the inlier residuals (median of a 2D normal
+        //distribution in the radius: 1.1774 sigma):
+        std::nth_element(inliers.begin(), inliers.begin() + inliers.size() / 2, inliers.end());
+        double sigma  = inliers[inliers.size() / 2] / 1.1774;
+        double newcut = std::max(4.685 * sigma, mincut);
+        bool   stable = std::abs(newcut - cut) < 0.01 * cut;
+        cut = newcut;
+
+        //the rotation is compared by the movement at the edge of the matrix (about 10 mm):
+        if(std::abs(dshiftx) < settings.tolerance && std::abs(dshifty) < settings.tolerance
+                && std::abs(drotation) * 1e4 < settings.tolerance && stable)
+        {
+            result.converged = true;
+            break;
+        }
+    }
+    if(result.iterations > settings.maxiterations)
+        result.iterations = settings.maxiterations;
+
+    double sum2 = 0;
+    for(auto& it : residuals)
+        if(it < cut)
+        {
+            sum2 += it * it;
+            ++result.numinliers;
+        }
+
+    result.parameters.columnshift = shiftx / columnpitch;
+    result.parameters.rowshift    = shifty / rowpitch;
+    result.parameters.rotation    = rotation;
+    result.residual = (result.numinliers > 0)?std::sqrt(sum2 / result.numinliers):0;
+
+    return result;
+}
+
+std::vector<AlignmentResult> AlignmentFunctions::AlignLayers(
+                                            const std::vector<std::vector<Dataset> >& layers,
+                                            unsigned int reference,
+                                            const AlignmentSettings& settings,
+                                            unsigned int numthreads)
+{
+    std::vector<AlignmentResult> results(layers.size());
+    for(unsigned int i = 0; i < layers.size(); ++i)
+        results[i].layer = i + 1;
+
+    if(reference < 1 || reference > layers.size())
+        return results;
+
+    results[reference - 1].converged = true;
+
+    numthreads = ThreadFunctions::GetNumThreads(numthreads);
+    if(numthreads > layers.size())
+        numthreads = layers.size();
+
+    std::atomic<unsigned int> nextlayer(0);
+    auto worker = [&]()
+    {
+        unsigned int index;
+        while((index = nextlayer++) < layers.size())
+        {
+            if(index == reference - 1)
+                continue;
+
+            std::vector<AlignmentPair> pairs = CollectPairs(layers[reference - 1], layers[index],
+                                                            settings);
+            results[index] = FitAlignment(pairs, settings);
+            results[index].layer = index + 1;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numthreads; ++i)
+        threads.push_back(std::thread(worker));
+    worker();
+    for(auto& it : threads)
+        it.join();
+
+    return results;
+}
+
+void AlignmentFunctions::PrintReport(std::ostream& out, const std::vector<AlignmentResult>& results)
+{
+    out << "Layer  column shift  row shift  rotation (mrad)  pairs  inliers  iterations"
+        << "  residual (um)" << std::endl;
+    for(auto& it : results)
+    {
+        out << "  " << it.layer << "    " << it.parameters.columnshift << "  "
+            << it.parameters.rowshift << "  " << it.parameters.rotation * 1e3 << "  "
+            << it.numpairs << "  " << it.numinliers << "  " << it.iterations << "  "
+            << it.residual;
+        if(!it.converged)
+            out << "  (not converged)";
+        out << std::endl;
+    }
+}
+
+bool AlignmentFunctions::Save(std::string filename, const std::vector<AlignmentResult>& results)
+{
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::out | std::ios::trunc);
+    if(!f.is_open())
+        return false;
+
+    f << "## Alignment\n";
+    for(auto& it : results)
+    {
+        std::string prefix = std::string("l") + char('0' + it.layer);
+        f << "# layer " << it.layer << ": " << it.numpairs << " pairs, " << it.numinliers
+          << " inliers, " << it.iterations << " iterations, residual " << it.residual << " um"
+          << ((it.converged)?"":", not converged") << "\n";
+        f.precision(10);
+        f << prefix << "columnshift " << it.parameters.columnshift << "\n"
+          << prefix << "rowshift "    << it.parameters.rowshift << "\n"
+          << prefix << "rotation "    << it.parameters.rotation << "\n";
+    }
+
+    f.close();
+    return !f.fail();
+}
+
+std::vector<AlignmentParameters> AlignmentFunctions::Load(std::string filename,
+                                                          unsigned int numlayers)
+{
+    if(!FileExists(filename))
+        return std::vector<AlignmentParameters>();
+
+    StringPairs values = LoadParameterFile(filename, "Alignment");
+
+    std::vector<AlignmentParameters> parameters(numlayers);
+    for(unsigned int i = 0; i < numlayers; ++i)
+    {
+        std::stringstream prefix("");
+        prefix << "l" << (i + 1);
+        parameters[i].columnshift = FindKeyDouble(values, prefix.str() + "columnshift", 0);
+        parameters[i].rowshift    = FindKeyDouble(values, prefix.str() + "rowshift", 0);
+        parameters[i].rotation    = FindKeyDouble(values, prefix.str() + "rotation", 0);
+    }
+
+    return parameters;
+}
+
+void AlignmentFunctions::Apply(Dataset& hit, const AlignmentParameters& parameters)
+{
+    double x = (hit.column - centrecolumn) * columnpitch;
+    double y = (hit.row - centrerow) * rowpitch;
+
+    const double cosine = std::cos(parameters.rotation);
+    const double sine   = std::sin(parameters.rotation);
+
+    double newx = cosine * x - sine * y + parameters.columnshift * columnpitch;
+    double newy = sine * x + cosine * y + parameters.rowshift * rowpitch;
+
+    hit.column = short(std::floor(newx / columnpitch + centrecolumn + 0.5));
+    hit.row    = short(std::floor(newy / rowpitch + centrerow + 0.5));
+}
+
+#endif //alignmentsources
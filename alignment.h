@@ -0,0 +1,165 @@
+#ifndef __ALIGNMENT
+#define __ALIGNMENT
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+#include "dataset.h"
+
+/*
+ * Spatial alignment of the telescope planes. For every plane, the transformation into the frame
+ * of a reference plane is fitted from pairs of hits coincident in time:
+ *      (x_ref, y_ref) = R(rotation) * (x, y) + (shift x, shift y)
+ * with positions relative to the centre of the matrix. Most coincident pairs are random
+ * combinations, so the fit starts at the most frequent position difference and uses iteratively
+ * reweighted least squares with Tukey's biweight to suppress them.
+ * The results are stored in the `## Alignment` section of a parameter file (see
+ * fileoperations.h) and applied to the hit addresses after loading.
+ */
+
+/**
+ * @brief AlignmentParameters describes the transformation of one plane into the reference frame
+ */
+struct AlignmentParameters
+{
+    AlignmentParameters() : columnshift(0), rowshift(0), rotation(0) {}
+
+    double columnshift;         //shift in units of the column pitch (150 um)
+    double rowshift;            //shift in units of the row pitch (50 um)
+    double rotation;            //rotation around the matrix centre (in rad)
+};
+
+/**
+ * @brief AlignmentResult contains the parameters and the fit report for one plane
+ */
+struct AlignmentResult
+{
+    AlignmentResult() : layer(0), numpairs(0), numinliers(0), iterations(0), converged(false),
+        residual(0) {}
+
+    unsigned int        layer;          //layer number (1 to 4)
+    AlignmentParameters parameters;
+    uint64_t            numpairs;       //coincident pairs used for the fit
+    uint64_t            numinliers;     //pairs with non-zero weight after the last iteration
+    unsigned int        iterations;
+    bool                converged;
+    double              residual;       //RMS of the inlier residuals (in um)
+};
+
+/**
+ * @brief AlignmentSettings contains the parameters for the pair selection and the fit
+ */
+struct AlignmentSettings
+{
+    AlignmentSettings() : timedist(75), samplestep(1), maxpairs(2000000), maxiterations(50),
+        tolerance(0.01) {}
+
+    long long    timedist;          //time window for coincident pairs (in time stamp units)
+    unsigned int samplestep;        //use only every `samplestep`-th hit of the reference layer
+    uint64_t     maxpairs;          //maximum number of pairs collected per plane
+    unsigned int maxiterations;     //iteration limit of the reweighted fit
+    double       tolerance;         //convergence limit for the change of the shifts (in um)
+};
+
+/**
+ * @brief AlignmentPair is a pair of coincident hits in centred physical coordinates (in um)
+ */
+struct AlignmentPair
+{
+    float xref;
+    float yref;
+    float x;
+    float y;
+};
+
+namespace AlignmentFunctions {
+
+    const double columnpitch = 150;     //in um
+    const double rowpitch    = 50;      //in um
+    const double centrecolumn = 65.5;
+    const double centrerow    = 185.5;
+
+    /**
+     * @brief CollectPairs selects the pairs of hits coincident in time from two time sorted layers
+     * @param reference         - time sorted hits of the reference layer
+     * @param layer             - time sorted hits of the layer to align
+     * @param settings          - time window, sampling and pair limit
+     * @return                  - the pairs in centred physical coordinates
+     */
+    std::vector<AlignmentPair> CollectPairs(const std::vector<Dataset>& reference,
+                                            const std::vector<Dataset>& layer,
+                                            const AlignmentSettings& settings);
+
+    /**
+     * @brief FitAlignment fits shift and rotation to the pairs with iteratively reweighted least
+     *      squares
+     * @param pairs             - the pairs from CollectPairs()
+     * @param settings          - iteration limit and tolerance
+     * @return                  - the fit result (layer number not set)
+     */
+    AlignmentResult FitAlignment(const std::vector<AlignmentPair>& pairs,
+                                 const AlignmentSettings& settings);
+
+    /**
+     * @brief AlignLayers aligns all layers to the reference layer, each layer on its own thread
+     * @param layers            - time sorted hits for every layer (index 0 is layer 1)
+     * @param reference         - layer number of the reference layer
+     * @param settings          - settings for pair selection and fit
+     * @param numthreads        - maximum number of threads, 0 for one per CPU core
+     * @return                  - the results for all layers (the reference has no shifts)
+     */
+    std::vector<AlignmentResult> AlignLayers(const std::vector<std::vector<Dataset> >& layers,
+                                             unsigned int reference = 1,
+                                             const AlignmentSettings& settings
+                                                = AlignmentSettings(),
+                                             unsigned int numthreads = 0);
+
+    /**
+     * @brief PrintReport writes the fit results and their convergence to a stream
+     * @param out               - the stream to write to
+     * @param results           - the results from AlignLayers()
+     */
+    void PrintReport(std::ostream& out, const std::vector<AlignmentResult>& results);
+
+    /**
+     * @brief Save writes the alignment parameters in an `## Alignment` section
+     * @param filename          - the file to write (overwritten)
+     * @param results           - the results from AlignLayers()
+     * @return                  - false if the file could not be written
+     */
+    bool Save(std::string filename, const std::vector<AlignmentResult>& results);
+    /**
+     * @brief Load reads the alignment parameters from the `## Alignment` section of a file
+     * @param filename          - the file to read
+     * @param numlayers         - number of layers to read parameters for
+     * @return                  - the parameters for layers 1 to `numlayers`, empty if the file
+     *                              could not be read
+     */
+    std::vector<AlignmentParameters> Load(std::string filename, unsigned int numlayers = 4);
+
+    /**
+     * @brief Apply transforms the address of a hit into the reference frame. The new address is
+     *      rounded to the closest pixel.
+     * @param hit               - the hit to move
+     * @param parameters        - the parameters for the layer of the hit
+     */
+    void Apply(Dataset& hit, const AlignmentParameters& parameters);
+    /**
+     * @brief Apply transforms the addresses of all hits with the parameters for their layers
+     * @param begin             - iterator to the first hit
+     * @param end               - iterator behind the last hit
+     * @param parameters        - the parameters for the layers (index 0 is layer 1)
+     */
+    template<class Iterator>
+    void Apply(Iterator begin, Iterator end, const std::vector<AlignmentParameters>& parameters)
+    {
+        for(Iterator it = begin; it != end; ++it)
+            if(it->layer >= 1 && it->layer <= int(parameters.size()))
+                Apply(*it, parameters[it->layer - 1]);
+    }
+
+}
+
+#endif //__ALIGNMENT
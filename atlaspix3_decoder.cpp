@@ -34,6 +34,8 @@
 
 #include "fileoperations.h"
 #include "atlaspix3.h"
+#include "totcalculation.h"
+#include "totspectrum.h"
 
 int main(int argc, char** argv)
 {
@@ -94,6 +96,7 @@ int main(int argc, char** argv)
 
     std::string inputfile = FindKey(config, "input", "");
     std::string outputfile = FindKey(config, "output", "");
+    std::string spectrafile = FindKey(config, "totspectra", "");
 
     if(inputfile == "" || outputfile == "")
     {
@@ -233,6 +236,18 @@ int main(int argc, char** argv)
 
     std::vector<Dataset> hitcollection;
 
+    //ToT calculation for the clean up (dividers as in Dataset::CalculateToT(0, 1)):
+    const ToTCalculator totcalculator(1, 2);
+    std::vector<short>   collectionts;
+    std::vector<short>   collectionts2;
+    std::vector<int>     collectiontots;
+
+    //optional per-pixel ToT spectra of the written hits:
+    ToTSpectra* spectra = nullptr;
+    if(spectrafile != "")
+        spectra = new ToTSpectra(FindKeyInt(config, "totts1div", 1),
+                                 FindKeyInt(config, "totts2div", 2));
+
     dec.SetUDPBugSetting(udpbug);
     decnomux.SetUDPBugSetting(udpbug);
     dectrig.SetUDPBugSetting(udpbug);
@@ -310,11 +325,23 @@ int main(int argc, char** argv)
 
             // clean up
                   if (cleanup) {
+                    //ToT of the whole collection in one pass:
+                    collectionts.clear();
+                    collectionts2.clear();
+                    for(auto& it : hitcollection)
+                    {
+                        collectionts.push_back(it.shortts);
+                        collectionts2.push_back(it.shortts2);
+                    }
+                    collectiontots.resize(hitcollection.size());
+                    totcalculator.Calculate(hitcollection.size(), collectionts.data(),
+                                            collectionts2.data(), collectiontots.data());
+
                     double mytot(0);
 
-                   // int num_hit=0;
+                    unsigned int num_hit = 0;
                     for (auto& it : hitcollection) {
-                      mytot = it.CalculateToT(0,1);
+                      mytot = collectiontots[num_hit++];
                       if(it.layer==0){
                           it.Print();
                           nl0++;
@@ -355,7 +382,6 @@ int main(int argc, char** argv)
                       first_hit = false;
                       if (it.layer == 0) {layer0++;}
                     }
-                    //num_hit++;
                   }
 
 
@@ -377,6 +403,9 @@ int main(int argc, char** argv)
                 }
             }
 
+            if(spectra != nullptr)
+                spectra->Fill(hitcollection.data(), hitcollection.size());
+
             hitcollection.clear();
 
             //write data to HDD in bunches of 2000 datasets:
@@ -426,6 +455,8 @@ int main(int argc, char** argv)
             ++datasetcount[0];
         }
     }
+    if(spectra != nullptr)
+        spectra->Fill(hitcollection.data(), hitcollection.size());
     for(int i = ((splitlayers)?1:0); i < ((splitlayers)?5:1); ++i)
     {
         fout[i] << sout[i].str();
@@ -438,6 +469,17 @@ int main(int argc, char** argv)
     std::cout << "TS2 problem " << nts2 << std::endl;
     std::cout << "Layer 0 " << nl0 << std::endl;
 
+    if(spectra != nullptr)
+    {
+        if(spectra->Save(spectrafile))
+            std::cout << "ToT spectra of " << spectra->GetNumEntries() << " hits written to \""
+                      << spectrafile << "\" (" << spectra->GetNumRejected()
+                      << " hits outside of the matrices)" << std::endl;
+        else
+            std::cerr << "Could not write ToT spectra to \"" << spectrafile << "\"" << std::endl;
+        delete spectra;
+    }
+
 
 #ifdef DEBUG
     std::cout << "finished decoding" << std::endl;
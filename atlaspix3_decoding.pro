@@ -12,11 +12,17 @@ SOURCES += atlaspix3_decoder.cpp \
             decoder.cpp \
             atlaspix3.cpp \
             dataset.cpp \
+            totcalculation.cpp \
+            totspectrum.cpp \
+            binaryfile.cpp \
     fileoperations.cpp
 
 HEADERS += decoder.h \
             atlaspix3.h \
             dataset.h \
+            totcalculation.h \
+            totspectrum.h \
+            binaryfile.h \
     fileoperations.h
 
 
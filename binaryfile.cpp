@@ -0,0 +1,237 @@
+#ifndef binaryfilesources
+#define binaryfilesources
+
+#include "binaryfile.h"
+
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool BinaryFileFunctions::GetFileKey(std::string filename, FileKey& key)
+{
+    struct stat info;
+    if(stat(filename.c_str(), &info) != 0)
+        return false;
+
+    key.size    = uint64_t(info.st_size);
+    key.mtime   = int64_t(info.st_mtime);
+#if defined(__linux__)
+    key.mtimens = int64_t(info.st_mtim.tv_nsec);
+#else
+    key.mtimens = 0;
+#endif
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------
+
+FileMapping::FileMapping() : mapping(nullptr), mappedsize(0), contents(nullptr), opened(false)
+{
+
+}
+
+FileMapping::FileMapping(FileMapping&& other) : mapping(other.mapping),
+    mappedsize(other.mappedsize), contents(other.contents), opened(other.opened)
+{
+    //the array of a vector stays in place on a move:
+    buffer.swap(other.buffer);
+
+    other.mapping    = nullptr;
+    other.mappedsize = 0;
+    other.contents   = nullptr;
+    other.opened     = false;
+}
+
+FileMapping::~FileMapping()
+{
+    Close();
+}
+
+FileMapping& FileMapping::operator=(FileMapping&& other)
+{
+    if(this == &other)
+        return *this;
+
+    Close();
+
+    mapping    = other.mapping;
+    mappedsize = other.mappedsize;
+    contents   = other.contents;
+    opened     = other.opened;
+    buffer.swap(other.buffer);
+
+    other.mapping    = nullptr;
+    other.mappedsize = 0;
+    other.contents   = nullptr;
+    other.opened     = false;
+
+    return *this;
+}
+
+bool FileMapping::Open(std::string filename, bool writable, bool sequential)
+{
+    Close();
+
+    struct stat info;
+    if(stat(filename.c_str(), &info) != 0)
+        return false;
+
+    //an empty file can not be mapped:
+    if(info.st_size == 0)
+    {
+        opened = true;
+        return true;
+    }
+
+#if defined(__linux__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    //a private mapping: changes only affect the pages of this process
+    void* map = mmap(nullptr, size_t(info.st_size), PROT_READ | (writable?PROT_WRITE:0),
+                     MAP_PRIVATE, fd, 0);
+    close(fd);  //the mapping stays valid after closing the descriptor
+    if(map == MAP_FAILED)
+        return false;
+
+    if(sequential)
+        madvise(map, size_t(info.st_size), MADV_SEQUENTIAL);
+
+    mapping    = map;
+    mappedsize = uint64_t(info.st_size);
+    contents   = static_cast<char*>(map);
+#else
+    (void)(writable);
+    (void)(sequential);
+
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::in | std::ios::binary);
+    if(!f.is_open())
+        return false;
+
+    //8 byte elements for the alignment of the records:
+    buffer.resize((uint64_t(info.st_size) + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    f.read(reinterpret_cast<char*>(&buffer[0]), std::streamsize(info.st_size));
+    if(!f.good())
+    {
+        buffer.clear();
+        return false;
+    }
+
+    mappedsize = uint64_t(info.st_size);
+    contents   = reinterpret_cast<char*>(&buffer[0]);
+#endif
+
+    opened = true;
+    return true;
+}
+
+void FileMapping::Close()
+{
+#if defined(__linux__)
+    if(mapping != nullptr)
+        munmap(mapping, size_t(mappedsize));
+#endif
+    mapping    = nullptr;
+    mappedsize = 0;
+    contents   = nullptr;
+    opened     = false;
+    buffer.clear();
+    buffer.shrink_to_fit();
+}
+
+bool FileMapping::is_open() const
+{
+    return opened;
+}
+
+const char* FileMapping::data() const
+{
+    return contents;
+}
+
+char* FileMapping::data()
+{
+    return contents;
+}
+
+uint64_t FileMapping::size() const
+{
+    return mappedsize;
+}
+
+//------------------------------------------------------------------------------------------------
+
+AtomicFileWriter::AtomicFileWriter() : filename(""), tempname("")
+{
+
+}
+
+AtomicFileWriter::~AtomicFileWriter()
+{
+    if(f.is_open())
+        Discard();
+}
+
+bool AtomicFileWriter::Open(std::string filename)
+{
+    if(f.is_open())
+        Discard();
+
+    if(filename == "")
+        return false;
+
+    this->filename = filename;
+    tempname = filename + ".part";
+
+    f.open(tempname.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+    return f.is_open();
+}
+
+bool AtomicFileWriter::Commit()
+{
+    if(!f.is_open())
+        return false;
+
+    f.flush();
+    const bool success = f.good();
+    f.close();
+
+    if(!success || std::rename(tempname.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tempname.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void AtomicFileWriter::Discard()
+{
+    if(f.is_open())
+        f.close();
+    if(tempname != "")
+        std::remove(tempname.c_str());
+}
+
+bool AtomicFileWriter::is_open() const
+{
+    return f.is_open();
+}
+
+std::fstream& AtomicFileWriter::stream()
+{
+    return f;
+}
+
+#endif //binaryfilesources
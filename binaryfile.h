@@ -0,0 +1,131 @@
+#ifndef __BINARYFILE
+#define __BINARYFILE
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Building blocks of the binary file formats (hit cache, cluster files, ToT calibration and ToT
+ * spectra): the key identifying the text file a binary file was generated from, access to a
+ * whole file through a memory mapping and writing a file under a temporary name.
+ */
+
+/**
+ * @brief FileKey identifies the state of a file by its size and modification time
+ */
+struct FileKey
+{
+    FileKey(uint64_t size = 0, int64_t mtime = 0, int64_t mtimens = 0) : size(size),
+        mtime(mtime), mtimens(mtimens) {}
+
+    bool operator==(const FileKey& other) const
+    {
+        return size == other.size && mtime == other.mtime && mtimens == other.mtimens;
+    }
+
+    uint64_t size;
+    int64_t  mtime;             //modification time (seconds)
+    int64_t  mtimens;           //nanosecond part of the modification time (0 if not available)
+};
+
+/**
+ * @brief FileMapping gives access to the contents of a whole file. On linux the file is memory
+ *      mapped, on other systems the contents are read into memory.
+ */
+class FileMapping
+{
+public:
+    FileMapping();
+    FileMapping(FileMapping&& other);
+    ~FileMapping();
+
+    FileMapping& operator=(FileMapping&& other);
+
+    /**
+     * @brief Open maps the file
+     * @param filename          - the file to open
+     * @param writable          - allow changes of the contents. The mapping is private, the
+     *                              changes are never written to the file.
+     * @param sequential        - the contents are mostly read from front to back
+     * @return                  - false if the file could not be opened or mapped
+     */
+    bool Open(std::string filename, bool writable = false, bool sequential = false);
+    void Close();
+
+    bool        is_open() const;
+    const char* data() const;
+    char*       data();
+    uint64_t    size() const;
+
+private:
+    FileMapping(const FileMapping&);
+    FileMapping& operator=(const FileMapping&);
+
+    void*                 mapping;
+    uint64_t              mappedsize;
+    char*                 contents;
+    bool                  opened;
+    std::vector<uint64_t> buffer;   //used instead of the mapping on non-linux systems
+};
+
+/**
+ * @brief AtomicFileWriter writes a file under the temporary name "<filename>.part", which is
+ *      renamed to the final name on Commit(). Aborted writes do not leave broken files behind and
+ *      an existing file is only replaced by a complete one.
+ */
+class AtomicFileWriter
+{
+public:
+    AtomicFileWriter();
+    /**
+     * @brief ~AtomicFileWriter discards the file if it was not committed
+     */
+    ~AtomicFileWriter();
+
+    /**
+     * @brief Open creates the temporary file
+     * @param filename          - the final name of the file
+     * @return                  - false if the temporary file could not be created
+     */
+    bool Open(std::string filename);
+    /**
+     * @brief Commit closes the file and moves it to its final name
+     * @return                  - false if writing or renaming failed, the temporary file is
+     *                              removed in this case
+     */
+    bool Commit();
+    /**
+     * @brief Discard closes and deletes the temporary file
+     */
+    void Discard();
+
+    bool          is_open() const;
+    /**
+     * @brief stream gives access to the file for writing (and seeking)
+     */
+    std::fstream& stream();
+
+private:
+    AtomicFileWriter(const AtomicFileWriter&);
+    AtomicFileWriter& operator=(const AtomicFileWriter&);
+
+    std::fstream f;
+    std::string  filename;
+    std::string  tempname;
+};
+
+namespace BinaryFileFunctions {
+
+    /**
+     * @brief GetFileKey retrieves size and modification time of a file
+     * @param filename          - the file to check
+     * @param key               - the object to write the key to
+     * @return                  - false if the file does not exist
+     */
+    bool GetFileKey(std::string filename, FileKey& key);
+
+}
+
+#endif //__BINARYFILE
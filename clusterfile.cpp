@@ -0,0 +1,257 @@
+#ifndef clusterfilesources
+#define clusterfilesources
+
+#include "clusterfile.h"
+
+#include <cstring>
+#include <cstdio>
+
+ClusterFileHeader::ClusterFileHeader() : version(ClusterFileVersion),
+    recordsize(sizeof(ClusterRecord)), numclusters(0), numpixels(0), reserved(0)
+{
+    std::memcpy(magic, "AP3CLUS", sizeof(magic));
+}
+
+ClusterRecord::ClusterRecord() : time(0), firstpixel(0), column(0), row(0), size(0), duration(0),
+    tot(0), layer(0), startcolumn(0), endcolumn(0), startrow(0), endrow(0), reserved(0)
+{
+
+}
+
+//------------------------------------------------------------------------------------------------
+
+ClusterFileWriter::ClusterFileWriter() : pixelname(""), writepixels(false), failed(false)
+{
+
+}
+
+ClusterFileWriter::~ClusterFileWriter()
+{
+    if(file.is_open())
+        Close();
+}
+
+bool ClusterFileWriter::Open(std::string filename, std::string sourcefile, bool writepixels)
+{
+    if(file.is_open())
+        Close();
+
+    if(filename == "")
+        return false;
+
+    header = ClusterFileHeader();
+    if(sourcefile != "" && !BinaryFileFunctions::GetFileKey(sourcefile, header.source))
+        return false;
+
+    this->writepixels = writepixels;
+    pixelname = filename + ".pixels.part";
+    failed    = false;
+
+    if(!file.Open(filename))
+        return false;
+
+    if(writepixels)
+    {
+        pixelfile.open(pixelname.c_str(), std::ios::in | std::ios::out | std::ios::binary
+                                            | std::ios::trunc);
+        if(!pixelfile.is_open())
+        {
+            Discard();
+            return false;
+        }
+    }
+
+    //the header is written again with the correct counts in Close():
+    file.stream().write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    return file.stream().good();
+}
+
+bool ClusterFileWriter::Add(ClusterRecord record, const uint64_t* pixels)
+{
+    if(!file.is_open() || failed)
+        return false;
+
+    record.firstpixel = header.numpixels;
+    if(writepixels)
+    {
+        if(pixels == nullptr && record.size > 0)
+        {
+            failed = true;
+            return false;
+        }
+
+        pixelfile.write(reinterpret_cast<const char*>(pixels),
+                        std::streamsize(record.size * sizeof(uint64_t)));
+        header.numpixels += record.size;
+    }
+
+    file.stream().write(reinterpret_cast<const char*>(&record), sizeof(record));
+    if(!file.stream().good() || (writepixels && !pixelfile.good()))
+    {
+        failed = true;
+        return false;
+    }
+
+    ++header.numclusters;
+    return true;
+}
+
+bool ClusterFileWriter::Close()
+{
+    if(!file.is_open())
+        return false;
+
+    std::fstream& f = file.stream();
+
+    //the pixel list follows the records:
+    if(writepixels && !failed)
+    {
+        pixelfile.flush();
+        pixelfile.seekg(0, std::ios::beg);
+
+        std::vector<char> block(1 << 20);
+        while(pixelfile.good())
+        {
+            pixelfile.read(&block[0], std::streamsize(block.size()));
+            if(pixelfile.gcount() > 0)
+                f.write(&block[0], pixelfile.gcount());
+        }
+        failed |= !pixelfile.eof();
+    }
+    if(pixelfile.is_open())
+        pixelfile.close();
+    std::remove(pixelname.c_str());
+
+    if(failed)
+    {
+        file.Discard();
+        return false;
+    }
+
+    f.seekp(0, std::ios::beg);
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    return file.Commit();
+}
+
+void ClusterFileWriter::Discard()
+{
+    file.Discard();
+    if(pixelfile.is_open())
+        pixelfile.close();
+    std::remove(pixelname.c_str());
+}
+
+bool ClusterFileWriter::is_open() const
+{
+    return file.is_open();
+}
+
+uint64_t ClusterFileWriter::GetNumClusters() const
+{
+    return header.numclusters;
+}
+
+//------------------------------------------------------------------------------------------------
+
+MappedClusterFile::MappedClusterFile() : records(nullptr), pixels(nullptr), numclusters(0),
+    opened(false)
+{
+
+}
+
+MappedClusterFile::~MappedClusterFile()
+{
+    Close();
+}
+
+bool MappedClusterFile::Open(std::string filename, std::string sourcefile)
+{
+    Close();
+
+    FileKey expected;
+    if(sourcefile != "" && !BinaryFileFunctions::GetFileKey(sourcefile, expected))
+        return false;
+
+    if(!file.Open(filename))
+        return false;
+
+    ClusterFileHeader header;
+    ClusterFileHeader reference;
+    if(file.size() < sizeof(ClusterFileHeader))
+    {
+        file.Close();
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if(std::strncmp(header.magic, reference.magic, sizeof(header.magic)) != 0
+            || header.version != ClusterFileVersion || header.recordsize != sizeof(ClusterRecord)
+            || file.size() != sizeof(ClusterFileHeader)
+                                + header.numclusters * sizeof(ClusterRecord)
+                                + header.numpixels * sizeof(uint64_t)
+            || (sourcefile != "" && !(header.source == expected)))
+    {
+        file.Close();
+        return false;
+    }
+
+    numclusters = header.numclusters;
+    records     = reinterpret_cast<const ClusterRecord*>(file.data() + sizeof(ClusterFileHeader));
+    if(header.numpixels > 0)
+        pixels = reinterpret_cast<const uint64_t*>(file.data() + sizeof(ClusterFileHeader)
+                                                   + numclusters * sizeof(ClusterRecord));
+
+    opened = true;
+    return true;
+}
+
+void MappedClusterFile::Close()
+{
+    file.Close();
+    records     = nullptr;
+    pixels      = nullptr;
+    numclusters = 0;
+    opened      = false;
+}
+
+bool MappedClusterFile::is_open() const
+{
+    return opened;
+}
+
+const ClusterRecord* MappedClusterFile::begin() const
+{
+    return records;
+}
+
+const ClusterRecord* MappedClusterFile::end() const
+{
+    return records + numclusters;
+}
+
+uint64_t MappedClusterFile::size() const
+{
+    return numclusters;
+}
+
+const ClusterRecord& MappedClusterFile::operator[](uint64_t index) const
+{
+    return records[index];
+}
+
+bool MappedClusterFile::HasPixels() const
+{
+    return pixels != nullptr;
+}
+
+const uint64_t* MappedClusterFile::Pixels(uint64_t index) const
+{
+    if(pixels == nullptr)
+        return nullptr;
+
+    return pixels + records[index].firstpixel;
+}
+
+#endif //clusterfilesources
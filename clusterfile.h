@@ -0,0 +1,222 @@
+#ifndef __CLUSTERFILE
+#define __CLUSTERFILE
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <stdint.h>
+
+#include "binaryfile.h"
+
+/*
+ * Binary cluster files store one fixed size summary record per cluster behind a fixed size header,
+ * optionally followed by a pixel list: for every cluster the indices of its hits in the binary
+ * hit file (see hitfile.h) the clusters were generated from. The records alone are enough for
+ * cluster size, position and ToT distributions; the pixel list gives access to the hits for shape
+ * and time studies without clustering the hits again.
+ * The header stores size and modification time of the decoded text file, like the hit cache, so
+ * pixel lists can be checked against the hit cache they refer to.
+ */
+
+/**
+ * @brief ClusterFileHeader is the fixed size (64 bytes) header of a cluster file
+ */
+struct ClusterFileHeader
+{
+    ClusterFileHeader();
+
+    char     magic[8];          //"AP3CLUS" + '\0'
+    uint32_t version;           //format version, see ClusterFileVersion
+    uint32_t recordsize;        //sizeof(ClusterRecord) of the writing program
+    uint64_t numclusters;       //number of records following the header
+    uint64_t numpixels;         //number of pixel list entries behind the records (0 for none)
+    FileKey  source;            //size and modification time of the text file the hits were
+                                //  decoded to (24 bytes)
+    uint64_t reserved;
+};
+
+const uint32_t ClusterFileVersion = 1;
+
+/**
+ * @brief ClusterRecord is the summary of one cluster (48 bytes)
+ */
+struct ClusterRecord
+{
+    ClusterRecord();
+
+    int64_t  time;              //time stamp of the first hit
+    uint64_t firstpixel;        //index of the first hit of the cluster in the pixel list
+    float    column;            //mean column of the hits
+    float    row;               //mean row of the hits
+    uint32_t size;              //number of hits
+    int32_t  duration;          //time stamp difference between the last and the first hit
+    int32_t  tot;               //sum of the ToT values of the hits
+    int16_t  layer;
+    int16_t  startcolumn;
+    int16_t  endcolumn;
+    int16_t  startrow;
+    int16_t  endrow;
+    int16_t  reserved;
+};
+
+/**
+ * @brief ClusterFileWriter writes cluster records and their pixel lists. The pixel list is
+ *      collected in a second temporary file and appended on Close(). As for the hit files, the
+ *      file only gets its final name after it was written completely.
+ */
+class ClusterFileWriter
+{
+public:
+    ClusterFileWriter();
+    ~ClusterFileWriter();
+
+    /**
+     * @brief Open creates the cluster file
+     * @param filename          - the cluster file to write
+     * @param sourcefile        - the decoded text file the hits originate from (its size and
+     *                              modification time are stored), empty for none
+     * @param writepixels       - store the pixel lists of the clusters
+     * @return                  - true on success
+     */
+    bool Open(std::string filename, std::string sourcefile = "", bool writepixels = true);
+    /**
+     * @brief Add appends a cluster
+     * @param record            - the summary of the cluster, `firstpixel` is set by the writer
+     * @param pixels            - the indices of the `record.size` hits of the cluster in the hit
+     *                              file, ignored if no pixel lists are written
+     * @return                  - false if the file is not open or writing failed
+     */
+    bool Add(ClusterRecord record, const uint64_t* pixels = nullptr);
+    /**
+     * @brief Close appends the pixel list, finalises the header and moves the file to its final
+     *      name
+     * @return                  - true if all data has been written successfully
+     */
+    bool Close();
+    /**
+     * @brief Discard closes and deletes the incomplete file
+     */
+    void Discard();
+
+    bool     is_open() const;
+    uint64_t GetNumClusters() const;
+
+private:
+    ClusterFileWriter(const ClusterFileWriter&);
+    ClusterFileWriter& operator=(const ClusterFileWriter&);
+
+    AtomicFileWriter  file;
+    std::fstream      pixelfile;
+    std::string       pixelname;
+    ClusterFileHeader header;
+    bool              writepixels;
+    bool              failed;
+};
+
+/**
+ * @brief MappedClusterFile gives read-only access to a cluster file. On linux the file is memory
+ *      mapped, on other systems it is read into memory.
+ */
+class MappedClusterFile
+{
+public:
+    MappedClusterFile();
+    ~MappedClusterFile();
+
+    /**
+     * @brief Open maps the cluster file
+     * @param filename          - the cluster file to open
+     * @param sourcefile        - if not empty, the file is only accepted if size and modification
+     *                              time of this file match the ones stored in the header
+     * @return                  - true if the file could be mapped and is valid
+     */
+    bool Open(std::string filename, std::string sourcefile = "");
+    void Close();
+
+    bool                 is_open() const;
+    const ClusterRecord* begin() const;
+    const ClusterRecord* end() const;
+    uint64_t             size() const;
+    const ClusterRecord& operator[](uint64_t index) const;
+
+    bool            HasPixels() const;
+    /**
+     * @brief Pixels gives the hit indices of a cluster
+     * @param index             - index of the cluster
+     * @return                  - pointer to the `size` indices of the cluster, nullptr if the file
+     *                              has no pixel list
+     */
+    const uint64_t* Pixels(uint64_t index) const;
+
+private:
+    MappedClusterFile(const MappedClusterFile&);
+    MappedClusterFile& operator=(const MappedClusterFile&);
+
+    FileMapping          file;
+    const ClusterRecord* records;
+    const uint64_t*      pixels;
+    uint64_t             numclusters;
+    bool                 opened;
+};
+
+namespace ClusterFileFunctions {
+
+    /**
+     * @brief Summarise calculates the record for the hits of a cluster
+     * @param begin             - iterator to the first hit of the cluster (in time order)
+     * @param end               - iterator behind the last hit of the cluster
+     * @param layer             - layer of the cluster
+     * @param time              - functor returning the time stamp of a hit
+     * @param tot               - functor returning the ToT of a hit
+     * @return                  - the record (`firstpixel` not set)
+     */
+    template<class Iterator, class TimeOf, class ToTOf>
+    ClusterRecord Summarise(Iterator begin, Iterator end, int layer, TimeOf time, ToTOf tot);
+
+}
+
+template<class Iterator, class TimeOf, class ToTOf>
+ClusterRecord ClusterFileFunctions::Summarise(Iterator begin, Iterator end, int layer,
+                                              TimeOf time, ToTOf tot)
+{
+    ClusterRecord record;
+    record.layer = layer;
+    if(begin == end)
+        return record;
+
+    record.time        = time(*begin);
+    record.startcolumn = begin->column;
+    record.endcolumn   = begin->column;
+    record.startrow    = begin->row;
+    record.endrow      = begin->row;
+
+    long long last   = record.time;
+    double    column = 0;
+    double    row    = 0;
+    for(Iterator it = begin; it != end; ++it)
+    {
+        ++record.size;
+        column     += it->column;
+        row        += it->row;
+        record.tot += tot(*it);
+
+        if(time(*it) > last)
+            last = time(*it);
+        if(it->column < record.startcolumn)
+            record.startcolumn = it->column;
+        else if(it->column > record.endcolumn)
+            record.endcolumn = it->column;
+        if(it->row < record.startrow)
+            record.startrow = it->row;
+        else if(it->row > record.endrow)
+            record.endrow = it->row;
+    }
+
+    record.column   = column / record.size;
+    record.row      = row / record.size;
+    record.duration = last - record.time;
+
+    return record;
+}
+
+#endif //__CLUSTERFILE
@@ -0,0 +1,150 @@
+#ifndef clusteringsources
+#define clusteringsources
+
+#include "clustering.h"
+
+UnionFind::UnionFind(uint64_t size)
+{
+    Reset(size);
+}
+
+void UnionFind::Reset(uint64_t size)
+{
+    parent.resize(size);
+    for(uint64_t i = 0; i < size; ++i)
+        parent[i] = i;
+}
+
+uint64_t UnionFind::Find(uint64_t index)
+{
+    //path halving: every visited element is linked to its grandparent
+    while(parent[index] != index)
+    {
+        parent[index] = parent[parent[index]];
+        index = parent[index];
+    }
+
+    return index;
+}
+
+bool UnionFind::Unite(uint64_t one, uint64_t two)
+{
+    one = Find(one);
+    two = Find(two);
+
+    if(one == two)
+        return false;
+
+    //keep the smaller index as representative:
+    if(one < two)
+        parent[two] = one;
+    else
+        parent[one] = two;
+
+    return true;
+}
+
+void UnionFind::SetRepresentative(uint64_t index, uint64_t representative)
+{
+    parent[index] = representative;
+}
+
+uint64_t UnionFind::GetSize() const
+{
+    return parent.size();
+}
+
+//------------------------------------------------------------------------------------------------
+
+uint64_t ClusterList::GetNumClusters() const
+{
+    return (offsets.size() > 0)?offsets.size() - 1:0;
+}
+
+uint64_t ClusterList::GetSize(uint64_t cluster) const
+{
+    return offsets[cluster + 1] - offsets[cluster];
+}
+
+void ClusterList::Clear()
+{
+    hits.clear();
+    offsets.clear();
+}
+
+//------------------------------------------------------------------------------------------------
+
+void ClusteringFunctions::Group(UnionFind& sets, ClusterList& clusters)
+{
+    const uint64_t numhits = sets.GetSize();
+
+    //number the clusters in the order of their representatives (= their first hits):
+    std::vector<uint64_t> label(numhits);
+    std::vector<uint64_t> sizes;
+    for(uint64_t i = 0; i < numhits; ++i)
+    {
+        uint64_t root = sets.Find(i);
+        if(root == i)
+        {
+            label[i] = sizes.size();
+            sizes.push_back(1);
+        }
+        else
+        {
+            label[i] = label[root];
+            ++sizes[label[i]];
+        }
+    }
+
+    clusters.offsets.resize(sizes.size() + 1);
+    clusters.offsets[0] = 0;
+    for(uint64_t k = 0; k < sizes.size(); ++k)
+        clusters.offsets[k + 1] = clusters.offsets[k] + sizes[k];
+
+    //counting sort of the hits by cluster keeps the input order within the clusters:
+    std::vector<uint64_t> position(clusters.offsets.begin(), clusters.offsets.end() - 1);
+    clusters.hits.resize(numhits);
+    for(uint64_t i = 0; i < numhits; ++i)
+        clusters.hits[position[label[i]]++] = i;
+}
+
+std::vector<std::pair<int, int> > ClusteringFunctions::Neighbours(const PixelNeighbourhood& nearby)
+{
+    //the neighbourhood is finite as the column weight is positive:
+    int maxrow = 0;
+    while(nearby.Contains(0, maxrow + 1))
+        ++maxrow;
+    int maxcolumn = 0;
+    while(nearby.Contains(maxcolumn + 1, 0))
+        ++maxcolumn;
+
+    std::vector<std::pair<int, int> > neighbours;
+    for(int column = -maxcolumn; column <= maxcolumn; ++column)
+        for(int row = -maxrow; row <= maxrow; ++row)
+            if(nearby.Contains(column, row))
+                neighbours.push_back(std::make_pair(column, row));
+
+    return neighbours;
+}
+
+//------------------------------------------------------------------------------------------------
+
+const uint64_t HitClusterer::none;
+
+HitClusterer::HitClusterer(long long timedist, const PixelNeighbourhood& nearby) :
+    timedist(timedist), neighbours(ClusteringFunctions::Neighbours(nearby))
+{
+
+}
+
+long long HitClusterer::GetTimeDistance() const
+{
+    return timedist;
+}
+
+const std::vector<std::pair<int, int> >& HitClusterer::GetNeighbours() const
+{
+    return neighbours;
+}
+
+#endif //clusteringsources
@@ -0,0 +1,721 @@
+#ifndef __CLUSTERING
+#define __CLUSTERING
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+
+#include "pixeldistance.h"
+#include "threads.h"
+
+/*
+ * Clustering of time sorted hits. Two hits belong to the same cluster if their time stamps differ
+ * by less than the time window and their pixels are neighbours (see PixelNeighbourhood). The
+ * clusters are the connected components of this relation, found with a union-find structure.
+ * The neighbours of a hit are looked up in a hash grid over column and row, where each bucket
+ * chains the hits of a pixel from the newest to the oldest. Walking a chain stops at the first hit
+ * outside of the time window, so the effort is proportional to the number of hits times the size
+ * of the neighbourhood, independent of the number of open clusters.
+ * The hit class is a template parameter (it needs the members `column` and `row`, the time stamp
+ * is read with a functor): the telescope analysis clusters its hits by `ts`, the single chip
+ * analysis its own Dataset class by `timestamp`.
+ * For parallel clustering, the hit array is cut into time slices, preferably at gaps longer than
+ * the time window. Every slice is clustered on its own including the hits within the time window
+ * before it, and the connections across the slice borders are merged afterwards.
+ * For data read in chunks, the StreamingClusterer takes the hits one by one and returns a cluster
+ * as soon as the stream has passed its time window, so only the open clusters are kept in memory.
+ */
+
+/**
+ * @brief UnionFind keeps a partition of the indices 0 to size - 1 into disjoint sets. The
+ *      representative of a set is always its smallest index.
+ */
+class UnionFind
+{
+public:
+    UnionFind(uint64_t size = 0);
+
+    /**
+     * @brief Reset puts every index into a set of its own
+     * @param size              - the number of indices
+     */
+    void Reset(uint64_t size);
+
+    /**
+     * @brief Find returns the representative of the set containing `index`
+     * @param index             - the index to look up
+     * @return                  - the smallest index in the set
+     */
+    uint64_t Find(uint64_t index);
+    /**
+     * @brief Unite merges the sets containing the two indices
+     * @param one               - index in the first set
+     * @param two               - index in the second set
+     * @return                  - false if the indices were already in the same set
+     */
+    bool Unite(uint64_t one, uint64_t two);
+    /**
+     * @brief SetRepresentative links an index directly to the representative of its set. It does
+     *      not check anything, but can be called concurrently for different indices.
+     * @param index             - the index to link
+     * @param representative    - the representative of the set, not larger than `index`
+     */
+    void SetRepresentative(uint64_t index, uint64_t representative);
+
+    uint64_t GetSize() const;
+
+private:
+    std::vector<uint64_t> parent;
+};
+
+/**
+ * @brief ClusterList contains the clusters as lists of hit indices. The hits of cluster `k` are
+ *      hits[offsets[k]] to hits[offsets[k + 1] - 1], in the order of the input. The clusters are
+ *      sorted by their first hit.
+ */
+struct ClusterList
+{
+    std::vector<uint64_t> hits;
+    std::vector<uint64_t> offsets;
+
+    uint64_t GetNumClusters() const;
+    uint64_t GetSize(uint64_t cluster) const;
+    void     Clear();
+};
+
+namespace ClusteringFunctions {
+
+    /**
+     * @brief Group collects the sets of a union-find structure into a cluster list
+     * @param sets              - the partition of the hits
+     * @param clusters          - the container to write the clusters to (overwritten)
+     */
+    void Group(UnionFind& sets, ClusterList& clusters);
+
+    /**
+     * @brief Neighbours lists the pixel offsets inside a neighbourhood
+     * @param nearby            - the neighbourhood of a pixel
+     * @return                  - the (column, row) offsets including (0, 0)
+     */
+    std::vector<std::pair<int, int> > Neighbours(const PixelNeighbourhood& nearby);
+
+    /**
+     * @brief FindSlices cuts a time sorted hit array into slices of about equal size. A border is
+     *      moved forward to a gap of at least `timedist` if there is one within a quarter of the
+     *      slice size, so no cluster crosses it.
+     * @param hits              - the time sorted hits
+     * @param numhits           - number of hits in the array
+     * @param time              - functor returning the time stamp of a hit
+     * @param timedist          - the time window of the clustering
+     * @param numslices         - the number of slices to create
+     * @return                  - the first index of every slice followed by `numhits`
+     */
+    template<class Hit, class TimeOf>
+    std::vector<uint64_t> FindSlices(const Hit* hits, uint64_t numhits, TimeOf time,
+                                     long long timedist, unsigned int numslices);
+
+    /**
+     * @brief ClusterParallel finds the clusters in a time sorted hit array with several threads.
+     *      The result is identical to HitClusterer::Cluster().
+     * @param hits              - the time sorted hits
+     * @param numhits           - number of hits in the array
+     * @param timedist          - the time window for connected hits (in time stamp units)
+     * @param nearby            - the neighbourhood of a pixel
+     * @param time              - functor returning the time stamp of a hit
+     * @param clusters          - the container to write the clusters to (overwritten)
+     * @param numthreads        - maximum number of threads, 0 for one per CPU core
+     * @return                  - false if the hits are not sorted by time
+     */
+    template<class Hit, class TimeOf>
+    bool ClusterParallel(const Hit* hits, uint64_t numhits, long long timedist,
+                         const PixelNeighbourhood& nearby, TimeOf time, ClusterList& clusters,
+                         unsigned int numthreads = 0);
+
+    //smallest number of hits per slice for the parallel clustering:
+    const uint64_t minslicesize = 65536;
+
+}
+
+/**
+ * @brief HitClusterer finds the clusters in time sorted hit arrays
+ */
+class HitClusterer
+{
+public:
+    /**
+     * @brief HitClusterer sets up the clustering criteria
+     * @param timedist          - hits with a time stamp difference below `timedist` can be
+     *                              connected (in time stamp units)
+     * @param nearby            - the neighbourhood of a pixel
+     */
+    HitClusterer(long long timedist, const PixelNeighbourhood& nearby);
+
+    /**
+     * @brief Cluster finds the clusters in a time sorted hit array
+     * @param hits              - the time sorted hits
+     * @param numhits           - number of hits in the array
+     * @param time              - functor returning the time stamp of a hit
+     * @param clusters          - the container to write the clusters to (overwritten)
+     * @return                  - false if the hits are not sorted by time
+     */
+    template<class Hit, class TimeOf>
+    bool Cluster(const Hit* hits, uint64_t numhits, TimeOf time, ClusterList& clusters);
+
+    /**
+     * @brief Connect passes all connected pairs of hits to `pair` without grouping them
+     * @param hits              - the time sorted hits
+     * @param numhits           - number of hits in the array
+     * @param time              - functor returning the time stamp of a hit
+     * @param pair              - called as pair(newer index, older index) for connected hits
+     * @return                  - false if the hits are not sorted by time
+     */
+    template<class Hit, class TimeOf, class PairAction>
+    bool Connect(const Hit* hits, uint64_t numhits, TimeOf time, PairAction&& pair);
+
+    long long GetTimeDistance() const;
+    const std::vector<std::pair<int, int> >& GetNeighbours() const;
+
+    static const uint64_t none = uint64_t(-1);
+    static const int      columnbits = 8;
+    static const int      rowbits    = 9;
+
+    /**
+     * @brief Bucket calculates the hash grid bucket of a pixel. Addresses on the ATLASPix3 matrix
+     *      (132 x 372 pixels) do not collide.
+     * @param column            - column of the pixel
+     * @param row               - row of the pixel
+     * @return                  - the bucket index
+     */
+    static uint64_t Bucket(int column, int row)
+    {
+        return (uint64_t(column & ((1 << columnbits) - 1)) << rowbits)
+                | uint64_t(row & ((1 << rowbits) - 1));
+    }
+
+private:
+    /**
+     * @brief Link refers to a hit in a bucket chain. The time stamp is stored with the index, so
+     *      buckets without recent hits are skipped without reading the hit array.
+     */
+    struct Link
+    {
+        uint64_t  index;
+        long long ts;
+    };
+
+    long long timedist;
+    std::vector<std::pair<int, int> > neighbours;   //pixel offsets inside the neighbourhood
+    std::vector<Link> heads;                        //newest hit per bucket
+    std::vector<Link> previous;                     //next older hit in the same bucket
+    UnionFind sets;
+};
+
+template<class Hit, class TimeOf, class PairAction>
+bool HitClusterer::Connect(const Hit* hits, uint64_t numhits, TimeOf time, PairAction&& pair)
+{
+    for(uint64_t i = 1; i < numhits; ++i)
+        if(time(hits[i]) < time(hits[i - 1]))
+        {
+            std::cerr << "HitClusterer: hits are not sorted by time" << std::endl;
+            return false;
+        }
+
+    const Link empty = {none, 0};
+    heads.assign(uint64_t(1) << (columnbits + rowbits), empty);
+    previous.resize(numhits);
+
+    for(uint64_t i = 0; i < numhits; ++i)
+    {
+        const Hit& hit = hits[i];
+        const long long ts = time(hit);
+
+        for(auto& offset : neighbours)
+        {
+            const int column = hit.column + offset.first;
+            const int row    = hit.row + offset.second;
+
+            //the chain is sorted from new to old, so it ends at the first hit out of the window:
+            for(Link link = heads[Bucket(column, row)]; link.index != none;
+                    link = previous[link.index])
+            {
+                if(ts - link.ts >= timedist)
+                    break;
+                if(hits[link.index].column == column && hits[link.index].row == row)
+                    pair(i, link.index);
+            }
+        }
+
+        const uint64_t bucket = Bucket(hit.column, hit.row);
+        previous[i] = heads[bucket];
+        heads[bucket].index = i;
+        heads[bucket].ts    = ts;
+    }
+
+    return true;
+}
+
+template<class Hit, class TimeOf>
+bool HitClusterer::Cluster(const Hit* hits, uint64_t numhits, TimeOf time, ClusterList& clusters)
+{
+    sets.Reset(numhits);
+
+    if(!Connect(hits, numhits, time, [&](uint64_t one, uint64_t two) { sets.Unite(one, two); }))
+    {
+        clusters.Clear();
+        return false;
+    }
+
+    ClusteringFunctions::Group(sets, clusters);
+
+    return true;
+}
+
+template<class Hit, class TimeOf>
+std::vector<uint64_t> ClusteringFunctions::FindSlices(const Hit* hits, uint64_t numhits,
+                                                      TimeOf time, long long timedist,
+                                                      unsigned int numslices)
+{
+    std::vector<uint64_t> borders(1, 0);
+    if(numslices < 1)
+        numslices = 1;
+
+    const uint64_t slicesize   = numhits / numslices;
+    const uint64_t searchlimit = slicesize / 4;
+
+    for(unsigned int k = 1; k < numslices; ++k)
+    {
+        uint64_t border = k * slicesize;
+        if(border <= borders.back())
+            continue;
+
+        for(uint64_t i = border; i < border + searchlimit && i < numhits; ++i)
+            if(time(hits[i]) - time(hits[i - 1]) >= timedist)
+            {
+                border = i;
+                break;
+            }
+
+        if(border < numhits)
+            borders.push_back(border);
+    }
+    borders.push_back(numhits);
+
+    return borders;
+}
+
+template<class Hit, class TimeOf>
+bool ClusteringFunctions::ClusterParallel(const Hit* hits, uint64_t numhits, long long timedist,
+                                          const PixelNeighbourhood& nearby, TimeOf time,
+                                          ClusterList& clusters, unsigned int numthreads)
+{
+    numthreads = ThreadFunctions::GetNumThreads(numthreads);
+    if(numthreads == 1 || numhits < 2 * minslicesize)
+    {
+        HitClusterer clusterer(timedist, nearby);
+        return clusterer.Cluster(hits, numhits, time, clusters);
+    }
+
+    for(uint64_t i = 1; i < numhits; ++i)
+        if(time(hits[i]) < time(hits[i - 1]))
+        {
+            std::cerr << "ClusterParallel: hits are not sorted by time" << std::endl;
+            clusters.Clear();
+            return false;
+        }
+
+    //more slices than threads to balance differences in the hit density:
+    unsigned int numslices = 4 * numthreads;
+    if(numhits / numslices < minslicesize)
+        numslices = numhits / minslicesize;
+    const std::vector<uint64_t> borders = FindSlices(hits, numhits, time, timedist, numslices);
+    numslices = borders.size() - 1;
+
+    UnionFind sets(numhits);
+    //connections to hits of earlier slices (global indices):
+    std::vector<std::vector<std::pair<uint64_t, uint64_t> > > crossing(numslices);
+
+    std::atomic<unsigned int> nextslice(0);
+    auto worker = [&]()
+    {
+        HitClusterer clusterer(timedist, nearby);
+        UnionFind    local;
+
+        unsigned int k;
+        while((k = nextslice++) < numslices)
+        {
+            const uint64_t start = borders[k];
+            const uint64_t end   = borders[k + 1];
+
+            //include the hits before the border the first hits can be connected to:
+            uint64_t overlap = start;
+            while(overlap > 0 && time(hits[start]) - time(hits[overlap - 1]) < timedist)
+                --overlap;
+
+            local.Reset(end - start);
+            clusterer.Connect(hits + overlap, end - overlap, time,
+                [&](uint64_t one, uint64_t two)
+                {
+                    one += overlap;
+                    two += overlap;
+                    //pairs inside the overlap belong to the previous slice:
+                    if(one < start)
+                        return;
+                    if(two < start)
+                        crossing[k].push_back(std::make_pair(one, two));
+                    else
+                        local.Unite(one - start, two - start);
+                });
+
+            for(uint64_t i = start; i < end; ++i)
+                sets.SetRepresentative(i, start + local.Find(i - start));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numthreads && i < numslices; ++i)
+        threads.push_back(std::thread(worker));
+    worker();
+    for(auto& it : threads)
+        it.join();
+
+    for(auto& slice : crossing)
+        for(auto& it : slice)
+            sets.Unite(it.first, it.second);
+
+    Group(sets, clusters);
+
+    return true;
+}
+
+/**
+ * @brief StreamingClusterer clusters a stream of time sorted hits. A cluster is closed and put into
+ *      a queue as soon as the time stamp of the stream is at least the time window behind its
+ *      last hit. The closed clusters contain the same hits as the ones from HitClusterer, ordered
+ *      by their input order, but the queue is ordered by the last hits of the clusters.
+ *      Hits older than the newest hit added are treated as if they had its time stamp.
+ */
+template<class Hit, class TimeOf>
+class StreamingClusterer
+{
+public:
+    /**
+     * @brief StreamingClusterer sets up the clustering criteria
+     * @param timedist          - hits with a time stamp difference below `timedist` can be
+     *                              connected (in time stamp units)
+     * @param nearby            - the neighbourhood of a pixel
+     * @param time              - functor returning the time stamp of a hit
+     */
+    StreamingClusterer(long long timedist, const PixelNeighbourhood& nearby,
+                       TimeOf time = TimeOf());
+
+    /**
+     * @brief Add adds a hit to the stream and closes the clusters it has passed
+     * @param hit               - the next hit
+     */
+    void Add(const Hit& hit);
+    template<class Iterator>
+    void Add(Iterator begin, Iterator end);
+    /**
+     * @brief Finish closes all open clusters. Hits added afterwards start a new stream.
+     */
+    void Finish();
+
+    /**
+     * @brief Pop takes the oldest closed cluster from the queue
+     * @param cluster           - the container to move the hits of the cluster to
+     * @return                  - false if no closed cluster is available
+     */
+    bool Pop(std::vector<Hit>& cluster);
+
+    uint64_t GetNumOpenClusters() const;
+    uint64_t GetNumClosedClusters() const;  //clusters waiting in the queue
+    uint64_t GetNumLateHits() const;
+
+private:
+    static const uint64_t none = uint64_t(-1);
+
+    struct Link
+    {
+        uint64_t  index;                    //sequence number of the hit
+        long long ts;
+    };
+
+    //hits within the time window of the newest hit:
+    struct Recent
+    {
+        int       column;
+        int       row;
+        long long ts;
+        uint64_t  slot;                     //cluster the hit was added to
+        Link      previous;                 //next older hit in the same bucket
+    };
+
+    struct Slot
+    {
+        std::vector<std::pair<uint64_t, Hit> > hits;   //hits with their sequence numbers
+        long long last;                     //time stamp of the last hit
+        uint64_t  forward;                  //cluster this one was merged into
+        bool      used;
+    };
+
+    uint64_t Resolve(uint64_t slot);
+    uint64_t Merge(uint64_t one, uint64_t two);
+    uint64_t NewSlot();
+    void     Close(long long limit);
+
+    long long timedist;
+    std::vector<std::pair<int, int> > neighbours;
+    TimeOf    time;
+
+    std::vector<Link>    heads;
+    std::deque<Recent>   recent;
+    uint64_t             nextsequence;      //sequence number of the next hit
+    std::vector<Slot>    slots;
+    std::vector<uint64_t> freeslots;
+    std::deque<std::pair<long long, uint64_t> > events;  //(time of a hit, its cluster)
+    std::deque<std::vector<Hit> > closed;
+
+    long long now;                          //time stamp of the newest hit
+    bool      started;
+    uint64_t  numopen;
+    uint64_t  latehits;
+};
+
+template<class Hit, class TimeOf>
+const uint64_t StreamingClusterer<Hit, TimeOf>::none;
+
+template<class Hit, class TimeOf>
+StreamingClusterer<Hit, TimeOf>::StreamingClusterer(long long timedist,
+                                                    const PixelNeighbourhood& nearby,
+                                                    TimeOf time) :
+    timedist(timedist), neighbours(ClusteringFunctions::Neighbours(nearby)), time(time),
+    nextsequence(0), now(0), started(false), numopen(0), latehits(0)
+{
+    const Link empty = {none, 0};
+    heads.assign(uint64_t(1) << (HitClusterer::columnbits + HitClusterer::rowbits), empty);
+}
+
+template<class Hit, class TimeOf>
+void StreamingClusterer<Hit, TimeOf>::Add(const Hit& hit)
+{
+    long long ts = time(hit);
+    if(!started)
+    {
+        now     = ts;
+        started = true;
+    }
+
+    if(ts < now)
+    {
+        ++latehits;
+        ts = now;
+    }
+    else if(ts > now)
+    {
+        now = ts;
+        Close(now - timedist);
+
+        //hits out of the window can not be connected any more:
+        while(recent.size() > 0 && now - recent.front().ts >= timedist)
+            recent.pop_front();
+    }
+
+    const uint64_t firstsequence = nextsequence - recent.size();
+
+    uint64_t target = none;
+    for(auto& offset : neighbours)
+    {
+        const int column = hit.column + offset.first;
+        const int row    = hit.row + offset.second;
+
+        //the time check comes first, so removed hits are never accessed:
+        for(Link link = heads[HitClusterer::Bucket(column, row)]; link.index != none;
+                link = recent[link.index - firstsequence].previous)
+        {
+            if(ts - link.ts >= timedist)
+                break;
+
+            const Recent& entry = recent[link.index - firstsequence];
+            if(entry.column != column || entry.row != row)
+                continue;
+
+            uint64_t slot = Resolve(entry.slot);
+            if(target == none)
+                target = slot;
+            else if(slot != target)
+                target = Merge(target, slot);
+        }
+    }
+
+    if(target == none)
+        target = NewSlot();
+
+    slots[target].hits.push_back(std::make_pair(nextsequence, hit));
+    slots[target].last = ts;
+    events.push_back(std::make_pair(ts, target));
+
+    const uint64_t bucket = HitClusterer::Bucket(hit.column, hit.row);
+    Recent entry;
+    entry.column   = hit.column;
+    entry.row      = hit.row;
+    entry.ts       = ts;
+    entry.slot     = target;
+    entry.previous = heads[bucket];
+    recent.push_back(entry);
+
+    heads[bucket].index = nextsequence;
+    heads[bucket].ts    = ts;
+    ++nextsequence;
+}
+
+template<class Hit, class TimeOf>
+template<class Iterator>
+void StreamingClusterer<Hit, TimeOf>::Add(Iterator begin, Iterator end)
+{
+    for(Iterator it = begin; it != end; ++it)
+        Add(*it);
+}
+
+template<class Hit, class TimeOf>
+void StreamingClusterer<Hit, TimeOf>::Finish()
+{
+    if(!started)
+        return;
+
+    Close(now);
+
+    recent.clear();
+    const Link empty = {none, 0};
+    heads.assign(heads.size(), empty);
+    started = false;
+}
+
+template<class Hit, class TimeOf>
+bool StreamingClusterer<Hit, TimeOf>::Pop(std::vector<Hit>& cluster)
+{
+    if(closed.size() == 0)
+        return false;
+
+    cluster.swap(closed.front());
+    closed.pop_front();
+
+    return true;
+}
+
+template<class Hit, class TimeOf>
+uint64_t StreamingClusterer<Hit, TimeOf>::GetNumOpenClusters() const
+{
+    return numopen;
+}
+
+template<class Hit, class TimeOf>
+uint64_t StreamingClusterer<Hit, TimeOf>::GetNumClosedClusters() const
+{
+    return closed.size();
+}
+
+template<class Hit, class TimeOf>
+uint64_t StreamingClusterer<Hit, TimeOf>::GetNumLateHits() const
+{
+    return latehits;
+}
+
+template<class Hit, class TimeOf>
+uint64_t StreamingClusterer<Hit, TimeOf>::Resolve(uint64_t slot)
+{
+    uint64_t root = slot;
+    while(slots[root].forward != none)
+        root = slots[root].forward;
+
+    //shorten the path for the next lookups:
+    while(slots[slot].forward != none)
+    {
+        uint64_t next = slots[slot].forward;
+        slots[slot].forward = root;
+        slot = next;
+    }
+
+    return root;
+}
+
+template<class Hit, class TimeOf>
+uint64_t StreamingClusterer<Hit, TimeOf>::Merge(uint64_t one, uint64_t two)
+{
+    //the hits of the smaller cluster are moved:
+    if(slots[one].hits.size() < slots[two].hits.size())
+        std::swap(one, two);
+
+    slots[one].hits.insert(slots[one].hits.end(), slots[two].hits.begin(),
+                           slots[two].hits.end());
+    slots[two].hits.clear();
+    //the merged slot stays in use as a forward until its hits leave the time window:
+    slots[two].forward = one;
+    --numopen;
+
+    return one;
+}
+
+template<class Hit, class TimeOf>
+uint64_t StreamingClusterer<Hit, TimeOf>::NewSlot()
+{
+    uint64_t slot;
+    if(freeslots.size() > 0)
+    {
+        slot = freeslots.back();
+        freeslots.pop_back();
+    }
+    else
+    {
+        slot = slots.size();
+        slots.push_back(Slot());
+    }
+
+    slots[slot].hits.clear();
+    slots[slot].last    = now;
+    slots[slot].forward = none;
+    slots[slot].used    = true;
+    ++numopen;
+
+    return slot;
+}
+
+template<class Hit, class TimeOf>
+void StreamingClusterer<Hit, TimeOf>::Close(long long limit)
+{
+    while(events.size() > 0 && events.front().first <= limit)
+    {
+        const long long ts   = events.front().first;
+        const uint64_t  slot = events.front().second;
+        events.pop_front();
+
+        //skip outdated events (the cluster got newer hits or was already closed):
+        Slot& cluster = slots[slot];
+        if(!cluster.used || cluster.last != ts)
+            continue;
+
+        if(cluster.forward == none)
+        {
+            std::sort(cluster.hits.begin(), cluster.hits.end(),
+                      [](const std::pair<uint64_t, Hit>& a, const std::pair<uint64_t, Hit>& b)
+                        { return a.first < b.first; });
+
+            closed.push_back(std::vector<Hit>());
+            closed.back().reserve(cluster.hits.size());
+            for(auto& it : cluster.hits)
+                closed.back().push_back(it.second);
+
+            --numopen;
+        }
+
+        cluster.hits.clear();
+        cluster.used = false;
+        freeslots.push_back(slot);
+    }
+}
+
+#endif //__CLUSTERING
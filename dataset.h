@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <iostream>
 
+#include "totcalculation.h"
+
 class Dataset
 {
     public:
@@ -105,23 +107,20 @@ class Dataset
                                          || (column == rhs.column && row < rhs.row)));
         }
 
+        /**
+         * @brief CalculateToT calculates the ToT of the hit from TS1 and TS2
+         * @param ts1ckdiv          - clock divider setting of TS1 (the divider is ts1ckdiv + 1)
+         * @param ts2ckdiv          - clock divider setting of TS2 (the divider is ts2ckdiv + 1)
+         * @return                  - the ToT in units of the base clock
+         */
         int CalculateToT(int ts1ckdiv, int ts2ckdiv) const {
-              const int ts1_size = 1024;
-              const int ts2_size = 128;
-
-              int overflow = ts2_size * (ts2ckdiv + 1);
-
-              if(overflow > ts1_size * (ts1ckdiv + 1)) {overflow = ts1_size * (ts1ckdiv + 1); }
-
-              int ts1_corrected = (shortts * (ts1ckdiv + 1)) % (ts2_size * (ts2ckdiv + 1));
-              int ts2_corrected = (shortts2 * (ts2ckdiv + 1)) % (ts1_size * (ts1ckdiv + 1));
+            int overflow = 128 * (ts2ckdiv + 1);
+            if(overflow > 1024 * (ts1ckdiv + 1))
+                overflow = 1024 * (ts1ckdiv + 1);
 
-              int tot = ts2_corrected - ts1_corrected;
-
-              if (tot < 0) {tot += overflow;}
-
-              return tot;
-            }
+            return ToTCalculationFunctions::CalculateToT(shortts, shortts2, ts1ckdiv + 1,
+                                                         ts2ckdiv + 1, overflow);
+        }
         void Print(){
 
             std::cout << layer << " " << column << " " << row << " " << ts << " " << ts2 << std::endl;
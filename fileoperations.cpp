@@ -1,5 +1,6 @@
 #include "fileoperations.h"
 
+#ifndef fileoperationssources
 #define fileoperationssources
 
 std::string ConvertToWinPath(std::string path)
@@ -426,3 +427,4 @@ bool FindKeyBool(StringPairs &data, std::string key, const bool fail)
         return fail;
 }
 
+#endif //fileoperationssources
@@ -0,0 +1,137 @@
+/**********************************************************
+ * Automatic determination of the time stamp offsets     *
+ * between the telescope layers from decoded data         *
+ *                                                        *
+ * The program reads the decoded hits once, correlates    *
+ * the hit rates of the layers (see offsetfinder.h) and   *
+ * writes an `## Offset` block for the decoder config.    *
+ *                                                        *
+ * Call: find_offsets [config file]                       *
+ *   The decoded file is taken from the `output` key of   *
+ *   the `## Config` section, the offsets used for it     *
+ *   from the `## Offset` section. Optional settings are  *
+ *   read from the `## OffsetSearch` section.             *
+ **********************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "fileoperations.h"
+#include "dataset.h"
+#include "hitfile.h"
+#include "offsetfinder.h"
+
+int main(int argc, char** argv)
+{
+    if(argc != 2)
+    {
+        std::cout << "Not all call parameters passed:\n"
+                  << " call \"" << argv[0] << " [config file path]\"" << std::endl;
+        return -1;
+    }
+
+    StringPairs config  = LoadParameterFile(argv[1], "Config");
+    StringPairs offsets = LoadParameterFile(argv[1], "Offset");
+    StringPairs search  = LoadParameterFile(argv[1], "OffsetSearch");
+
+    std::string inputfile  = FindKey(search, "input", FindKey(config, "output", ""));
+    std::string outputfile = FindKey(search, "output", std::string(argv[1]) + ".offset");
+    if(inputfile == "")
+    {
+        std::cerr << "decoded data file missing. Aborting" << std::endl;
+        return -2;
+    }
+
+    unsigned int reference = FindKeyInt(search, "reference", 1);
+    if(reference < 1 || reference > 4)
+    {
+        std::cerr << "invalid reference layer " << reference << ". Aborting" << std::endl;
+        return -3;
+    }
+
+    OffsetFinder finder(reference,
+                        FindKeyInt(search, "binwidth", 1),
+                        FindKeyInt(search, "bins", 2048),
+                        FindKeyInt(search, "coarsebinwidth", 64),
+                        FindKeyInt(search, "coarsebins", 8192),
+                        FindKeyInt(search, "maxsegments", 512));
+
+    HitReader reader;
+    if(!reader.Open(inputfile, FindKeyBool(search, "usecache", true)))
+    {
+        std::cerr << "could not open \"" << inputfile << "\". Aborting" << std::endl;
+        return -4;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    uint64_t numhits = 0;
+    Dataset hit;
+    while(reader.Next(hit))
+    {
+        finder.Add(hit);
+        if(++numhits % 1000000 == 0)
+        {
+            std::cout << numhits << " hits processed\r";
+            std::cout.flush();
+        }
+    }
+    finder.Finish();
+    reader.Close();
+
+    double duration = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                        - start).count();
+    std::cout << numhits << " hits processed in " << duration << " s ("
+              << finder.GetCoarse().GetNumSegments() << " coarse and "
+              << finder.GetFine().GetNumSegments() << " fine segments, "
+              << finder.GetFine().GetNumLateHits() << " hits out of order)" << std::endl;
+
+    std::vector<LayerOffset> result = finder.GetOffsets();
+
+    //the decoded data already contains the offsets from the config file:
+    std::stringstream block("");
+    block << "## Offset\n";
+    for(unsigned int i = 0; i < 4; ++i)
+    {
+        std::string key = std::string("l") + char('1' + i) + "ts1";
+        int current = FindKeyInt(offsets, key, 0);
+
+        std::cout << "Layer " << (i + 1) << ": ";
+        if(!result[i].valid)
+            std::cout << "no result, keeping " << current << std::endl;
+        else if(i + 1 == reference)
+            std::cout << "reference layer" << std::endl;
+        else
+            std::cout << result[i].offset << " +- " << result[i].precision / 2
+                      << " (significance " << result[i].significance << ", "
+                      << result[i].numhits << " hits)" << std::endl;
+
+        block << key << " " << (current + ((result[i].valid)?result[i].offset:0)) << "\n";
+    }
+    //the TS2 offsets are not changed by the correlation:
+    for(unsigned int i = 0; i < 4; ++i)
+    {
+        std::string key = std::string("l") + char('1' + i) + "ts2";
+        block << key << " " << FindKeyInt(offsets, key, 0) << "\n";
+    }
+
+    std::cout << std::endl << block.str() << std::endl;
+
+    std::fstream f;
+    f.open(outputfile.c_str(), std::ios::out | std::ios::trunc);
+    if(!f.is_open())
+    {
+        std::cerr << "could not write \"" << outputfile << "\"" << std::endl;
+        return -5;
+    }
+    f << block.str();
+    f.close();
+
+    std::cout << "Offsets written to \"" << outputfile << "\"" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**********************************************************
+ * Generation of the per-pixel ToT calibration from       *
+ * injection scans                                        *
+ *                                                        *
+ * The program reads the ToT values measured for the      *
+ * injected charges, fits the ToT function to every pixel *
+ * on several threads (see totcalibrationfit.h) and       *
+ * writes a binary calibration file which can be used by  *
+ * `LoadToTCalibration()` in the analysis scripts.        *
+ *                                                        *
+ * Call: fit_totcalibration [scan file] [output file]     *
+ *                          ([threads])                   *
+ *   The scan file contains lines                         *
+ *   "column row charge tot [count]". The pixels which    *
+ *   could not be calibrated are listed in                *
+ *   `[output file].failures`.                            *
+ **********************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+
+#include "totcalibration.h"
+#include "totcalibrationfit.h"
+
+int main(int argc, char** argv)
+{
+    if(argc != 3 && argc != 4)
+    {
+        std::cout << "Not all call parameters passed:\n"
+                  << " call \"" << argv[0] << " [scan file] [output file] ([threads])\""
+                  << std::endl;
+        return -1;
+    }
+
+    std::string scanfile    = argv[1];
+    std::string outputfile  = argv[2];
+    std::string failurefile = outputfile + ".failures";
+    unsigned int numthreads = (argc == 4)?std::atoi(argv[3]):0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    ToTScan scan;
+    if(!scan.Load(scanfile))
+    {
+        std::cerr << "could not open \"" << scanfile << "\". Aborting" << std::endl;
+        return -2;
+    }
+    if(scan.GetNumPixels() == 0)
+    {
+        std::cerr << "no scan data found in \"" << scanfile << "\". Aborting" << std::endl;
+        return -3;
+    }
+
+    double loadtime = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                        - start).count();
+    start = std::chrono::steady_clock::now();
+
+    ToTCalibration calibration;
+    std::vector<ToTPixelFit> fits = ToTCalibrationFitFunctions::Fit(scan, calibration,
+                                                                    numthreads);
+
+    double fittime = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                        - start).count();
+
+    unsigned int numtoofew = 0;
+    unsigned int numnotconverged = 0;
+    unsigned int numatlimit = 0;
+    for(auto& it : fits)
+    {
+        if(it.numpoints == 0)
+            continue;
+        if(it.status == 0)
+            ++numtoofew;
+        else if((it.status & ToTCalibration::S_NotConverged) != 0)
+            ++numnotconverged;
+        else if((it.status & ToTCalibration::S_AtLimit) != 0)
+            ++numatlimit;
+    }
+
+    std::cout << scan.GetNumPixels() << " pixels read in " << loadtime << " s and fitted in "
+              << fittime << " s on " << ThreadFunctions::GetNumThreads(numthreads)
+              << " threads" << std::endl
+              << "  calibrated:         " << calibration.GetNumCalibrated() << std::endl
+              << "    with parameter at limit: " << numatlimit << std::endl
+              << "  not converged:      " << numnotconverged << std::endl
+              << "  too few points:     " << numtoofew << std::endl;
+
+    if(!calibration.Save(outputfile))
+    {
+        std::cerr << "could not write \"" << outputfile << "\"" << std::endl;
+        return -4;
+    }
+    std::cout << "Calibration written to \"" << outputfile << "\"" << std::endl;
+
+    if(!ToTCalibrationFitFunctions::WriteFailureMap(failurefile, fits))
+    {
+        std::cerr << "could not write \"" << failurefile << "\"" << std::endl;
+        return -5;
+    }
+    std::cout << "Failure map written to \"" << failurefile << "\"" << std::endl;
+
+    return 0;
+}
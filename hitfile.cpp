@@ -0,0 +1,395 @@
+#ifndef hitfilesources
+#define hitfilesources
+
+#include "hitfile.h"
+
+#include <cstring>
+
+HitFileHeader::HitFileHeader() : version(HitFileVersion), recordsize(sizeof(Dataset)), numhits(0)
+{
+    std::memcpy(magic, "AP3HITS", sizeof(magic));
+    reserved[0] = 0;
+    reserved[1] = 0;
+}
+
+std::string HitCacheName(std::string filename)
+{
+    return filename + ".hitcache";
+}
+
+bool HitFileFunctions::IsCacheValid(std::string filename)
+{
+    MappedHitFile cache;
+    return cache.Open(HitCacheName(filename), filename);
+}
+
+//------------------------------------------------------------------------------------------------
+
+HitFileWriter::HitFileWriter() : failed(false)
+{
+
+}
+
+HitFileWriter::~HitFileWriter()
+{
+    if(file.is_open())
+        Close();
+}
+
+bool HitFileWriter::Open(std::string filename, std::string sourcefile)
+{
+    if(file.is_open())
+        Close();
+
+    if(filename == "")
+        return false;
+
+    header = HitFileHeader();
+    if(sourcefile != "" && !BinaryFileFunctions::GetFileKey(sourcefile, header.source))
+        return false;
+
+    failed = false;
+
+    if(!file.Open(filename))
+        return false;
+
+    //the header is written again with the correct hit count in Close():
+    file.stream().write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    return file.stream().good();
+}
+
+bool HitFileWriter::Add(const Dataset& hit)
+{
+    return Add(&hit, 1);
+}
+
+bool HitFileWriter::Add(const Dataset* hits, uint64_t numhits)
+{
+    if(!file.is_open() || failed)
+        return false;
+
+    std::fstream& f = file.stream();
+    f.write(reinterpret_cast<const char*>(hits), std::streamsize(numhits * sizeof(Dataset)));
+    if(!f.good())
+    {
+        failed = true;
+        return false;
+    }
+
+    header.numhits += numhits;
+    return true;
+}
+
+bool HitFileWriter::Close()
+{
+    if(!file.is_open())
+        return false;
+
+    if(failed)
+    {
+        file.Discard();
+        return false;
+    }
+
+    file.stream().seekp(0, std::ios::beg);
+    file.stream().write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    return file.Commit();
+}
+
+void HitFileWriter::Discard()
+{
+    file.Discard();
+}
+
+bool HitFileWriter::is_open() const
+{
+    return file.is_open();
+}
+
+uint64_t HitFileWriter::GetNumHits() const
+{
+    return header.numhits;
+}
+
+//------------------------------------------------------------------------------------------------
+
+MappedHitFile::MappedHitFile() : hits(nullptr), numhits(0), opened(false)
+{
+
+}
+
+MappedHitFile::~MappedHitFile()
+{
+    Close();
+}
+
+bool MappedHitFile::Open(std::string filename, std::string sourcefile)
+{
+    Close();
+
+    FileKey expected;
+    if(sourcefile != "" && !BinaryFileFunctions::GetFileKey(sourcefile, expected))
+        return false;
+
+    if(!file.Open(filename, false, true))
+        return false;
+
+    HitFileHeader header;
+    HitFileHeader reference;
+    if(file.size() < sizeof(HitFileHeader))
+    {
+        file.Close();
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if(std::strncmp(header.magic, reference.magic, sizeof(header.magic)) != 0
+            || header.version != HitFileVersion || header.recordsize != sizeof(Dataset)
+            || file.size() != sizeof(HitFileHeader) + header.numhits * sizeof(Dataset)
+            || (sourcefile != "" && !(header.source == expected)))
+    {
+        file.Close();
+        return false;
+    }
+
+    numhits = header.numhits;
+    hits    = reinterpret_cast<const Dataset*>(file.data() + sizeof(HitFileHeader));
+    opened  = true;
+
+    return true;
+}
+
+void MappedHitFile::Close()
+{
+    file.Close();
+    hits    = nullptr;
+    numhits = 0;
+    opened  = false;
+}
+
+bool MappedHitFile::is_open() const
+{
+    return opened;
+}
+
+const Dataset* MappedHitFile::begin() const
+{
+    return hits;
+}
+
+const Dataset* MappedHitFile::end() const
+{
+    return hits + numhits;
+}
+
+uint64_t MappedHitFile::size() const
+{
+    return numhits;
+}
+
+const Dataset& MappedHitFile::operator[](uint64_t index) const
+{
+    return hits[index];
+}
+
+//------------------------------------------------------------------------------------------------
+
+HitFileReader::HitFileReader() : buffered(0), position(0), remaining(0), numhits(0)
+{
+
+}
+
+bool HitFileReader::Open(std::string filename, uint64_t buffersize)
+{
+    Close();
+
+    f.open(filename.c_str(), std::ios::in | std::ios::binary);
+    if(!f.is_open())
+        return false;
+
+    HitFileHeader header;
+    HitFileHeader expected;
+    f.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!f.good() || std::strncmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != HitFileVersion || header.recordsize != sizeof(Dataset))
+    {
+        f.close();
+        return false;
+    }
+
+    numhits   = header.numhits;
+    remaining = numhits;
+    buffer.resize((buffersize > 0)?buffersize:1);
+
+    return true;
+}
+
+void HitFileReader::Close()
+{
+    if(f.is_open())
+        f.close();
+    buffer.clear();
+    buffer.shrink_to_fit();
+    buffered  = 0;
+    position  = 0;
+    remaining = 0;
+    numhits   = 0;
+}
+
+bool HitFileReader::Fill()
+{
+    if(remaining == 0 || !f.is_open())
+        return false;
+
+    uint64_t toread = (remaining < buffer.size())?remaining:buffer.size();
+    f.read(reinterpret_cast<char*>(&buffer[0]), std::streamsize(toread * sizeof(Dataset)));
+    if(!f.good())
+    {
+        remaining = 0;
+        return false;
+    }
+
+    buffered   = toread;
+    position   = 0;
+    remaining -= toread;
+
+    return true;
+}
+
+bool HitFileReader::Next(Dataset& hit)
+{
+    const Dataset* next = Peek();
+    if(next == nullptr)
+        return false;
+
+    hit = *next;
+    ++position;
+
+    return true;
+}
+
+const Dataset* HitFileReader::Peek()
+{
+    if(position >= buffered && !Fill())
+        return nullptr;
+
+    return &buffer[position];
+}
+
+void HitFileReader::Pop()
+{
+    ++position;
+}
+
+bool HitFileReader::is_open() const
+{
+    return f.is_open();
+}
+
+uint64_t HitFileReader::size() const
+{
+    return numhits;
+}
+
+//------------------------------------------------------------------------------------------------
+
+HitReader::HitReader() : filename(""), index(0), fromcache(false)
+{
+
+}
+
+HitReader::~HitReader()
+{
+    Close();
+}
+
+bool HitReader::Open(std::string filename, bool usecache)
+{
+    Close();
+
+    this->filename = filename;
+
+    if(usecache && cache.Open(HitCacheName(filename), filename))
+    {
+        fromcache = true;
+        return true;
+    }
+
+    f.open(filename.c_str(), std::ios::in);
+    if(!f.is_open())
+        return false;
+
+    if(usecache && !writer.Open(HitCacheName(filename), filename))
+        std::cerr << "Could not write cache file \"" << HitCacheName(filename) << "\""
+                  << std::endl;
+
+    return true;
+}
+
+void HitReader::Close()
+{
+    //the cache is only kept if the file has been read completely:
+    if(writer.is_open())
+        writer.Discard();
+    if(f.is_open())
+        f.close();
+
+    cache.Close();
+    index      = 0;
+    fromcache  = false;
+    fieldorder = Dataset();
+}
+
+bool HitReader::Next(Dataset& hit)
+{
+    if(fromcache)
+    {
+        if(index >= cache.size())
+            return false;
+
+        hit = cache[index++];
+        return true;
+    }
+
+    if(!f.is_open())
+        return false;
+
+    std::string line;
+    while(std::getline(f, line))
+    {
+        if(line.length() > 0 && line[0] == '#')
+            fieldorder = DatasetFunctions::FindOrder(line);
+        else
+        {
+            hit = DatasetFunctions::Construct(line, fieldorder);
+            if(hit.is_valid())
+            {
+                if(writer.is_open())
+                    writer.Add(hit);
+                return true;
+            }
+        }
+    }
+
+    //end of file reached:
+    f.close();
+    if(writer.is_open() && !writer.Close())
+        std::cerr << "Could not write cache file \"" << HitCacheName(filename) << "\""
+                  << std::endl;
+
+    return false;
+}
+
+bool HitReader::is_open() const
+{
+    return fromcache || f.is_open();
+}
+
+bool HitReader::FromCache() const
+{
+    return fromcache;
+}
+
+#endif //hitfilesources
@@ -0,0 +1,264 @@
+#ifndef __HITFILE
+#define __HITFILE
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <stdint.h>
+
+#include "dataset.h"
+#include "binaryfile.h"
+
+/*
+ * Binary hit files store Dataset objects as they are in memory behind a fixed size header.
+ * They are used as a sidecar cache next to the decoded text files ("<file>.hitcache") to
+ * skip the text parsing on repeated loads of the same file. The cache stores size and
+ * modification time of the text file it was created from and is ignored (and rewritten)
+ * as soon as the text file changed.
+ */
+
+/**
+ * @brief HitFileHeader is the fixed size (64 bytes) header in front of the binary hit records
+ */
+struct HitFileHeader
+{
+    HitFileHeader();
+
+    char     magic[8];          //"AP3HITS" + '\0'
+    uint32_t version;           //format version, see HitFileVersion
+    uint32_t recordsize;        //sizeof(Dataset) of the writing program
+    uint64_t numhits;           //number of records following the header
+    FileKey  source;            //size and modification time of the text file (24 bytes)
+    uint64_t reserved[2];
+};
+
+const uint32_t HitFileVersion = 1;
+
+/**
+ * @brief HitCacheName generates the file name for the binary cache of a text hit file
+ * @param filename          - the text file containing the decoded hits
+ * @return                  - the file name of the sidecar cache file
+ */
+std::string HitCacheName(std::string filename);
+
+/**
+ * @brief HitFileWriter writes Dataset objects to a binary hit file. The number of hits is
+ *      written to the header on Close(). The data is written to a temporary file which is
+ *      renamed to the final name only after successful completion, so aborted writes do not
+ *      leave broken files behind.
+ */
+class HitFileWriter
+{
+public:
+    HitFileWriter();
+    ~HitFileWriter();
+
+    /**
+     * @brief Open creates the binary file
+     * @param filename          - the binary file to write
+     * @param sourcefile        - the text file the data originates from. Its size and
+     *                              modification time are stored in the header. Leave
+     *                              empty for files without text source (e.g. temporary files)
+     * @return                  - true on success, false if the file could not be created
+     */
+    bool Open(std::string filename, std::string sourcefile = "");
+    /**
+     * @brief Add appends one hit to the file
+     * @param hit               - the hit to add
+     * @return                  - false if the file is not open or writing failed
+     */
+    bool Add(const Dataset& hit);
+    /**
+     * @brief Add appends several hits to the file
+     * @param hits              - pointer to the first hit
+     * @param numhits           - number of hits to write
+     * @return                  - false if the file is not open or writing failed
+     */
+    bool Add(const Dataset* hits, uint64_t numhits);
+    /**
+     * @brief Close finalises the header and moves the file to its final name
+     * @return                  - true if all data has been written successfully
+     */
+    bool Close();
+    /**
+     * @brief Discard closes and deletes the incomplete file
+     */
+    void Discard();
+
+    bool     is_open() const;
+    uint64_t GetNumHits() const;
+
+private:
+    HitFileWriter(const HitFileWriter&);
+    HitFileWriter& operator=(const HitFileWriter&);
+
+    AtomicFileWriter file;
+    HitFileHeader    header;
+    bool             failed;
+};
+
+/**
+ * @brief MappedHitFile gives read-only access to the records of a binary hit file. On linux the
+ *      file is memory mapped, on other systems the records are read into memory.
+ */
+class MappedHitFile
+{
+public:
+    MappedHitFile();
+    ~MappedHitFile();
+
+    /**
+     * @brief Open maps the binary hit file
+     * @param filename          - the binary hit file to open
+     * @param sourcefile        - if not empty, the file is only accepted if size and modification
+     *                              time of this file match the ones stored in the header
+     * @return                  - true if the file could be mapped and is valid
+     */
+    bool Open(std::string filename, std::string sourcefile = "");
+    void Close();
+
+    bool           is_open() const;
+    const Dataset* begin() const;
+    const Dataset* end() const;
+    uint64_t       size() const;
+    const Dataset& operator[](uint64_t index) const;
+
+private:
+    MappedHitFile(const MappedHitFile&);
+    MappedHitFile& operator=(const MappedHitFile&);
+
+    FileMapping    file;
+    const Dataset* hits;
+    uint64_t       numhits;
+    bool           opened;
+};
+
+/**
+ * @brief HitFileReader reads the records of a binary hit file sequentially through a buffer of
+ *      fixed size. In contrast to MappedHitFile, the memory used does not grow with the file size.
+ */
+class HitFileReader
+{
+public:
+    HitFileReader();
+
+    /**
+     * @brief Open opens a binary hit file for sequential reading
+     * @param filename          - the binary hit file to read
+     * @param buffersize        - number of hits to buffer
+     * @return                  - true on success, false on a missing or broken file
+     */
+    bool Open(std::string filename, uint64_t buffersize = 65536);
+    void Close();
+
+    /**
+     * @brief Next provides the next hit of the file
+     * @param hit               - the object to write the hit to
+     * @return                  - false if the end of the file has been reached
+     */
+    bool Next(Dataset& hit);
+    /**
+     * @brief Peek gives access to the next hit without removing it
+     * @return                  - the next hit or nullptr if there is no more data
+     */
+    const Dataset* Peek();
+    /**
+     * @brief Pop removes the hit returned by Peek()
+     */
+    void Pop();
+
+    bool     is_open() const;
+    uint64_t size() const;
+
+private:
+    bool Fill();
+
+    std::fstream         f;
+    std::vector<Dataset> buffer;
+    uint64_t             buffered;
+    uint64_t             position;
+    uint64_t             remaining;
+    uint64_t             numhits;
+};
+
+/**
+ * @brief HitReader reads hits sequentially from a decoded text file. If a valid cache exists for
+ *      the file it is used instead of the text file, otherwise the cache is generated while
+ *      reading if requested. Only valid hits are returned.
+ */
+class HitReader
+{
+public:
+    HitReader();
+    ~HitReader();
+
+    /**
+     * @brief Open prepares reading the passed file
+     * @param filename          - the text file with decoded hits
+     * @param usecache          - use and generate the binary cache for the file
+     * @return                  - true if the file could be opened
+     */
+    bool Open(std::string filename, bool usecache = true);
+    void Close();
+
+    /**
+     * @brief Next provides the next valid hit of the file
+     * @param hit               - the object to write the hit to
+     * @return                  - false at the end of the file
+     */
+    bool Next(Dataset& hit);
+
+    bool is_open() const;
+    bool FromCache() const;
+
+private:
+    HitReader(const HitReader&);
+    HitReader& operator=(const HitReader&);
+
+    std::string   filename;
+    MappedHitFile cache;
+    uint64_t      index;
+    bool          fromcache;
+    std::fstream  f;
+    Dataset       fieldorder;
+    HitFileWriter writer;
+};
+
+namespace HitFileFunctions {
+
+    /**
+     * @brief IsCacheValid checks whether the cache for the passed text file exists and matches
+     *      the current state of the text file
+     * @param filename          - the text file with the decoded hits
+     * @return                  - true if the cache can be used
+     */
+    bool IsCacheValid(std::string filename);
+
+    /**
+     * @brief WriteCache writes the passed hits to the binary cache of the text file they were
+     *      loaded from
+     * @param filename          - the text file the hits were loaded from
+     * @param begin             - iterator to the first hit to write
+     * @param end               - iterator behind the last hit to write
+     * @return                  - true if the cache was written successfully
+     */
+    template<class Iterator>
+    bool WriteCache(std::string filename, Iterator begin, Iterator end)
+    {
+        HitFileWriter writer;
+        if(!writer.Open(HitCacheName(filename), filename))
+            return false;
+
+        for(Iterator it = begin; it != end; ++it)
+            if(!writer.Add(*it))
+            {
+                writer.Discard();
+                return false;
+            }
+
+        return writer.Close();
+    }
+
+}
+
+#endif //__HITFILE
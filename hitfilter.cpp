@@ -0,0 +1,162 @@
+#ifndef hitfiltersources
+#define hitfiltersources
+
+#include "hitfilter.h"
+
+#include <cstdlib>
+
+bool OutlierFilter::SingleStage::Push(const Dataset& hit, Dataset& out, uint64_t& removed)
+{
+    if(numheld == 0)
+    {
+        //the first hit is always accepted:
+        last    = hit;
+        out     = hit;
+        numheld = 1;
+        return true;
+    }
+    else if(numheld == 1)
+    {
+        candidate = hit;
+        numheld   = 2;
+        return false;
+    }
+
+    if(std::llabs(last.ts - candidate.ts) > step && std::llabs(last.ts - hit.ts) < step / 2)
+    {
+        ++removed;
+        candidate = hit;
+        return false;
+    }
+
+    out       = candidate;
+    last      = candidate;
+    candidate = hit;
+    return true;
+}
+
+bool OutlierFilter::SingleStage::Flush(Dataset& out)
+{
+    //the last hit is always accepted:
+    if(numheld == 2)
+    {
+        out     = candidate;
+        numheld = 1;
+        return true;
+    }
+    else
+        return false;
+}
+
+bool OutlierFilter::JumpStage::Push(const Dataset& hit, uint64_t& removed)
+{
+    if(!initialised)
+    {
+        lasttime    = hit.ts;
+        initialised = true;
+    }
+
+    if(std::llabs(hit.ts - lasttime) > step)
+    {
+        ++removed;
+        return false;
+    }
+
+    lasttime = hit.ts;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------
+
+OutlierFilter::OutlierFilter(long long stepsize, long long singlestepsize)
+    : readystart(0), numready(0)
+{
+    first.step  = singlestepsize;
+    jump.step   = stepsize;
+    second.step = singlestepsize;
+}
+
+void OutlierFilter::Add(const Dataset& hit)
+{
+    ++counts.input;
+
+    Dataset out;
+    if(first.Push(hit, out, counts.singlefirst))
+        PushJump(out);
+}
+
+void OutlierFilter::PushJump(const Dataset& hit)
+{
+    if(jump.Push(hit, counts.jumps))
+        PushSecond(hit);
+}
+
+void OutlierFilter::PushSecond(const Dataset& hit)
+{
+    Dataset out;
+    if(second.Push(hit, out, counts.singlesecond))
+    {
+        ready[(readystart + numready) % 3] = out;
+        ++numready;
+        ++counts.output;
+    }
+}
+
+void OutlierFilter::Flush()
+{
+    Dataset out;
+    if(first.Flush(out))
+        PushJump(out);
+
+    if(second.Flush(out))
+    {
+        ready[(readystart + numready) % 3] = out;
+        ++numready;
+        ++counts.output;
+    }
+}
+
+bool OutlierFilter::Next(Dataset& hit)
+{
+    if(numready == 0)
+        return false;
+
+    hit        = ready[readystart];
+    readystart = (readystart + 1) % 3;
+    --numready;
+
+    return true;
+}
+
+const OutlierCounts& OutlierFilter::GetCounts() const
+{
+    return counts;
+}
+
+//------------------------------------------------------------------------------------------------
+
+OutlierCounts RemoveOutliersInPlace(std::vector<Dataset>& data, long long stepsize,
+                                    long long singlestepsize)
+{
+    OutlierFilter filter(stepsize, singlestepsize);
+
+    //the filter never releases more hits than it got, so the write position stays behind the
+    //read position:
+    uint64_t position = 0;
+    for(uint64_t i = 0; i < data.size(); ++i)
+    {
+        filter.Add(data[i]);
+        while(filter.Next(data[position]))
+            ++position;
+    }
+
+    filter.Flush();
+    while(filter.Next(data[position]))
+        ++position;
+
+    data.resize(position);
+
+    return filter.GetCounts();
+}
+
+#endif //hitfiltersources
@@ -0,0 +1,116 @@
+#ifndef __HITFILTER
+#define __HITFILTER
+
+#include <vector>
+#include <stdint.h>
+
+#include "dataset.h"
+
+/**
+ * @brief OutlierCounts contains the number of hits removed by the individual criteria of the
+ *      OutlierFilter
+ */
+struct OutlierCounts
+{
+    OutlierCounts() : input(0), output(0), singlefirst(0), jumps(0), singlesecond(0) {}
+
+    uint64_t input;             //hits passed to the filter
+    uint64_t output;            //hits passing the filter
+    uint64_t singlefirst;       //single hits with wrong time stamp (first pass)
+    uint64_t jumps;             //hits too far in time from the previous accepted hit
+    uint64_t singlesecond;      //single hits with wrong time stamp (after the jump removal)
+};
+
+/**
+ * @brief OutlierFilter removes hits with corrupted time stamps from a stream of hits in one pass.
+ *      It produces the same result as calling RemoveSingleOutliers(), RemoveOutliers() and
+ *      RemoveSingleOutliers() from sortdata.cpp one after the other, but looks at most at three
+ *      hits at a time:
+ *        - single outliers: a hit is removed if its time stamp differs more than
+ *            `singlestepsize` from the last accepted hit while the following hit is closer than
+ *            `singlestepsize / 2` to the last accepted hit
+ *        - jumps: a hit is removed if its time stamp differs more than `stepsize` from the last
+ *            accepted hit
+ *      Usage: pass every hit to Add() and take all available hits with Next() afterwards. At the
+ *      end of the data, call Flush() and take the remaining hits with Next().
+ */
+class OutlierFilter
+{
+public:
+    /**
+     * @brief OutlierFilter initialises an empty filter
+     * @param stepsize          - maximum time stamp difference to the previous hit
+     * @param singlestepsize    - time stamp difference marking a single hit as outlier
+     */
+    OutlierFilter(long long stepsize = 150e6, long long singlestepsize = 150e6);
+
+    /**
+     * @brief Add passes the next hit to the filter
+     * @param hit               - the hit to check
+     */
+    void Add(const Dataset& hit);
+    /**
+     * @brief Flush marks the end of the data, so the hits still kept for look-ahead are released
+     */
+    void Flush();
+    /**
+     * @brief Next takes the next hit that passed the filter
+     * @param hit               - the object to write the hit to
+     * @return                  - false if no hit is available at the moment
+     */
+    bool Next(Dataset& hit);
+
+    const OutlierCounts& GetCounts() const;
+
+private:
+    //removal of single hits with one hit look-ahead:
+    struct SingleStage
+    {
+        SingleStage() : step(0), numheld(0) {}
+
+        bool Push(const Dataset& hit, Dataset& out, uint64_t& removed);
+        bool Flush(Dataset& out);
+
+        long long step;
+        Dataset   last;         //last accepted hit
+        Dataset   candidate;    //hit waiting for the decision
+        int       numheld;
+    };
+
+    //removal of hits too far from the last accepted one:
+    struct JumpStage
+    {
+        JumpStage() : step(0), initialised(false), lasttime(0) {}
+
+        bool Push(const Dataset& hit, uint64_t& removed);
+
+        long long step;
+        bool      initialised;
+        long long lasttime;
+    };
+
+    void PushJump(const Dataset& hit);
+    void PushSecond(const Dataset& hit);
+
+    SingleStage   first;
+    JumpStage     jump;
+    SingleStage   second;
+    OutlierCounts counts;
+
+    Dataset       ready[3];
+    int           readystart;
+    int           numready;
+};
+
+/**
+ * @brief RemoveOutliersInPlace applies the OutlierFilter to the data and compacts the remaining
+ *      hits at the beginning of the vector, no copy of the data is created
+ * @param data              - the hits to clean
+ * @param stepsize          - maximum time stamp difference to the previous hit
+ * @param singlestepsize    - time stamp difference marking a single hit as outlier
+ * @return                  - the number of hits removed per criterion
+ */
+OutlierCounts RemoveOutliersInPlace(std::vector<Dataset>& data, long long stepsize = 150e6,
+                                    long long singlestepsize = 150e6);
+
+#endif //__HITFILTER
@@ -0,0 +1,234 @@
+#ifndef hitjoinsources
+#define hitjoinsources
+
+#include "hitjoin.h"
+#include "hitsort.h"
+#include "pixeldistance.h"
+
+#include <thread>
+#include <algorithm>
+
+TimeWindow::TimeWindow(const Dataset* hits, uint64_t numhits, long long width) : hits(hits),
+    numhits((hits != nullptr)?numhits:0), width(width), first(0), last(0)
+{
+
+}
+
+void TimeWindow::Advance(long long ts)
+{
+    //hits leaving the window at the lower end:
+    while(first < numhits && hits[first].ts <= ts - width)
+        ++first;
+    if(last < first)
+        last = first;
+    //hits entering the window at the upper end:
+    while(last < numhits && hits[last].ts < ts + width)
+        ++last;
+}
+
+uint64_t TimeWindow::begin() const
+{
+    return first;
+}
+
+uint64_t TimeWindow::end() const
+{
+    return last;
+}
+
+long long TimeWindow::GetWidth() const
+{
+    return width;
+}
+
+//------------------------------------------------------------------------------------------------
+
+bool HitJoinFunctions::IsTimeSorted(const Dataset* hits, uint64_t numhits)
+{
+    for(uint64_t i = 1; i < numhits; ++i)
+        if(hits[i].ts < hits[i - 1].ts)
+            return false;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------
+
+CorrelationCounts::CorrelationCounts(long long timedist, long long spacedist) :
+    timedist((timedist > 0)?timedist:1), spacedist((spacedist > 0)?spacedist:1),
+    columns(132, -0.5, 131.5, 132, -0.5, 131.5), rows(372, -0.5, 371.5, 372, -0.5, 372.5),
+    timedifference(10000, -5000.5 * 25, 4999.5 * 25), spacefail(100000, -0.5 * 50, 699.5 * 50),
+    timefail(100000, -0.5 * 25, 49999.5 * 25)
+{
+
+}
+
+bool CorrelationCounts::Merge(const CorrelationCounts& other)
+{
+    if(other.timedist != timedist || other.spacedist != spacedist)
+        return false;
+
+    //check all binnings first to not add only a part of the counts:
+    if(!columns.HasSameBinning(other.columns) || !rows.HasSameBinning(other.rows)
+            || !timedifference.HasSameBinning(other.timedifference)
+            || !spacefail.HasSameBinning(other.spacefail)
+            || !timefail.HasSameBinning(other.timefail))
+        return false;
+
+    columns.Merge(other.columns);
+    rows.Merge(other.rows);
+    timedifference.Merge(other.timedifference);
+    spacefail.Merge(other.spacefail);
+    timefail.Merge(other.timefail);
+
+    windowbegin.insert(windowbegin.end(), other.windowbegin.begin(), other.windowbegin.end());
+    windowend.insert(windowend.end(), other.windowend.begin(), other.windowend.end());
+
+    join.numone     += other.join.numone;
+    join.candidates += other.join.candidates;
+    join.nearmisses += other.join.nearmisses;
+
+    return true;
+}
+
+void HitJoinFunctions::CorrelateHits(const std::vector<Dataset>& one,
+                                     const std::vector<Dataset>& two, CorrelationCounts& counts,
+                                     std::atomic<uint64_t>* progress, bool debug)
+{
+    CorrelateHits(one.data(), one.size(), two, counts, progress, debug);
+}
+
+void HitJoinFunctions::CorrelateHits(const Dataset* one, uint64_t numone,
+                                     const std::vector<Dataset>& two, CorrelationCounts& counts,
+                                     std::atomic<uint64_t>* progress, bool debug)
+{
+    const long long timedist = counts.timedist;
+    const PixelNeighbourhood nearby(counts.spacedist * counts.spacedist);
+
+    if(debug)
+    {
+        counts.windowbegin.reserve(numone);
+        counts.windowend.reserve(numone);
+    }
+
+    //the progress is reported in blocks to keep the shared counter out of the inner loop:
+    const uint64_t progressblock = 4096;
+
+    counts.join = JoinHits(one, numone, two.data(), two.size(), timedist, 3 * timedist,
+        [&](const Dataset& hitone, const Dataset& hittwo, long long dt)
+        {
+            if(nearby.Contains(hitone.column - hittwo.column, hitone.row - hittwo.row))
+            {
+                counts.columns.Fill(hitone.column, hittwo.column);
+                counts.rows.Fill(hitone.row, hittwo.row);
+                counts.timedifference.Fill(dt * 25);
+            }
+            else
+            {
+                uint64_t dist = PixelDistanceFunctions::ISqrt(PixelDistanceFunctions::Distance2(
+                                            hitone.column - hittwo.column, hitone.row - hittwo.row));
+                counts.spacefail.Fill(dist * 50);
+            }
+        },
+        [&](const Dataset&, const Dataset&, long long dt)
+        {
+            counts.timefail.Fill((dt < 0)?-dt:dt);
+        },
+        [&](uint64_t index, uint64_t begin, uint64_t end)
+        {
+            if(debug)
+            {
+                counts.windowbegin.push_back(begin);
+                counts.windowend.push_back(end);
+            }
+            if(progress != nullptr && (index + 1) % progressblock == 0)
+                *progress += progressblock;
+        });
+
+    if(progress != nullptr)
+        *progress += numone % progressblock;
+}
+
+std::vector<CorrelationCounts> HitJoinFunctions::CorrelateLayerPairs(
+                                        const std::vector<std::vector<Dataset> >& layers,
+                                        const std::vector<LayerPair>& pairs,
+                                        long long timedist, long long spacedist,
+                                        unsigned int numthreads,
+                                        std::atomic<uint64_t>* progress, bool debug)
+{
+    std::vector<CorrelationCounts> results(pairs.size(),
+                                           CorrelationCounts(timedist, spacedist));
+
+    numthreads = ThreadFunctions::GetNumThreads(numthreads);
+
+    //split the first layers to keep all threads busy with few pairs:
+    const uint64_t minpart = 100000;
+    const unsigned int maxparts = (pairs.size() > 0)
+                                    ? (numthreads + pairs.size() - 1) / pairs.size() : 1;
+
+    struct Task
+    {
+        unsigned int pair;
+        uint64_t begin;
+        uint64_t end;
+        CorrelationCounts* counts;
+    };
+
+    std::vector<Task> tasks;
+    std::vector<std::vector<CorrelationCounts> > parts(pairs.size());
+    for(unsigned int i = 0; i < pairs.size(); ++i)
+    {
+        const LayerPair& pair = pairs[i];
+        const uint64_t numone = (pair.one < layers.size()) ? layers[pair.one].size() : 0;
+
+        unsigned int numparts = 1;
+        if(pair.one < layers.size() && pair.two < layers.size())
+        {
+            numparts = std::max<uint64_t>(1, std::min<uint64_t>(maxparts, numone / minpart));
+            parts[i].resize(numparts - 1, CorrelationCounts(timedist, spacedist));
+        }
+
+        for(unsigned int part = 0; part < numparts; ++part)
+            tasks.push_back(Task{i, numone * part / numparts, numone * (part + 1) / numparts,
+                                 (part == 0) ? &results[i] : &parts[i][part - 1]});
+    }
+
+    if(numthreads > tasks.size())
+        numthreads = tasks.size();
+
+    std::atomic<unsigned int> nexttask(0);
+    auto worker = [&]()
+    {
+        unsigned int index;
+        while((index = nexttask++) < tasks.size())
+        {
+            const Task& task = tasks[index];
+            const LayerPair& pair = pairs[task.pair];
+            if(pair.one >= layers.size() || pair.two >= layers.size())
+            {
+                if(progress != nullptr)
+                    *progress += task.end - task.begin;
+                continue;
+            }
+
+            CorrelateHits(layers[pair.one].data() + task.begin, task.end - task.begin,
+                          layers[pair.two], *task.counts, progress, debug);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numthreads; ++i)
+        threads.push_back(std::thread(worker));
+    worker();
+    for(auto& it : threads)
+        it.join();
+
+    //add up the parts in order, so the debug windows stay sorted by the first hits:
+    for(unsigned int i = 0; i < pairs.size(); ++i)
+        for(const auto& it : parts[i])
+            results[i].Merge(it);
+
+    return results;
+}
+
+#endif //hitjoinsources
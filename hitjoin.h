@@ -0,0 +1,259 @@
+#ifndef __HITJOIN
+#define __HITJOIN
+
+#include <vector>
+#include <atomic>
+#include <utility>
+#include <stdint.h>
+
+#include "dataset.h"
+#include "inthistogram.h"
+
+/*
+ * Time window join of two hit arrays sorted by time stamp (e.g. the data of two layers).
+ * For every hit of the first array all hits of the second array with a time stamp difference
+ * below a given limit are passed to an accumulator. The window on the second array is only moved
+ * forward, so the effort is O(n + m + number of candidate pairs), independent of the order of
+ * the hits within the window and without any stop heuristics.
+ */
+
+/**
+ * @brief TimeWindow keeps the range of hits in a time sorted array which lie within +- `width`
+ *      (exclusive) around a time stamp. The time stamps passed to Advance() have to be
+ *      non-decreasing.
+ */
+class TimeWindow
+{
+public:
+    /**
+     * @brief TimeWindow initialises an empty window at the beginning of the array
+     * @param hits              - the time sorted hits
+     * @param numhits           - number of hits in the array
+     * @param width             - half width of the window in time stamp units
+     */
+    TimeWindow(const Dataset* hits, uint64_t numhits, long long width);
+
+    /**
+     * @brief Advance moves the window to the passed time stamp
+     * @param ts                - the new centre of the window
+     */
+    void Advance(long long ts);
+
+    uint64_t  begin() const;
+    uint64_t  end() const;
+    long long GetWidth() const;
+
+private:
+    const Dataset* hits;
+    uint64_t       numhits;
+    long long      width;
+    uint64_t       first;       //first hit inside the window
+    uint64_t       last;        //first hit behind the window
+};
+
+/**
+ * @brief JoinCounts contains the number of pairs handled by a join
+ */
+struct JoinCounts
+{
+    JoinCounts() : numone(0), numtwo(0), candidates(0), nearmisses(0) {}
+
+    uint64_t numone;            //hits in the first array
+    uint64_t numtwo;            //hits in the second array
+    uint64_t candidates;        //pairs within the time window
+    uint64_t nearmisses;        //pairs outside the time window but within the near miss range
+};
+
+/**
+ * @brief CorrelationCounts accumulates the spatial and time correlation between the hits of two
+ *      layers in integer histograms (see inthistogram.h) with the binning of the histograms of
+ *      `Correlate()`, so several layer pairs (or parts of one) can be correlated concurrently
+ *      without sharing ROOT objects. The results are added with Merge() and copied into the ROOT
+ *      histograms with CopyTo().
+ */
+struct CorrelationCounts
+{
+    /**
+     * @brief CorrelationCounts creates empty counters
+     * @param timedist          - time window for correlated pairs (in time stamp units)
+     * @param spacedist         - spatial limit for correlated pairs (in multiples of 50 um)
+     */
+    CorrelationCounts(long long timedist = 1, long long spacedist = 1);
+
+    /**
+     * @brief Merge adds the counts of another part of the same correlation (e.g. of other hits
+     *      of the first layer), the recorded search windows are appended
+     * @param other             - the counts to add
+     * @return                  - false if the limits or the binnings are different
+     */
+    bool Merge(const CorrelationCounts& other);
+
+    long long timedist;
+    long long spacedist;
+
+    IntHistogram2D columns;         //column of the first vs. the second hit of correlated pairs
+    IntHistogram2D rows;            //row of the first vs. the second hit of correlated pairs
+    IntHistogram1D timedifference;  //dt * 25 of correlated pairs
+    IntHistogram1D spacefail;       //distance * 50 of the pairs failing in space
+    IntHistogram1D timefail;        //|dt| of the pairs with timedist <= |dt| < 3 * timedist
+
+    //search window on the second layer for every hit of the first one (only with debug):
+    std::vector<uint64_t> windowbegin;
+    std::vector<uint64_t> windowend;
+
+    JoinCounts join;
+};
+
+/**
+ * @brief LayerPair identifies the two layers to correlate by their indices
+ */
+struct LayerPair
+{
+    LayerPair(unsigned int one = 0, unsigned int two = 0) : one(one), two(two) {}
+
+    unsigned int one;
+    unsigned int two;
+};
+
+namespace HitJoinFunctions {
+
+    /**
+     * @brief IsTimeSorted checks whether the hits are in non-decreasing time stamp order
+     * @param hits              - the hits to check
+     * @param numhits           - number of hits
+     * @return                  - true if the array can be used for JoinHits()
+     */
+    bool IsTimeSorted(const Dataset* hits, uint64_t numhits);
+
+    /**
+     * @brief NoAction can be passed to JoinHits() for unused accumulators
+     */
+    struct NoAction
+    {
+        void operator()(const Dataset&, const Dataset&, long long) const {}
+        void operator()(uint64_t, uint64_t, uint64_t) const {}
+    };
+
+    /**
+     * @brief CorrelateHits correlates two time sorted arrays of hits. Pairs are counted as
+     *      correlated if |dt| < `timedist` and sqrt(9 * dcolumn^2 + drow^2) < `spacedist`
+     *      (the pixels are three times as wide as high). Pairs with timedist <= |dt| <
+     *      3 * timedist are counted in `counts.timefail`.
+     * @param one               - time sorted hits of the first layer
+     * @param two               - time sorted hits of the second layer
+     * @param counts            - the counters to fill, initialised with the limits to use
+     * @param progress          - if not nullptr, the number of hits from `one` already processed
+     *                              is added to this counter while running
+     * @param debug             - record the search window for every hit of `one`
+     */
+    void CorrelateHits(const std::vector<Dataset>& one, const std::vector<Dataset>& two,
+                       CorrelationCounts& counts, std::atomic<uint64_t>* progress = nullptr,
+                       bool debug = false);
+    /**
+     * @brief CorrelateHits correlates a part of the first layer with the second one, see above
+     * @param one               - time sorted hits of the first layer
+     * @param numone            - number of hits in `one`
+     * @param two               - time sorted hits of the second layer
+     * @param counts            - the counters to fill, initialised with the limits to use
+     * @param progress          - if not nullptr, the number of hits from `one` already processed
+     *                              is added to this counter while running
+     * @param debug             - record the search window for every hit of `one`
+     */
+    void CorrelateHits(const Dataset* one, uint64_t numone, const std::vector<Dataset>& two,
+                       CorrelationCounts& counts, std::atomic<uint64_t>* progress = nullptr,
+                       bool debug = false);
+
+    /**
+     * @brief CorrelateLayerPairs correlates several pairs of layers concurrently. With more
+     *      threads than pairs, the first layers are split into parts (of at least 100000 hits),
+     *      which are correlated concurrently and added up with CorrelationCounts::Merge().
+     * @param layers            - time sorted hits for every layer
+     * @param pairs             - the layer pairs to correlate
+     * @param timedist          - time window for correlated pairs (in time stamp units)
+     * @param spacedist         - spatial limit for correlated pairs (in multiples of 50 um)
+     * @param numthreads        - maximum number of threads to use, 0 for one per CPU core
+     * @param progress          - if not nullptr, the number of processed hits of the first
+     *                              layers of the pairs is added to this counter while running
+     * @param debug             - record the search windows (see CorrelateHits())
+     * @return                  - the counters in the order of `pairs`
+     */
+    std::vector<CorrelationCounts> CorrelateLayerPairs(
+                                        const std::vector<std::vector<Dataset> >& layers,
+                                        const std::vector<LayerPair>& pairs,
+                                        long long timedist, long long spacedist,
+                                        unsigned int numthreads = 0,
+                                        std::atomic<uint64_t>* progress = nullptr,
+                                        bool debug = false);
+
+}
+
+/**
+ * @brief JoinHits passes all pairs of hits from two time sorted arrays with a time stamp difference
+ *      |one.ts - two.ts| < `timedist` to `pair`. Pairs with `timedist` <= |one.ts - two.ts| <
+ *      `missdist` are passed to `miss`.
+ * @param one               - time sorted hits of the first array
+ * @param numone            - number of hits in `one`
+ * @param two               - time sorted hits of the second array
+ * @param numtwo            - number of hits in `two`
+ * @param timedist          - the time window for candidate pairs (in time stamp units)
+ * @param missdist          - limit for the near miss pairs, values <= `timedist` disable them
+ * @param pair              - called as pair(hitone, hittwo, one.ts - two.ts) for every candidate
+ * @param miss              - called as miss(hitone, hittwo, one.ts - two.ts) for every near miss
+ * @param window            - called as window(indexone, begin, end) with the index range on
+ *                              `two` searched for every hit in `one`
+ * @return                  - the number of pairs found
+ */
+template<class PairAccumulator, class MissAccumulator, class WindowObserver>
+JoinCounts JoinHits(const Dataset* one, uint64_t numone, const Dataset* two, uint64_t numtwo,
+                    long long timedist, long long missdist, PairAccumulator&& pair,
+                    MissAccumulator&& miss, WindowObserver&& window)
+{
+    JoinCounts counts;
+    counts.numone = numone;
+    counts.numtwo = numtwo;
+
+    TimeWindow range(two, numtwo, (missdist > timedist)?missdist:timedist);
+
+    for(uint64_t i = 0; i < numone; ++i)
+    {
+        const Dataset& hit = one[i];
+        range.Advance(hit.ts);
+        window(i, range.begin(), range.end());
+
+        for(uint64_t j = range.begin(); j < range.end(); ++j)
+        {
+            long long dt = hit.ts - two[j].ts;
+            if(dt < timedist && dt > -timedist)
+            {
+                pair(hit, two[j], dt);
+                ++counts.candidates;
+            }
+            else
+            {
+                miss(hit, two[j], dt);
+                ++counts.nearmisses;
+            }
+        }
+    }
+
+    return counts;
+}
+
+/**
+ * @brief JoinHits passes all pairs of hits from two time sorted arrays with a time stamp difference
+ *      |one.ts - two.ts| < `timedist` to `pair`
+ * @param one               - time sorted hits of the first array
+ * @param two               - time sorted hits of the second array
+ * @param timedist          - the time window for candidate pairs (in time stamp units)
+ * @param pair              - called as pair(hitone, hittwo, one.ts - two.ts) for every candidate
+ * @return                  - the number of pairs found
+ */
+template<class PairAccumulator>
+JoinCounts JoinHits(const std::vector<Dataset>& one, const std::vector<Dataset>& two,
+                    long long timedist, PairAccumulator&& pair)
+{
+    return JoinHits(one.data(), one.size(), two.data(), two.size(), timedist, 0, pair,
+                    HitJoinFunctions::NoAction(), HitJoinFunctions::NoAction());
+}
+
+#endif //__HITJOIN
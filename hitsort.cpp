@@ -0,0 +1,577 @@
+#ifndef hitsortsources
+#define hitsortsources
+
+#include "hitsort.h"
+#include "hitfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+long long HitSortFunctions::PeakMemoryUsage()
+{
+#if defined(__linux__)
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;
+#else
+    return -1;
+#endif
+}
+
+namespace {
+    //layer values 0 to 15 are separated, all other values are collected in one group:
+    const int numlayergroups = 17;
+
+    inline int LayerGroup(const Dataset& hit)
+    {
+        return (hit.layer >= 0 && hit.layer < numlayergroups - 1)?hit.layer:numlayergroups - 1;
+    }
+}
+
+SortDisorder HitSortFunctions::MeasureDisorder(const std::vector<Dataset>& hits)
+{
+    SortDisorder disorder;
+    disorder.numhits = hits.size();
+    if(hits.size() == 0)
+        return disorder;
+
+    disorder.numruns = 1;
+    std::vector<int64_t> lastindex(numlayergroups, -1);
+    for(uint64_t i = 0; i < hits.size(); ++i)
+    {
+        if(i > 0 && hits[i] < hits[i - 1])
+            ++disorder.numruns;
+
+        int group = LayerGroup(hits[i]);
+        if(lastindex[group] == -1 || hits[i] < hits[lastindex[group]])
+            ++disorder.numlayerruns;
+        lastindex[group] = int64_t(i);
+    }
+
+    return disorder;
+}
+
+//------------------------------------------------------------------------------------------------
+
+namespace {
+    //position of a run in the work array:
+    struct Run
+    {
+        Run(uint64_t start, uint64_t end) : position(start), end(end) {}
+
+        uint64_t position;
+        uint64_t end;
+    };
+
+    struct MemoryRunLess
+    {
+        MemoryRunLess(const std::vector<Dataset>* data, const std::vector<Run>* runs)
+            : data(data), runs(runs) {}
+
+        bool operator()(int a, int b) const
+        {
+            const Run& ra = (*runs)[a];
+            const Run& rb = (*runs)[b];
+            if(ra.position == ra.end)
+                return false;
+            else if(rb.position == rb.end)
+                return true;
+            else
+                return (*data)[ra.position] < (*data)[rb.position];
+        }
+
+        const std::vector<Dataset>* data;
+        const std::vector<Run>*     runs;
+    };
+
+    /**
+     * finds the runs in [start, end). Runs shorter than minrun are extended by insertion sort
+     * and hits less than minrun positions away from their place in the run are inserted
+     * instead of starting a new run. `origin` is kept in sync with `data`.
+     */
+    void FindRuns(std::vector<Dataset>& data, std::vector<uint64_t>& origin, uint64_t start,
+                  uint64_t end, uint64_t minrun, std::vector<Run>& runs)
+    {
+        uint64_t runstart = start;
+        while(runstart < end)
+        {
+            uint64_t runend = runstart + 1;
+            while(runend < end)
+            {
+                if(!(data[runend] < data[runend - 1]))
+                {
+                    ++runend;
+                    continue;
+                }
+
+                uint64_t searchstart = runstart;
+                if(runend - runstart > minrun)
+                {
+                    searchstart = runend - minrun;
+                    if(data[runend] < data[searchstart])
+                        break;  //too far away, start a new run
+                }
+
+                Dataset  hit   = data[runend];
+                uint64_t index = origin[runend];
+                uint64_t pos   = std::upper_bound(data.begin() + searchstart,
+                                                  data.begin() + runend, hit) - data.begin();
+                for(uint64_t i = runend; i > pos; --i)
+                {
+                    data[i]   = data[i - 1];
+                    origin[i] = origin[i - 1];
+                }
+                data[pos]   = hit;
+                origin[pos] = index;
+
+                ++runend;
+            }
+
+            runs.push_back(Run(runstart, runend));
+            runstart = runend;
+        }
+    }
+}
+
+SortDisorder AdaptiveSort(std::vector<Dataset>& hits, unsigned int minrun)
+{
+    SortDisorder disorder = HitSortFunctions::MeasureDisorder(hits);
+    if(hits.size() == 0)
+        return disorder;
+
+    //already sorted:
+    if(disorder.numruns == 1)
+    {
+        disorder.numsortedruns = 1;
+        return disorder;
+    }
+
+    disorder.perlayer = disorder.numlayerruns * 2 < disorder.numruns;
+
+    std::vector<Dataset>  work;
+    std::vector<uint64_t> origin(hits.size());
+    std::vector<Run>      runs;
+
+    if(disorder.perlayer)
+    {
+        std::vector<uint64_t> groupstart(numlayergroups + 1, 0);
+        for(uint64_t i = 0; i < hits.size(); ++i)
+            ++groupstart[LayerGroup(hits[i]) + 1];
+        for(int i = 0; i < numlayergroups; ++i)
+            groupstart[i + 1] += groupstart[i];
+
+        work.resize(hits.size());
+        std::vector<uint64_t> position(groupstart.begin(), groupstart.end() - 1);
+        for(uint64_t i = 0; i < hits.size(); ++i)
+        {
+            int group = LayerGroup(hits[i]);
+            work[position[group]]   = hits[i];
+            origin[position[group]] = i;
+            ++position[group];
+        }
+
+        for(int i = 0; i < numlayergroups; ++i)
+            FindRuns(work, origin, groupstart[i], groupstart[i + 1], minrun, runs);
+    }
+    else
+    {
+        work.swap(hits);
+        for(uint64_t i = 0; i < origin.size(); ++i)
+            origin[i] = i;
+
+        FindRuns(work, origin, 0, work.size(), minrun, runs);
+        hits.resize(work.size());
+    }
+
+    disorder.numsortedruns = runs.size();
+
+    LoserTree<MemoryRunLess> tree(int(runs.size()), MemoryRunLess(&work, &runs));
+    for(uint64_t i = 0; i < hits.size(); ++i)
+    {
+        Run& run = runs[tree.Top()];
+        hits[i] = work[run.position];
+
+        uint64_t displacement = (origin[run.position] > i)?origin[run.position] - i
+                                                           :i - origin[run.position];
+        if(displacement > disorder.maxdisplacement)
+            disorder.maxdisplacement = displacement;
+
+        ++run.position;
+        tree.Update();
+    }
+
+    return disorder;
+}
+
+//------------------------------------------------------------------------------------------------
+
+namespace {
+    struct KeyIndex
+    {
+        uint64_t key;
+        uint64_t index;
+    };
+
+    const int      radixbits    = 11;
+    const uint64_t radixbuckets = uint64_t(1) << radixbits;
+    const uint64_t radixmask    = radixbuckets - 1;
+
+    inline uint64_t PackKey(const Dataset& hit, long long mints)
+    {
+        return (uint64_t(hit.ts - mints) << 17) | (uint64_t(hit.column) << 9) | uint64_t(hit.row);
+    }
+
+    //runs `function(thread, start, end)` on `numthreads` threads for equal parts of [0, size):
+    template<class Function>
+    void ParallelFor(unsigned int numthreads, uint64_t size, Function function)
+    {
+        if(numthreads <= 1)
+        {
+            function(0, 0, size);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        for(unsigned int t = 0; t < numthreads; ++t)
+            threads.push_back(std::thread(function, t, size * t / numthreads,
+                                          size * (t + 1) / numthreads));
+        for(auto& it : threads)
+            it.join();
+    }
+}
+
+bool RadixSort(std::vector<Dataset>& hits, unsigned int numthreads)
+{
+    if(hits.size() < 2)
+        return true;
+
+    long long mints = hits[0].ts;
+    long long maxts = hits[0].ts;
+    for(const auto& it : hits)
+    {
+        if(it.column < 0 || it.column > 255 || it.row < 0 || it.row > 511)
+        {
+            std::sort(hits.begin(), hits.end());
+            return false;
+        }
+        if(it.ts < mints)
+            mints = it.ts;
+        else if(it.ts > maxts)
+            maxts = it.ts;
+    }
+
+    if(maxts - mints < 0 || uint64_t(maxts - mints) >= (uint64_t(1) << 47))
+    {
+        std::sort(hits.begin(), hits.end());
+        return false;
+    }
+
+    const uint64_t size = hits.size();
+    numthreads = ThreadFunctions::GetNumThreads(numthreads);
+    if(size < numthreads * radixbuckets)
+        numthreads = 1;
+
+    //number of digits needed for the largest key:
+    uint64_t maxkey = (uint64_t(maxts - mints) << 17) | 0x1FFFF;
+    int numdigits = 0;
+    while(numdigits * radixbits < 64 && (maxkey >> (numdigits * radixbits)) != 0)
+        ++numdigits;
+
+    std::vector<KeyIndex> pairs(size);
+    std::vector<KeyIndex> temp(size);
+
+    //generate the keys and count the digits of all passes at once:
+    std::vector<uint64_t> counts(uint64_t(numthreads) * numdigits * radixbuckets, 0);
+    ParallelFor(numthreads, size, [&](unsigned int thread, uint64_t start, uint64_t end) {
+        uint64_t* count = &counts[uint64_t(thread) * numdigits * radixbuckets];
+        for(uint64_t i = start; i < end; ++i)
+        {
+            uint64_t key = PackKey(hits[i], mints);
+            pairs[i].key   = key;
+            pairs[i].index = i;
+            for(int d = 0; d < numdigits; ++d)
+                ++count[d * radixbuckets + ((key >> (d * radixbits)) & radixmask)];
+        }
+    });
+
+    //the totals per bucket do not depend on the order of the keys:
+    std::vector<uint64_t> totals(uint64_t(numdigits) * radixbuckets, 0);
+    for(unsigned int t = 0; t < numthreads; ++t)
+        for(uint64_t b = 0; b < totals.size(); ++b)
+            totals[b] += counts[uint64_t(t) * numdigits * radixbuckets + b];
+
+    std::vector<uint64_t> offsets(uint64_t(numthreads) * radixbuckets);
+    bool reordered = false;
+    for(int d = 0; d < numdigits; ++d)
+    {
+        //skip digits identical for all keys:
+        if(std::find(totals.begin() + d * radixbuckets, totals.begin() + (d + 1) * radixbuckets,
+                     size) != totals.begin() + (d + 1) * radixbuckets)
+            continue;
+
+        const int shift = d * radixbits;
+
+        //the counts per thread refer to the parts of the array the threads processed, so they
+        //have to be redone after the first reordering:
+        if(reordered && numthreads > 1)
+        {
+            ParallelFor(numthreads, size, [&](unsigned int thread, uint64_t start, uint64_t end) {
+                uint64_t* count = &counts[(uint64_t(thread) * numdigits + d) * radixbuckets];
+                std::fill(count, count + radixbuckets, 0);
+                for(uint64_t i = start; i < end; ++i)
+                    ++count[(pairs[i].key >> shift) & radixmask];
+            });
+        }
+
+        //the hits of thread t are placed behind the ones of the threads before for each bucket
+        //to keep the sort stable:
+        uint64_t position = 0;
+        for(uint64_t b = 0; b < radixbuckets; ++b)
+            for(unsigned int t = 0; t < numthreads; ++t)
+            {
+                offsets[t * radixbuckets + b] = position;
+                position += counts[(uint64_t(t) * numdigits + d) * radixbuckets + b];
+            }
+
+        ParallelFor(numthreads, size, [&](unsigned int thread, uint64_t start, uint64_t end) {
+            uint64_t* offset = &offsets[thread * radixbuckets];
+            for(uint64_t i = start; i < end; ++i)
+                temp[offset[(pairs[i].key >> shift) & radixmask]++] = pairs[i];
+        });
+
+        pairs.swap(temp);
+        reordered = true;
+    }
+    std::vector<KeyIndex>().swap(temp);
+
+    //apply the permutation:
+    std::vector<Dataset> sorted(size);
+    ParallelFor(numthreads, size, [&](unsigned int, uint64_t start, uint64_t end) {
+        for(uint64_t i = start; i < end; ++i)
+            sorted[i] = hits[pairs[i].index];
+    });
+    hits.swap(sorted);
+
+    return true;
+}
+
+SortDisorder SortHits(std::vector<Dataset>& hits, int method, unsigned int numthreads,
+                      int* usedmethod)
+{
+    SortDisorder disorder;
+
+    if(method == SM_Auto)
+    {
+        disorder = HitSortFunctions::MeasureDisorder(hits);
+        uint64_t runs = (disorder.numruns < disorder.numlayerruns)?disorder.numruns
+                                                                   :disorder.numlayerruns;
+        //merging is cheaper than radix sorting for long runs. On a single thread, the radix
+        //sort is not faster than std::sort due to the random access in the final permutation:
+        if(runs * 256 <= hits.size())
+            method = SM_Adaptive;
+        else if(ThreadFunctions::GetNumThreads(numthreads) > 1)
+            method = SM_Radix;
+        else
+            method = SM_Std;
+    }
+
+    switch(method)
+    {
+    case SM_Std:
+        disorder = HitSortFunctions::MeasureDisorder(hits);
+        std::sort(hits.begin(), hits.end());
+        break;
+    case SM_Adaptive:
+        disorder = AdaptiveSort(hits);
+        break;
+    case SM_Sample:
+        if(disorder.numhits != hits.size())
+            disorder = HitSortFunctions::MeasureDisorder(hits);
+        ParallelSampleSort(hits, ThreadFunctions::GetNumThreads(numthreads));
+        break;
+    default:
+        method = SM_Radix;
+        if(disorder.numhits != hits.size())
+            disorder = HitSortFunctions::MeasureDisorder(hits);
+        if(!RadixSort(hits, numthreads))
+            method = SM_Std;
+        break;
+    }
+
+    if(usedmethod != nullptr)
+        *usedmethod = method;
+
+    return disorder;
+}
+
+//------------------------------------------------------------------------------------------------
+
+ExternalSorter::ExternalSorter(uint64_t memorybudget, std::string tempprefix)
+    : memorybudget(memorybudget), tempprefix(tempprefix), failed(false)
+{
+    //sorting needs a second copy of the data and up to 32 bytes of keys and indices per hit:
+    maxbuffered = memorybudget / (2 * sizeof(Dataset) + 4 * sizeof(uint64_t));
+    if(maxbuffered < 1024)
+        maxbuffered = 1024;
+}
+
+ExternalSorter::~ExternalSorter()
+{
+    RemoveRuns();
+}
+
+bool ExternalSorter::Add(const Dataset& hit)
+{
+    if(failed)
+        return false;
+
+    if(buffer.capacity() == 0)
+        buffer.reserve(maxbuffered);
+
+    buffer.push_back(hit);
+    ++stats.numhits;
+
+    if(buffer.size() >= maxbuffered)
+        return SpillRun();
+
+    return true;
+}
+
+bool ExternalSorter::SpillRun()
+{
+    SortHits(buffer);
+
+    std::stringstream s("");
+    s << tempprefix << ".run" << runfiles.size();
+
+    HitFileWriter writer;
+    if(!writer.Open(s.str()) || !writer.Add(&buffer[0], buffer.size()) || !writer.Close())
+    {
+        std::cerr << "Could not write temporary file \"" << s.str() << "\"" << std::endl;
+        writer.Discard();
+        failed = true;
+        return false;
+    }
+
+    runfiles.push_back(s.str());
+    stats.bytesspilled += sizeof(HitFileHeader) + buffer.size() * sizeof(Dataset);
+    ++stats.numruns;
+
+    buffer.clear();
+
+    return true;
+}
+
+void ExternalSorter::RemoveRuns()
+{
+    for(auto& it : runfiles)
+        std::remove(it.c_str());
+    runfiles.clear();
+}
+
+namespace {
+    struct RunLess
+    {
+        RunLess(std::vector<HitFileReader>* runs) : runs(runs) {}
+
+        bool operator()(int a, int b) const
+        {
+            const Dataset* ha = (*runs)[a].Peek();
+            const Dataset* hb = (*runs)[b].Peek();
+            if(ha == nullptr)
+                return false;
+            else if(hb == nullptr)
+                return true;
+            else
+                return *ha < *hb;
+        }
+
+        std::vector<HitFileReader>* runs;
+    };
+}
+
+bool ExternalSorter::Finish(HitOutput output)
+{
+    if(failed)
+    {
+        RemoveRuns();
+        return false;
+    }
+
+    //everything fits in memory:
+    if(runfiles.size() == 0)
+    {
+        SortHits(buffer);
+        bool success = buffer.size() == 0 || output(&buffer[0], buffer.size());
+        std::vector<Dataset>().swap(buffer);
+        stats.peakrss = HitSortFunctions::PeakMemoryUsage();
+        return success;
+    }
+
+    if(buffer.size() > 0 && !SpillRun())
+    {
+        RemoveRuns();
+        return false;
+    }
+    std::vector<Dataset>().swap(buffer);
+
+    //split the budget between the read buffers of the runs and the output buffer:
+    uint64_t blocksize = maxbuffered / (runfiles.size() + 1);
+    if(blocksize < 256)
+        blocksize = 256;
+
+    std::vector<HitFileReader> runs(runfiles.size());
+    for(unsigned int i = 0; i < runfiles.size(); ++i)
+    {
+        if(!runs[i].Open(runfiles[i], blocksize))
+        {
+            std::cerr << "Could not read temporary file \"" << runfiles[i] << "\"" << std::endl;
+            RemoveRuns();
+            return false;
+        }
+    }
+
+    std::vector<Dataset> outbuffer;
+    outbuffer.reserve(blocksize);
+
+    bool success = true;
+    LoserTree<RunLess> tree(int(runs.size()), RunLess(&runs));
+    const Dataset* next = runs[tree.Top()].Peek();
+    while(next != nullptr && success)
+    {
+        outbuffer.push_back(*next);
+        runs[tree.Top()].Pop();
+        tree.Update();
+
+        if(outbuffer.size() == blocksize)
+        {
+            success = output(&outbuffer[0], outbuffer.size());
+            outbuffer.clear();
+        }
+
+        next = runs[tree.Top()].Peek();
+    }
+
+    if(success && outbuffer.size() > 0)
+        success = output(&outbuffer[0], outbuffer.size());
+
+    runs.clear();
+    RemoveRuns();
+
+    stats.peakrss = HitSortFunctions::PeakMemoryUsage();
+
+    return success;
+}
+
+const ExternalSortStats& ExternalSorter::GetStats() const
+{
+    return stats;
+}
+
+#endif //hitsortsources
@@ -0,0 +1,537 @@
+#ifndef __HITSORT
+#define __HITSORT
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <iterator>
+#include <stdint.h>
+
+#include "dataset.h"
+#include "threads.h"
+
+/**
+ * @brief LoserTree selects the smallest head element of several sorted sources in O(log k)
+ *      comparisons per element (tournament tree storing the loser in each node). The sources
+ *      are identified by their index, the comparison function has to decide which of two
+ *      sources has the smaller head and has to treat exhausted sources as larger than all
+ *      other sources.
+ */
+template<class IndexLess>
+class LoserTree
+{
+public:
+    /**
+     * @brief LoserTree builds the tree for the current heads of the sources
+     * @param numsources        - number of sources to merge
+     * @param less              - function object `bool less(int a, int b)` returning true if the
+     *                              head of source a is to be taken before the head of source b
+     */
+    LoserTree(int numsources, IndexLess less) : k(numsources), less(less), tree(numsources, 0)
+    {
+        if(k > 0)
+            tree[0] = Build(1);
+    }
+
+    /**
+     * @brief Top returns the index of the source with the smallest head element
+     */
+    int Top() const
+    {
+        return tree[0];
+    }
+
+    /**
+     * @brief Update restores the order after the head of the source returned by Top() changed
+     */
+    void Update()
+    {
+        int winner = tree[0];
+        for(int node = (winner + k) / 2; node > 0; node /= 2)
+            if(Less(tree[node], winner))
+                std::swap(tree[node], winner);
+        tree[0] = winner;
+    }
+
+private:
+    //ties are resolved by the source index to keep the merge stable:
+    bool Less(int a, int b)
+    {
+        if(less(a, b))
+            return true;
+        else if(less(b, a))
+            return false;
+        else
+            return a < b;
+    }
+
+    int Build(int node)
+    {
+        if(node >= k)
+            return node - k;
+
+        int left  = Build(2 * node);
+        int right = Build(2 * node + 1);
+        if(Less(right, left))
+        {
+            tree[node] = left;
+            return right;
+        }
+        else
+        {
+            tree[node] = right;
+            return left;
+        }
+    }
+
+    int              k;
+    IndexLess        less;
+    std::vector<int> tree;
+};
+
+/**
+ * @brief HitOutput receives blocks of sorted hits. Returning false aborts the sorting.
+ */
+typedef std::function<bool(const Dataset* hits, uint64_t numhits)> HitOutput;
+
+struct ExternalSortStats
+{
+    ExternalSortStats() : numhits(0), numruns(0), bytesspilled(0), peakrss(0) {}
+
+    uint64_t  numhits;          //number of hits sorted
+    uint64_t  numruns;          //number of sorted runs written to disk
+    uint64_t  bytesspilled;     //bytes written to temporary files
+    long long peakrss;          //peak resident memory of the process in kB
+};
+
+/**
+ * @brief ExternalSorter sorts an arbitrary number of hits with a limited amount of memory. The
+ *      hits are collected until the memory budget is used up, then the block is sorted and
+ *      written to a temporary binary hit file. In the end, all blocks are merged with a loser
+ *      tree. The order is the one defined by Dataset::operator<.
+ *      If all hits fit into the budget, no temporary files are written at all.
+ */
+class ExternalSorter
+{
+public:
+    /**
+     * @brief ExternalSorter prepares the sorter
+     * @param memorybudget      - maximum memory to use for buffering hits in bytes
+     * @param tempprefix        - path prefix for the temporary files. The files will be named
+     *                              "<tempprefix>.run<N>"
+     */
+    ExternalSorter(uint64_t memorybudget, std::string tempprefix);
+    ~ExternalSorter();
+
+    /**
+     * @brief Add adds one hit to the data to sort
+     * @param hit               - the hit to add
+     * @return                  - false if writing a temporary file failed
+     */
+    bool Add(const Dataset& hit);
+    /**
+     * @brief Finish merges all data and passes it in sorted order to `output`. Afterwards the
+     *      temporary files are removed and the sorter is empty.
+     * @param output            - the function receiving the sorted hits
+     * @return                  - true on success, false on errors reading the temporary files or
+     *                              if `output` returned false
+     */
+    bool Finish(HitOutput output);
+
+    const ExternalSortStats& GetStats() const;
+
+private:
+    ExternalSorter(const ExternalSorter&);
+    ExternalSorter& operator=(const ExternalSorter&);
+
+    bool SpillRun();
+    void RemoveRuns();
+
+    uint64_t                 memorybudget;
+    uint64_t                 maxbuffered;
+    std::string              tempprefix;
+    std::vector<Dataset>     buffer;
+    std::vector<std::string> runfiles;
+    ExternalSortStats        stats;
+    bool                     failed;
+};
+
+/**
+ * @brief SortDisorder describes how far the input of AdaptiveSort() was from being sorted
+ */
+struct SortDisorder
+{
+    SortDisorder() : numhits(0), numruns(0), numlayerruns(0), numsortedruns(0),
+        maxdisplacement(0), perlayer(false) {}
+
+    uint64_t numhits;           //number of hits sorted
+    uint64_t numruns;           //ascending runs in the input order
+    uint64_t numlayerruns;      //sum of the ascending runs in the data of the individual layers
+    uint64_t numsortedruns;     //runs merged after the insertion sort step
+    uint64_t maxdisplacement;   //maximum distance of a hit from its position in the sorted data
+    bool     perlayer;          //true if the layers were separated before merging
+};
+
+/**
+ * @brief AdaptiveSort sorts hits in the order of Dataset::operator< exploiting existing order in
+ *      the data. Ascending runs are detected in the data, short runs and hits slightly out of
+ *      place are handled by insertion sort and all runs are merged at once with a loser tree. If the layers are sorted
+ *      individually but interleaved, the data is split into the layers before detecting runs.
+ *      Sorting already sorted data takes linear time.
+ * @param hits              - the data to sort
+ * @param minrun            - minimum length of a run, shorter runs are extended. Hits at most
+ *                              this many positions away from their place are inserted into
+ *                              the current run
+ * @return                  - statistics on the disorder of the input data
+ */
+SortDisorder AdaptiveSort(std::vector<Dataset>& hits, unsigned int minrun = 32);
+
+/**
+ * @brief RadixSort sorts hits in the order of Dataset::operator< by a parallel LSD radix sort on
+ *      64 bit keys packed from the time stamp (relative to the earliest one), the column (8 bit)
+ *      and the row (9 bit). Only pairs of key and index are sorted, the hits are moved once
+ *      at the end. The sort is stable.
+ *      If the data does not fit into the key (columns outside 0 to 255, rows outside 0 to 511 or
+ *      a time stamp range larger than 2^47), std::sort is used instead.
+ * @param hits              - the data to sort
+ * @param numthreads        - number of threads to use, 0 for one per CPU core
+ * @return                  - true if the radix sort was used, false if std::sort was used
+ */
+bool RadixSort(std::vector<Dataset>& hits, unsigned int numthreads = 0);
+
+/**
+ * @brief ParallelSampleSort sorts the data on several threads. A sample of the data determines
+ *      splitters dividing the data into buckets of similar size, the elements are distributed
+ *      into their buckets in place and the buckets are sorted independently. Works with any
+ *      default constructible element type and comparison.
+ *      The distribution works on blocks of about 4 kB (as in IPS4o) in three parallel steps:
+ *      - every thread classifies its stripe of the data into one small buffer per bucket, full
+ *          buffers are written back to the already classified part of the stripe as blocks;
+ *      - the blocks are moved to the block aligned positions of their buckets. The moves are
+ *          planned on the block indices and executed in pieces on all threads;
+ *      - the elements left in the buffers fill the remaining positions at the bucket borders.
+ *      Apart from the sample, the buffers (numthreads^2 * 16 kB), the block plan (about 40 bytes
+ *      per block) and one saved block per piece of a long move sequence are allocated.
+ * @param data              - the data to sort
+ * @param numthreads        - number of threads to use (at least 1)
+ * @param comp              - the comparison function defining the order
+ */
+template<class T, class Compare>
+void ParallelSampleSort(std::vector<T>& data, unsigned int numthreads, Compare comp)
+{
+    const uint64_t size = data.size();
+    if(numthreads < 1)
+        numthreads = 1;
+    //not worth the overhead for small data:
+    if(numthreads == 1 || size < uint64_t(numthreads) * 4096)
+    {
+        std::sort(data.begin(), data.end(), comp);
+        return;
+    }
+
+    //more buckets than threads for a better load balance:
+    const unsigned int numbuckets = 4 * numthreads;
+    const unsigned int oversample = 64;
+
+    std::vector<T> samples;
+    samples.reserve(numbuckets * oversample);
+    std::mt19937_64 generator(size);
+    for(unsigned int i = 0; i < numbuckets * oversample; ++i)
+        samples.push_back(data[generator() % size]);
+    std::sort(samples.begin(), samples.end(), comp);
+
+    std::vector<T> splitters;
+    for(unsigned int i = 1; i < numbuckets; ++i)
+        splitters.push_back(samples[i * oversample]);
+    std::vector<T>().swap(samples);
+
+    auto bucketof = [&](const T& element) {
+        return (unsigned int)(std::upper_bound(splitters.begin(), splitters.end(), element, comp)
+                                - splitters.begin());
+    };
+
+    //runs worker(thread) on all threads:
+    auto runparallel = [numthreads](const std::function<void(unsigned int)>& worker) {
+        std::vector<std::thread> threads;
+        for(unsigned int t = 1; t < numthreads; ++t)
+            threads.push_back(std::thread(worker, t));
+        worker(0);
+        for(auto& it : threads)
+            it.join();
+    };
+
+    const uint64_t     blocksize = std::max<uint64_t>(1, 4096 / sizeof(T));
+    const uint64_t     numblocks = size / blocksize;   //complete blocks in the array
+    const unsigned int none      = numbuckets;         //bucket of a position without a block
+    const uint64_t     noblock   = uint64_t(-1);
+
+    //classify the stripes, the elements per thread and bucket are counted on the way:
+    std::vector<unsigned int> blockbucket(numblocks, none);
+    std::vector<T>            buffers(uint64_t(numthreads) * numbuckets * blocksize);
+    std::vector<uint64_t>     buffered(uint64_t(numthreads) * numbuckets, 0);
+    std::vector<uint64_t>     counts(uint64_t(numthreads) * numbuckets, 0);
+    runparallel([&](unsigned int thread) {
+        //the stripes start at block borders, the last one takes the incomplete block:
+        const uint64_t start = numblocks * thread / numthreads * blocksize;
+        const uint64_t end   = (thread + 1 < numthreads)
+                                    ?numblocks * (thread + 1) / numthreads * blocksize:size;
+        T*        buffer = &buffers[uint64_t(thread) * numbuckets * blocksize];
+        uint64_t* filled = &buffered[uint64_t(thread) * numbuckets];
+        uint64_t* count  = &counts[uint64_t(thread) * numbuckets];
+        uint64_t  write  = start;
+        for(uint64_t i = start; i < end; ++i)
+        {
+            const unsigned int bucket = bucketof(data[i]);
+            T* bucketbuffer = buffer + uint64_t(bucket) * blocksize;
+            bucketbuffer[filled[bucket]++] = std::move(data[i]);
+            ++count[bucket];
+            //the block only overwrites elements already read:
+            if(filled[bucket] == blocksize)
+            {
+                std::move(bucketbuffer, bucketbuffer + blocksize, data.begin() + write);
+                blockbucket[write / blocksize] = bucket;
+                write += blocksize;
+                filled[bucket] = 0;
+            }
+        }
+    });
+
+    std::vector<uint64_t> bucketstart(numbuckets + 1, 0);
+    std::vector<uint64_t> numfull(numbuckets, 0);       //complete blocks per bucket
+    std::vector<uint64_t> firstblock(numbuckets, 0);    //first block aligned position
+    for(unsigned int b = 0; b < numbuckets; ++b)
+    {
+        bucketstart[b + 1] = bucketstart[b];
+        for(unsigned int t = 0; t < numthreads; ++t)
+        {
+            const uint64_t index = uint64_t(t) * numbuckets + b;
+            bucketstart[b + 1] += counts[index];
+            numfull[b]         += (counts[index] - buffered[index]) / blocksize;
+        }
+        firstblock[b] = (bucketstart[b] + blocksize - 1) / blocksize;
+    }
+
+    //a block reaching into the incomplete block at the end of the array is put aside and
+    //  handled like the buffered elements:
+    std::vector<T> aside;
+    unsigned int   asidebucket = none;
+    for(unsigned int b = 0; b < numbuckets; ++b)
+        if(numfull[b] > 0 && firstblock[b] + numfull[b] > numblocks)
+        {
+            --numfull[b];
+            uint64_t block = numblocks;
+            while(blockbucket[--block] != b);
+            aside.assign(std::make_move_iterator(data.begin() + block * blocksize),
+                         std::make_move_iterator(data.begin() + (block + 1) * blocksize));
+            blockbucket[block] = none;
+            asidebucket = b;
+        }
+
+    //plan the block moves: blocks inside the range of their bucket stay, the others get the
+    //  free positions of their bucket in order
+    std::vector<uint64_t> target(numblocks, noblock);   //new position of the block at a position
+    std::vector<uint64_t> source(numblocks, noblock);   //old position of the block moved there
+    for(uint64_t k = 0; k < numblocks; ++k)
+    {
+        const unsigned int bucket = blockbucket[k];
+        if(bucket != none && k >= firstblock[bucket] && k < firstblock[bucket] + numfull[bucket])
+            target[k] = source[k] = k;
+    }
+    std::vector<uint64_t> nextfree(firstblock);
+    for(uint64_t k = 0; k < numblocks; ++k)
+    {
+        const unsigned int bucket = blockbucket[k];
+        if(bucket == none || target[k] != noblock)
+            continue;
+        while(source[nextfree[bucket]] != noblock)
+            ++nextfree[bucket];
+        target[k] = nextfree[bucket];
+        source[nextfree[bucket]] = k;
+    }
+    std::vector<uint64_t>().swap(nextfree);
+
+    //the moves form paths ending at a free position and closed cycles. Every path is executed
+    //  backwards, long ones are cut into pieces which save their first block before the moves:
+    struct MovePiece
+    {
+        uint64_t begin;         //first move of the piece
+        uint64_t end;           //behind the last move
+        int64_t  saved;         //index of the saved first block, -1 if the target of the
+                                //  last move is free, -2 if it is saved by the executing thread
+    };
+    const uint64_t maxpiece = std::max<uint64_t>(16, numblocks / (8 * numthreads));
+    std::vector<std::pair<uint64_t, uint64_t> > moves;  //(from, to)
+    std::vector<MovePiece> pieces;
+    int64_t                numsaved = 0;
+    std::vector<bool>      visited(numblocks, false);
+    auto addpath = [&](uint64_t first, bool cycle) {
+        const uint64_t begin = moves.size();
+        uint64_t block = first;
+        do
+        {
+            moves.push_back(std::make_pair(block, target[block]));
+            visited[block] = true;
+            block = target[block];
+        } while(block != first && blockbucket[block] != none);
+
+        if(moves.size() - begin <= maxpiece)
+            pieces.push_back(MovePiece{begin, moves.size(), cycle?-2:-1});
+        else
+            for(uint64_t i = begin; i < moves.size(); i += maxpiece)
+                pieces.push_back(MovePiece{i, std::min<uint64_t>(i + maxpiece, moves.size()),
+                                           numsaved++});
+    };
+    for(uint64_t k = 0; k < numblocks; ++k)
+        if(blockbucket[k] != none && target[k] != k && source[k] == noblock)
+            addpath(k, false);
+    for(uint64_t k = 0; k < numblocks; ++k)
+        if(blockbucket[k] != none && target[k] != k && !visited[k])
+            addpath(k, true);
+    std::vector<uint64_t>().swap(target);
+    std::vector<uint64_t>().swap(source);
+
+    auto blockat = [&](uint64_t block) { return data.begin() + block * blocksize; };
+    std::vector<T> savedblocks(uint64_t(numsaved) * blocksize);
+
+    std::atomic<uint64_t> nextpiece(0);
+    runparallel([&](unsigned int) {
+        uint64_t index;
+        while((index = nextpiece++) < pieces.size())
+            if(pieces[index].saved >= 0)
+            {
+                auto from = blockat(moves[pieces[index].begin].first);
+                std::move(from, from + blocksize,
+                          savedblocks.begin() + pieces[index].saved * blocksize);
+            }
+    });
+
+    nextpiece = 0;
+    runparallel([&](unsigned int) {
+        std::vector<T> local(blocksize);
+        uint64_t index;
+        while((index = nextpiece++) < pieces.size())
+        {
+            const MovePiece& piece = pieces[index];
+            T* saved = (piece.saved >= 0)?&savedblocks[piece.saved * blocksize]:local.data();
+            if(piece.saved == -2)
+                std::move(blockat(moves[piece.begin].first),
+                          blockat(moves[piece.begin].first) + blocksize, saved);
+
+            for(uint64_t i = piece.end - 1; i > piece.begin; --i)
+                std::move(blockat(moves[i].first), blockat(moves[i].first) + blocksize,
+                          blockat(moves[i].second));
+
+            if(piece.saved == -1)
+                std::move(blockat(moves[piece.begin].first),
+                          blockat(moves[piece.begin].first) + blocksize,
+                          blockat(moves[piece.begin].second));
+            else
+                std::move(saved, saved + blocksize, blockat(moves[piece.begin].second));
+        }
+    });
+    std::vector<std::pair<uint64_t, uint64_t> >().swap(moves);
+
+    //the last block of a bucket can reach into the next bucket, these elements are taken out
+    //  before the free positions are filled:
+    std::vector<std::vector<T> > overflow(numbuckets);
+    std::atomic<unsigned int> nextbucket(0);
+    runparallel([&](unsigned int) {
+        unsigned int bucket;
+        while((bucket = nextbucket++) < numbuckets)
+        {
+            const uint64_t blockend = (firstblock[bucket] + numfull[bucket]) * blocksize;
+            if(numfull[bucket] > 0 && blockend > bucketstart[bucket + 1])
+                overflow[bucket].assign(
+                        std::make_move_iterator(data.begin() + bucketstart[bucket + 1]),
+                        std::make_move_iterator(data.begin() + blockend));
+        }
+    });
+
+    //fill the positions of every bucket in front of and behind its blocks:
+    nextbucket = 0;
+    runparallel([&](unsigned int) {
+        unsigned int bucket;
+        while((bucket = nextbucket++) < numbuckets)
+        {
+            const uint64_t blockbegin = firstblock[bucket] * blocksize;
+            const uint64_t blockend   = (firstblock[bucket] + numfull[bucket]) * blocksize;
+            uint64_t position = bucketstart[bucket];
+            auto put = [&](T& element) {
+                if(position == blockbegin)
+                    position = blockend;
+                data[position++] = std::move(element);
+            };
+
+            for(auto& it : overflow[bucket])
+                put(it);
+            if(bucket == asidebucket)
+                for(auto& it : aside)
+                    put(it);
+            for(unsigned int t = 0; t < numthreads; ++t)
+            {
+                T* buffer = &buffers[(uint64_t(t) * numbuckets + bucket) * blocksize];
+                for(uint64_t i = 0; i < buffered[uint64_t(t) * numbuckets + bucket]; ++i)
+                    put(buffer[i]);
+            }
+        }
+    });
+
+    //sort the buckets, the threads take the next unsorted bucket:
+    nextbucket = 0;
+    runparallel([&](unsigned int) {
+        unsigned int bucket;
+        while((bucket = nextbucket++) < numbuckets)
+            std::sort(data.begin() + bucketstart[bucket],
+                      data.begin() + bucketstart[bucket + 1], comp);
+    });
+}
+
+template<class T>
+void ParallelSampleSort(std::vector<T>& data, unsigned int numthreads)
+{
+    ParallelSampleSort(data, numthreads, std::less<T>());
+}
+
+enum SortMethod {
+    SM_Auto     = 0,        //AdaptiveSort for nearly sorted data, otherwise radix sort
+                            //  (std::sort if only one thread is available)
+    SM_Std      = 1,        //std::sort
+    SM_Adaptive = 2,        //AdaptiveSort()
+    SM_Radix    = 3,        //RadixSort()
+    SM_Sample   = 4         //ParallelSampleSort()
+};
+
+/**
+ * @brief SortHits sorts hits in the order of Dataset::operator< with the selected method
+ * @param hits              - the data to sort
+ * @param method            - the sorting algorithm to use, see SortMethod
+ * @param numthreads        - number of threads for parallel sorting, 0 for one per CPU core
+ * @param usedmethod        - if not nullptr, the method actually used is written to it
+ * @return                  - the disorder of the input data. The displacement and the merged runs
+ *                              are only determined by AdaptiveSort()
+ */
+SortDisorder SortHits(std::vector<Dataset>& hits, int method = SM_Auto,
+                      unsigned int numthreads = 0, int* usedmethod = nullptr);
+
+namespace HitSortFunctions {
+
+    /**
+     * @brief MeasureDisorder counts the ascending runs in the data globally and per layer
+     * @param hits              - the data to analyse
+     * @return                  - the numbers of runs, the other fields are left empty
+     */
+    SortDisorder MeasureDisorder(const std::vector<Dataset>& hits);
+
+    /**
+     * @brief PeakMemoryUsage returns the peak resident set size of the process
+     * @return                  - the memory in kB or -1 if not available
+     */
+    long long PeakMemoryUsage();
+
+}
+
+#endif //__HITSORT
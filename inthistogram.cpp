@@ -0,0 +1,112 @@
+#ifndef inthistogramsources
+#define inthistogramsources
+
+#include "inthistogram.h"
+
+#include <algorithm>
+
+IntHistogram1D::IntHistogram1D(int numbins, double low, double high) :
+    numbins((numbins > 0)?numbins:1), low(low), high(high), counters(this->numbins + 2, 0),
+    entries(0)
+{
+
+}
+
+bool IntHistogram1D::Merge(const IntHistogram1D& other)
+{
+    if(!HasSameBinning(other))
+        return false;
+
+    for(unsigned int i = 0; i < counters.size(); ++i)
+        counters[i] += other.counters[i];
+    entries += other.entries;
+
+    return true;
+}
+
+bool IntHistogram1D::HasSameBinning(const IntHistogram1D& other) const
+{
+    return other.numbins == numbins && other.low == low && other.high == high;
+}
+
+void IntHistogram1D::Clear()
+{
+    std::fill(counters.begin(), counters.end(), 0);
+    entries = 0;
+}
+
+int IntHistogram1D::GetNumBins() const
+{
+    return numbins;
+}
+
+int IntHistogram1D::GetBinContent(int bin) const
+{
+    if(bin < 0 || bin > numbins + 1)
+        return 0;
+
+    return counters[bin];
+}
+
+uint64_t IntHistogram1D::GetEntries() const
+{
+    return entries;
+}
+
+//------------------------------------------------------------------------------------------------
+
+IntHistogram2D::IntHistogram2D(int numbinsx, double lowx, double highx,
+                               int numbinsy, double lowy, double highy) :
+    xaxis(numbinsx, lowx, highx), yaxis(numbinsy, lowy, highy),
+    counters(size_t(xaxis.GetNumBins() + 2) * (yaxis.GetNumBins() + 2), 0), entries(0)
+{
+
+}
+
+bool IntHistogram2D::Merge(const IntHistogram2D& other)
+{
+    if(!HasSameBinning(other))
+        return false;
+
+    for(unsigned int i = 0; i < counters.size(); ++i)
+        counters[i] += other.counters[i];
+    entries += other.entries;
+
+    return true;
+}
+
+bool IntHistogram2D::HasSameBinning(const IntHistogram2D& other) const
+{
+    return xaxis.HasSameBinning(other.xaxis) && yaxis.HasSameBinning(other.yaxis);
+}
+
+void IntHistogram2D::Clear()
+{
+    std::fill(counters.begin(), counters.end(), 0);
+    entries = 0;
+}
+
+int IntHistogram2D::GetNumBinsX() const
+{
+    return xaxis.GetNumBins();
+}
+
+int IntHistogram2D::GetNumBinsY() const
+{
+    return yaxis.GetNumBins();
+}
+
+int IntHistogram2D::GetBinContent(int binx, int biny) const
+{
+    if(binx < 0 || binx > GetNumBinsX() + 1 || biny < 0 || biny > GetNumBinsY() + 1)
+        return 0;
+
+    return counters[binx + (GetNumBinsX() + 2) * biny];
+}
+
+uint64_t IntHistogram2D::GetEntries() const
+{
+    return entries;
+}
+
+#endif //inthistogramsources
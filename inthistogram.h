@@ -0,0 +1,235 @@
+#ifndef __INTHISTOGRAM
+#define __INTHISTOGRAM
+
+#include <vector>
+#include <thread>
+#include <stdint.h>
+
+#include "threads.h"
+
+/*
+ * Integer histograms with fixed binning for the analysis loops. The counters are stored in one
+ * contiguous array with the layout of ROOT's TH1I/TH2I (bin 0 is the underflow, bin numbins + 1
+ * the overflow), and the bin of a value is calculated inline with the same expression as
+ * TAxis::FindFixBin(), so the bin contents and the number of entries are identical to filling
+ * the ROOT histogram directly. The other statistics are not: CopyTo() recalculates mean and RMS
+ * from the bin contents (as after TH1::ResetStats()), while Fill() of ROOT accumulates them from
+ * the unbinned values. The histograms do not use ROOT: every thread fills its own instance, the
+ * instances are added with Merge() and the result is copied into a ROOT histogram once with
+ * CopyTo().
+ */
+
+/**
+ * @brief IntHistogram1D is a one dimensional histogram with equidistant bins
+ */
+class IntHistogram1D
+{
+public:
+    /**
+     * @brief IntHistogram1D creates an empty histogram
+     * @param numbins           - number of bins
+     * @param low               - lower edge of the first bin
+     * @param high              - upper edge of the last bin
+     */
+    IntHistogram1D(int numbins = 1, double low = 0, double high = 1);
+
+    /**
+     * @brief Fill adds one entry
+     * @param x                 - the value to add
+     */
+    inline void Fill(double x);
+    /**
+     * @brief FindBin calculates the bin of a value like TAxis::FindFixBin()
+     * @param x                 - the value
+     * @return                  - the bin, 0 for underflow and numbins + 1 for overflow
+     */
+    inline int FindBin(double x) const;
+
+    /**
+     * @brief Merge adds the contents of another histogram (e.g. filled in another thread)
+     * @param other             - the histogram to add
+     * @return                  - false if the binning is different
+     */
+    bool Merge(const IntHistogram1D& other);
+    /**
+     * @brief HasSameBinning compares number of bins and the edges of the range
+     * @param other             - the histogram to compare to
+     * @return                  - true if both histograms have the same bins
+     */
+    bool HasSameBinning(const IntHistogram1D& other) const;
+    void Clear();
+
+    int      GetNumBins() const;
+    int      GetBinContent(int bin) const;
+    uint64_t GetEntries() const;
+
+    /**
+     * @brief CopyTo sets the contents of a ROOT histogram with the same binning (e.g. a TH1I) to
+     *      the ones of this histogram, the statistics are recalculated from the bin contents
+     * @param hist              - the histogram to write to
+     */
+    template<class Histogram>
+    void CopyTo(Histogram* hist) const;
+
+private:
+    int              numbins;
+    double           low;
+    double           high;
+    std::vector<int> counters;  //numbins + 2 entries, including underflow and overflow
+    uint64_t         entries;
+};
+
+/**
+ * @brief IntHistogram2D is a two dimensional histogram with equidistant bins
+ */
+class IntHistogram2D
+{
+public:
+    /**
+     * @brief IntHistogram2D creates an empty histogram
+     * @param numbinsx          - number of bins on the x axis
+     * @param lowx              - lower edge of the first bin on the x axis
+     * @param highx             - upper edge of the last bin on the x axis
+     * @param numbinsy          - number of bins on the y axis
+     * @param lowy              - lower edge of the first bin on the y axis
+     * @param highy             - upper edge of the last bin on the y axis
+     */
+    IntHistogram2D(int numbinsx = 1, double lowx = 0, double highx = 1,
+                   int numbinsy = 1, double lowy = 0, double highy = 1);
+
+    /**
+     * @brief Fill adds one entry
+     * @param x                 - the value on the x axis
+     * @param y                 - the value on the y axis
+     */
+    inline void Fill(double x, double y);
+
+    /**
+     * @brief Merge adds the contents of another histogram (e.g. filled in another thread)
+     * @param other             - the histogram to add
+     * @return                  - false if the binning is different
+     */
+    bool Merge(const IntHistogram2D& other);
+
+    /**
+     * @brief HasSameBinning compares the binning of both axes
+     * @param other             - histogram to compare with
+     * @return                  - true if both axes have the same binning
+     */
+    bool HasSameBinning(const IntHistogram2D& other) const;
+    void Clear();
+
+    int      GetNumBinsX() const;
+    int      GetNumBinsY() const;
+    int      GetBinContent(int binx, int biny) const;
+    uint64_t GetEntries() const;
+
+    /**
+     * @brief CopyTo sets the contents of a ROOT histogram with the same binning (e.g. a TH2I) to
+     *      the ones of this histogram, the statistics are recalculated from the bin contents
+     * @param hist              - the histogram to write to
+     */
+    template<class Histogram>
+    void CopyTo(Histogram* hist) const;
+
+private:
+    IntHistogram1D   xaxis;     //only used for the bin calculation
+    IntHistogram1D   yaxis;
+    std::vector<int> counters;  //(numbinsx + 2) x (numbinsy + 2), x changes fastest
+    uint64_t         entries;
+};
+
+namespace IntHistogramFunctions {
+
+    /**
+     * @brief Fill fills histograms on several threads. The items are split into contiguous
+     *      ranges, every thread fills an empty copy of `result` with `fill(histograms, start,
+     *      end)` and the copies are added to `result` at the end.
+     * @param result            - the histograms to fill, the type needs a copy constructor,
+     *                              Clear() and Merge()
+     * @param numitems          - number of items to distribute
+     * @param fill              - the function filling the items [start, end) into the
+     *                              histograms passed
+     * @param numthreads        - maximum number of threads, 0 for one per CPU core
+     */
+    template<class Histograms, class Function>
+    void Fill(Histograms& result, uint64_t numitems, Function fill, unsigned int numthreads = 0);
+
+}
+
+//------------------------------------------------------------------------------------------------
+
+inline int IntHistogram1D::FindBin(double x) const
+{
+    if(x < low)
+        return 0;
+    else if(!(x < high))
+        return numbins + 1;
+    else
+        return 1 + int(numbins * (x - low) / (high - low));
+}
+
+inline void IntHistogram1D::Fill(double x)
+{
+    ++counters[FindBin(x)];
+    ++entries;
+}
+
+template<class Histogram>
+void IntHistogram1D::CopyTo(Histogram* hist) const
+{
+    for(int i = 0; i < numbins + 2; ++i)
+        hist->SetBinContent(i, counters[i]);
+    hist->ResetStats();
+    hist->SetEntries(entries);
+}
+
+inline void IntHistogram2D::Fill(double x, double y)
+{
+    ++counters[xaxis.FindBin(x) + (xaxis.GetNumBins() + 2) * yaxis.FindBin(y)];
+    ++entries;
+}
+
+template<class Histogram>
+void IntHistogram2D::CopyTo(Histogram* hist) const
+{
+    //ROOT uses the same global bin numbers:
+    for(unsigned int i = 0; i < counters.size(); ++i)
+        hist->SetBinContent(i, counters[i]);
+    hist->ResetStats();
+    hist->SetEntries(entries);
+}
+
+template<class Histograms, class Function>
+void IntHistogramFunctions::Fill(Histograms& result, uint64_t numitems, Function fill,
+                                 unsigned int numthreads)
+{
+    //small inputs are not worth the copies of the histograms:
+    const uint64_t minitems = 100000;
+    numthreads = ThreadFunctions::GetNumThreads(numthreads);
+    if(numthreads > numitems / minitems)
+        numthreads = numitems / minitems;
+    if(numthreads <= 1)
+    {
+        fill(result, 0, numitems);
+        return;
+    }
+
+    Histograms empty(result);
+    empty.Clear();
+    std::vector<Histograms> histograms(numthreads - 1, empty);
+
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numthreads; ++i)
+        threads.push_back(std::thread([&, i]() {
+            fill(histograms[i - 1], numitems * i / numthreads, numitems * (i + 1) / numthreads);
+        }));
+    fill(result, 0, numitems / numthreads);
+    for(auto& it : threads)
+        it.join();
+
+    for(auto& it : histograms)
+        result.Merge(it);
+}
+
+#endif //__INTHISTOGRAM
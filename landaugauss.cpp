@@ -0,0 +1,331 @@
+#ifndef landaugausssources
+#define landaugausssources
+
+#include "landaugauss.h"
+
+#include <cmath>
+
+namespace {
+
+    //constants of langaufun():
+    const double invsq2pi  = 0.3989422804014;  //(2 pi)^(-1/2)
+    const double mpshift   = -0.22278298;      //Landau maximum location
+    const int    numsteps  = 100;              //number of convolution steps
+    const double numsigmas = 5.0;              //convolution extends to +- numsigmas sigmas
+
+    /**
+     * @brief The GaussianKernel contains the offsets (in units of sigma) and the weights of the
+     *      points of the convolution sum of langaufun()
+     */
+    struct GaussianKernel
+    {
+        GaussianKernel() : offsets(numsteps), weights(numsteps)
+        {
+            const double step = 2 * numsigmas / numsteps;
+            for(int i = 0; i < numsteps; ++i)
+            {
+                offsets[i] = -numsigmas + (i + 0.5) * step;
+                weights[i] = std::exp(-0.5 * offsets[i] * offsets[i]) * step * invsq2pi;
+            }
+        }
+
+        std::vector<double> offsets;
+        std::vector<double> weights;
+    };
+
+    const GaussianKernel& GetKernel()
+    {
+        static const GaussianKernel kernel;
+        return kernel;
+    }
+
+}
+
+const double LandauTable::low      = -8;
+const double LandauTable::split    = 24;
+const double LandauTable::step     = 1. / 128;
+const double LandauTable::tailstep = 1. / 4096;
+
+LandauTable::LandauTable()
+{
+    //one point below the start and two behind the end for the splines:
+    const int numpeak = int((split - low) / step) + 4;
+    peak.resize(numpeak);
+    for(int i = 0; i < numpeak; ++i)
+        peak[i] = LandauGaussFunctions::LandauDensity(low + (i - 1) * step);
+
+    const int numtail = int(1 / split / tailstep) + 5;
+    tail.resize(numtail);
+    tail[1] = 1;
+    for(int i = 2; i < numtail; ++i)
+    {
+        const double v = 1 / ((i - 1) * tailstep);
+        tail[i] = LandauGaussFunctions::LandauDensity(v) * v * v;
+    }
+    tail[0] = 2 * tail[1] - tail[2];
+}
+
+const LandauTable& LandauTable::Get()
+{
+    static const LandauTable table;
+    return table;
+}
+
+//the tables and the result never overlap, `__restrict` (known to GCC, Clang and MSVC) allows the
+//compiler to vectorise the loops with gathered table values:
+void LandauTable::AddPeak(int start, int end, const double* positions, double shift,
+                          double weight, double* __restrict result) const
+{
+    const double* __restrict p = peak.data();
+    const double scale  = 1 / step;
+    const double offset = (shift - low) * scale;
+    for(int i = start; i < end; ++i)
+    {
+        const double t = positions[i] * scale + offset;
+        const int    k = int(t);
+        const double f = t - k;
+        const double p0 = p[k], p1 = p[k + 1], p2 = p[k + 2], p3 = p[k + 3];
+
+        result[i] += weight * (p1 + 0.5 * f * (p2 - p0 + f * (2 * p0 - 5 * p1 + 4 * p2 - p3
+                                + f * (3 * (p1 - p2) + p3 - p0))));
+    }
+}
+
+void LandauTable::AddTail(int start, int end, const double* positions, double shift,
+                          double weight, double* __restrict result) const
+{
+    const double* __restrict p = tail.data();
+    const double scale = 1 / tailstep;
+    for(int i = start; i < end; ++i)
+    {
+        const double u = 1 / (positions[i] + shift);
+        const double t = u * scale;
+        const int    k = int(t);
+        const double f = t - k;
+        const double p0 = p[k], p1 = p[k + 1], p2 = p[k + 2], p3 = p[k + 3];
+
+        result[i] += weight * u * u * (p1 + 0.5 * f * (p2 - p0 + f * (2 * p0 - 5 * p1 + 4 * p2
+                                        - p3 + f * (3 * (p1 - p2) + p3 - p0))));
+    }
+}
+
+double LandauGaussFunctions::LandauDensity(double v)
+{
+    static const double p1[5] = {0.4259894875, -0.1249762550, 0.03984243700, -0.006298287635,
+                                 0.001511162253};
+    static const double q1[5] = {1.0, -0.3388260629, 0.09594393323, -0.01608042283,
+                                 0.003778942063};
+    static const double p2[5] = {0.1788541609, 0.1173957403, 0.01488850518, -0.001394989411,
+                                 0.0001283617211};
+    static const double q2[5] = {1.0, 0.7428795082, 0.3153932961, 0.06694219548,
+                                 0.008790609714};
+    static const double p3[5] = {0.1788544503, 0.09359161662, 0.006325387654, 0.00006611667319,
+                                 -0.000002031049101};
+    static const double q3[5] = {1.0, 0.6097809921, 0.2560616665, 0.04746722384,
+                                 0.006957301675};
+    static const double p4[5] = {0.9874054407, 118.6723273, 849.2794360, -743.7792444,
+                                 427.0262186};
+    static const double q4[5] = {1.0, 106.8615961, 337.6496214, 2016.712389, 1597.063511};
+    static const double p5[5] = {1.003675074, 167.5702434, 4789.711289, 21217.86767,
+                                 -22324.94910};
+    static const double q5[5] = {1.0, 156.9424537, 3745.310488, 9834.698876, 66924.28357};
+    static const double p6[5] = {1.000827619, 664.9143136, 62972.92665, 475554.6998,
+                                 -5743609.109};
+    static const double q6[5] = {1.0, 651.4101098, 56974.73333, 165917.4725, -2815759.939};
+    static const double a1[3] = {0.04166666667, -0.01996527778, 0.02709538966};
+    static const double a2[2] = {-1.845568670, -4.284640743};
+
+    auto rational = [](const double* p, const double* q, double x) {
+        return (p[0] + (p[1] + (p[2] + (p[3] + p[4] * x) * x) * x) * x)
+                / (q[0] + (q[1] + (q[2] + (q[3] + q[4] * x) * x) * x) * x);
+    };
+
+    if(v < -5.5)
+    {
+        const double u = std::exp(v + 1.0);
+        if(u < 1e-10)
+            return 0.0;
+        return 0.3989422803 * (std::exp(-1 / u) / std::sqrt(u))
+                * (1 + (a1[0] + (a1[1] + a1[2] * u) * u) * u);
+    }
+    else if(v < -1)
+    {
+        const double u = std::exp(-v - 1);
+        return std::exp(-u) * std::sqrt(u) * rational(p1, q1, v);
+    }
+    else if(v < 1)
+        return rational(p2, q2, v);
+    else if(v < 5)
+        return rational(p3, q3, v);
+    else if(v < 12)
+        return rational(p4, q4, 1 / v) / (v * v);
+    else if(v < 50)
+        return rational(p5, q5, 1 / v) / (v * v);
+    else if(v < 300)
+        return rational(p6, q6, 1 / v) / (v * v);
+    else
+    {
+        const double u = 1 / (v - v * std::log(v) / (v + 1));
+        return u * u * (1 + (a2[0] + a2[1] * u) * u);
+    }
+}
+
+double LandauGaussFunctions::Reference(double x, const double* parameters)
+{
+    const double width = parameters[0];
+    const double sigma = parameters[3];
+    if(!(width > 0))
+        return 0;
+
+    const double mpc  = parameters[1] - mpshift * width;
+    const double xlow = x - numsigmas * sigma;
+    const double xupp = x + numsigmas * sigma;
+    const double step = (xupp - xlow) / numsteps;
+
+    double sum = 0;
+    for(int i = 1; i <= numsteps / 2; ++i)
+    {
+        double xx = xlow + (i - 0.5) * step;
+        sum += LandauDensity((xx - mpc) / width) / width
+                * std::exp(-0.5 * ((x - xx) / sigma) * ((x - xx) / sigma));
+
+        xx = xupp - (i - 0.5) * step;
+        sum += LandauDensity((xx - mpc) / width) / width
+                * std::exp(-0.5 * ((x - xx) / sigma) * ((x - xx) / sigma));
+    }
+
+    return parameters[2] * step * sum * invsq2pi / sigma;
+}
+
+double LandauGaussFunctions::Evaluate(double x, const double* parameters)
+{
+    double result;
+    Evaluate(1, &x, parameters, &result);
+    return result;
+}
+
+void LandauGaussFunctions::Evaluate(unsigned int n, const double* x, const double* parameters,
+                                    double* result)
+{
+    const LandauTable&    table  = LandauTable::Get();
+    const GaussianKernel& kernel = GetKernel();
+
+    const double width = parameters[0];
+    if(!(width > 0))
+    {
+        for(unsigned int i = 0; i < n; ++i)
+            result[i] = 0;
+        return;
+    }
+    const double mpc   = parameters[1] - mpshift * width;
+    const double scale = parameters[2] / width;
+    //the kernel is normalised to sigma, so sigma = 0 gives the Landau density itself:
+    const double sigma = parameters[3] / width;
+
+    //in units of the Landau width: v = (x + offset * sigma - mpc) / width
+    std::vector<double> positions(n);
+    for(unsigned int i = 0; i < n; ++i)
+    {
+        positions[i] = (x[i] - mpc) / width;
+        result[i]    = 0;
+    }
+
+    //for sorted positions (e.g. bin centres) the ranges below the table (density 0), in the peak
+    //and in the tail table are found per kernel point, so every loop uses only one table:
+    if(std::is_sorted(x, x + n))
+    {
+        for(int k = 0; k < numsteps; ++k)
+        {
+            const double shift  = kernel.offsets[k] * sigma;
+            const double weight = kernel.weights[k];
+            const int start = std::lower_bound(positions.begin(), positions.end(),
+                                               LandauTable::GetLow() - shift)
+                                - positions.begin();
+            const int split = std::lower_bound(positions.begin() + start, positions.end(),
+                                               LandauTable::GetSplit() - shift)
+                                - positions.begin();
+            table.AddPeak(start, split, positions.data(), shift, weight, result);
+            table.AddTail(split, n, positions.data(), shift, weight, result);
+        }
+    }
+    else
+    {
+        for(int k = 0; k < numsteps; ++k)
+        {
+            const double shift  = kernel.offsets[k] * sigma;
+            const double weight = kernel.weights[k];
+            for(unsigned int i = 0; i < n; ++i)
+                result[i] += weight * table.Eval(positions[i] + shift);
+        }
+    }
+
+    for(unsigned int i = 0; i < n; ++i)
+        result[i] *= scale;
+}
+
+double LandauGaussFunctions::CheckAccuracy(double scale)
+{
+    double maxdeviation = 0;
+
+    std::vector<double> x;
+    std::vector<double> fast;
+    for(double width = 0.05; width <= 20; width *= 1.5)
+        for(double sigma = 0.05; sigma <= 20; sigma *= 1.5)
+        {
+            const double parameters[4] = {width * scale, 0, scale, sigma * scale};
+
+            x.clear();
+            for(double position = -10 * (width + sigma); position <= 100 * (width + sigma);
+                    position += 0.05 * (width + sigma))
+                x.push_back(position * scale);
+            fast.resize(x.size());
+            Evaluate(x.size(), x.data(), parameters, fast.data());
+
+            double maximum   = 0;
+            double deviation = 0;
+            for(unsigned int i = 0; i < x.size(); ++i)
+            {
+                const double reference = Reference(x[i], parameters);
+                maximum   = std::max(maximum, std::fabs(reference));
+                deviation = std::max(deviation, std::fabs(fast[i] - reference));
+            }
+            if(maximum > 0)
+                maxdeviation = std::max(maxdeviation, deviation / maximum);
+        }
+
+    return maxdeviation;
+}
+
+//------------------------------------------------------------------------------------------------
+
+LandauGaussFunction::LandauGaussFunction(int numbins, double firstcentre, double binwidth) :
+    firstcentre(firstcentre), binwidth(binwidth), centres((numbins > 0)?numbins:0),
+    values(centres.size()), cachedparameters{0, 0, 0, 0}, valid(false)
+{
+    for(unsigned int i = 0; i < centres.size(); ++i)
+        centres[i] = firstcentre + i * binwidth;
+}
+
+double LandauGaussFunction::operator()(const double* x, const double* parameters)
+{
+    const double position = (binwidth > 0)?((x[0] - firstcentre) / binwidth):-1;
+    const long   index    = std::lround(position);
+    if(index < 0 || index >= long(centres.size()) || std::fabs(position - index) > 1e-6)
+        return LandauGaussFunctions::Evaluate(x[0], parameters);
+
+    //the function is proportional to the area, so the values are cached for an area of 1 and
+    //a change of only the area (e.g. for a derivative) does not need a new evaluation:
+    if(!valid || parameters[0] != cachedparameters[0] || parameters[1] != cachedparameters[1]
+            || parameters[3] != cachedparameters[3])
+    {
+        std::copy(parameters, parameters + 4, cachedparameters);
+        cachedparameters[2] = 1;
+        LandauGaussFunctions::Evaluate(centres.size(), centres.data(), cachedparameters,
+                                       values.data());
+        valid = true;
+    }
+
+    return values[index] * parameters[2];
+}
+
+#endif //landaugausssources
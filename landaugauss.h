@@ -0,0 +1,202 @@
+#ifndef __LANDAUGAUSS
+#define __LANDAUGAUSS
+
+#include <vector>
+#include <algorithm>
+
+/*
+ * Fast evaluation of the convolution of a Landau and a Gaussian distribution as calculated by
+ * `langaufun()` in landau_gauss_ROOT/Langau.cxx. That function evaluates TMath::Landau() and
+ * TMath::Gaus() at 100 points for every value. Here the standard Landau density is tabulated
+ * once and the Gaussian weights of the 100 points are precomputed (they only depend on the
+ * position of the point in units of sigma), so a value costs 100 table interpolations. The
+ * functions do not depend on ROOT.
+ */
+
+namespace LandauGaussFunctions {
+
+    /**
+     * @brief LandauDensity calculates the density of the standard Landau distribution with the
+     *      CERNLIB approximation (DENLAN), which is also used by TMath::Landau()
+     * @param v                 - the position, (x - location) / scale
+     * @return                  - the density, equal to TMath::Landau(v, 0, 1)
+     */
+    double LandauDensity(double v);
+
+    /**
+     * @brief Reference calculates the convolution as `langaufun()`, with LandauDensity() for
+     *      TMath::Landau(), so it can be used to check the fast evaluation without ROOT
+     * @param x                 - the position to evaluate the function at
+     * @param parameters        - Landau width, most probable value, area and Gaussian sigma (the
+     *                              parameters of `langaufun()`)
+     * @return                  - the function value
+     */
+    double Reference(double x, const double* parameters);
+
+    /**
+     * @brief Evaluate calculates the convolution with the tabulated Landau density
+     * @param x                 - the position to evaluate the function at
+     * @param parameters        - the parameters as for Reference()
+     * @return                  - the function value
+     */
+    double Evaluate(double x, const double* parameters);
+    /**
+     * @brief Evaluate calculates the convolution for many positions (e.g. all bin centres of a
+     *      histogram). The loops run over the positions, so they can be vectorised.
+     * @param n                 - number of positions
+     * @param x                 - the positions
+     * @param parameters        - the parameters as for Reference()
+     * @param result            - array of n values to write the function values to
+     */
+    void Evaluate(unsigned int n, const double* x, const double* parameters, double* result);
+
+    /**
+     * @brief CheckAccuracy compares Evaluate() to Reference() for the Landau widths and
+     *      Gaussian sigmas in [0.05, 20] x `scale` around a most probable value of 0
+     * @param scale             - scale of the parameters and positions
+     * @return                  - the maximum deviation relative to the function maximum
+     */
+    double CheckAccuracy(double scale = 1);
+
+}
+
+/**
+ * @brief LandauGaussFunction is a function object for fits of the convolution to histograms (e.g.
+ *      with a TF1). Minuit evaluates the function bin after bin with the same parameters, so on a
+ *      change of the parameters the values at all bin centres are calculated with one call of
+ *      LandauGaussFunctions::Evaluate(). Other positions are calculated one by one.
+ */
+class LandauGaussFunction
+{
+public:
+    /**
+     * @brief LandauGaussFunction prepares the cache for equidistant bins
+     * @param numbins           - number of bins to cache the values for
+     * @param firstcentre       - centre of the first bin
+     * @param binwidth          - width of the bins
+     */
+    LandauGaussFunction(int numbins, double firstcentre, double binwidth);
+
+    /**
+     * @brief operator () evaluates the function with the signature of TF1 functions
+     * @param x                 - the position
+     * @param parameters        - Landau width, most probable value, area and Gaussian sigma
+     * @return                  - the function value
+     */
+    double operator()(const double* x, const double* parameters);
+
+private:
+    double              firstcentre;
+    double              binwidth;
+    std::vector<double> centres;
+    std::vector<double> values;
+    double              cachedparameters[4];    //the parameters `values` belong to (area 1)
+    bool                valid;
+};
+
+/**
+ * @brief LandauTable holds the standard Landau density on a grid. The region around the peak is
+ *      tabulated in v, the tail above `split` in u = 1 / v as v^2 * density, which is smooth
+ *      and tends to 1. Values are interpolated with cubic Catmull-Rom splines.
+ */
+class LandauTable
+{
+public:
+    /**
+     * @brief Get gives the table, it is filled on the first call
+     * @return                  - the shared table
+     */
+    static const LandauTable& Get();
+
+    /**
+     * @brief Eval interpolates the standard Landau density
+     * @param v                 - the position, (x - location) / scale
+     * @return                  - the density
+     */
+    inline double Eval(double v) const;
+    /**
+     * @brief EvalPeak interpolates the density in the peak table, the position is clamped to the
+     *      table range
+     * @param v                 - the position, below GetSplit()
+     * @return                  - the density
+     */
+    inline double EvalPeak(double v) const;
+    /**
+     * @brief EvalTail interpolates the density in the tail table
+     * @param v                 - the position, at least GetSplit()
+     * @return                  - the density
+     */
+    inline double EvalTail(double v) const;
+
+    /**
+     * @brief AddPeak adds weighted densities from the peak table to an array. The positions are
+     *      not clamped, so the loop can be vectorised.
+     * @param start             - first index to process
+     * @param end               - index behind the last one to process
+     * @param positions         - the positions, in [GetLow(), GetSplit()) after the shift
+     * @param shift             - offset added to all positions
+     * @param weight            - factor for the densities
+     * @param result            - the array to add the weighted densities to
+     */
+    void AddPeak(int start, int end, const double* positions, double shift, double weight,
+                 double* result) const;
+    /**
+     * @brief AddTail adds weighted densities from the tail table to an array, like AddPeak()
+     * @param start             - first index to process
+     * @param end               - index behind the last one to process
+     * @param positions         - the positions, at least GetSplit() after the shift
+     * @param shift             - offset added to all positions
+     * @param weight            - factor for the densities
+     * @param result            - the array to add the weighted densities to
+     */
+    void AddTail(int start, int end, const double* positions, double shift, double weight,
+                 double* result) const;
+
+    static double GetLow()   { return low; }
+    static double GetSplit() { return split; }
+
+private:
+    LandauTable();
+
+    static const double low;        //start of the peak table (the density is 0 below)
+    static const double split;      //start of the tail table
+    static const double step;       //step width of the peak table
+    static const double tailstep;   //step width of the tail table in u = 1 / v
+
+    std::vector<double> peak;
+    std::vector<double> tail;
+};
+
+inline double LandauTable::Eval(double v) const
+{
+    //both tables are evaluated (with clamped positions), so the function has no branches:
+    const double peakvalue = EvalPeak(v);
+    const double tailvalue = EvalTail(v);
+
+    return (v < split)?peakvalue:tailvalue;
+}
+
+inline double LandauTable::EvalPeak(double v) const
+{
+    const double t = std::min(std::max((v - low) / step + 1, 1.), double(peak.size() - 3));
+    const int    i = int(t);
+    const double f = t - i;
+    const double* p = &peak[i - 1];
+
+    return p[1] + 0.5 * f * (p[2] - p[0] + f * (2 * p[0] - 5 * p[1] + 4 * p[2] - p[3]
+                    + f * (3 * (p[1] - p[2]) + p[3] - p[0])));
+}
+
+inline double LandauTable::EvalTail(double v) const
+{
+    const double u = 1 / std::max(v, split);
+    const double t = std::min(u / tailstep + 1, double(tail.size() - 3));
+    const int    i = int(t);
+    const double f = t - i;
+    const double* p = &tail[i - 1];
+
+    return u * u * (p[1] + 0.5 * f * (p[2] - p[0] + f * (2 * p[0] - 5 * p[1] + 4 * p[2] - p[3]
+                        + f * (3 * (p[1] - p[2]) + p[3] - p[0]))));
+}
+
+#endif //__LANDAUGAUSS
@@ -0,0 +1,287 @@
+#ifndef landaugaussbatchsources
+#define landaugaussbatchsources
+
+#include "landaugaussbatch.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+namespace {
+
+    /**
+     * @brief FitContext contains the state of one thread of LandauGaussBatch::Run(). The results
+     *      fitted by the thread are collected here and added to the (not thread-safe) cache after
+     *      all threads finished.
+     */
+    struct FitContext
+    {
+        std::vector<std::pair<uint64_t, LMResult> > fitted;
+    };
+
+    const uint64_t fnvoffset = 14695981039346656037ull;
+    const uint64_t fnvprime  = 1099511628211ull;
+
+    void HashBytes(uint64_t& hash, const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= fnvprime;
+        }
+    }
+
+    void HashVector(uint64_t& hash, const std::vector<double>& values)
+    {
+        const uint64_t size = values.size();
+        HashBytes(hash, &size, sizeof(size));
+        if(size > 0)
+            HashBytes(hash, values.data(), size * sizeof(double));
+    }
+
+}
+
+LandauGaussBatch::LandauGaussBatch(unsigned int numthreads, const LMSettings& settings) :
+    numthreads(numthreads), settings(settings)
+{
+
+}
+
+void LandauGaussBatch::Add(const LandauGaussFitJob& job)
+{
+    jobs.push_back(job);
+}
+
+void LandauGaussBatch::Add(std::string name, const double* contents, int numbins, double low,
+                           double binwidth, double rangestart, double rangeend)
+{
+    LandauGaussFitJob job;
+    job.name = name;
+    if(numbins > 0)
+        job.spectrum.contents.assign(contents, contents + numbins);
+    job.spectrum.low        = low;
+    job.spectrum.binwidth   = binwidth;
+    job.spectrum.rangestart = rangestart;
+    job.spectrum.rangeend   = rangeend;
+
+    jobs.push_back(job);
+}
+
+void LandauGaussBatch::Clear()
+{
+    jobs.clear();
+    results.clear();
+}
+
+unsigned int LandauGaussBatch::GetNumJobs() const
+{
+    return jobs.size();
+}
+
+const std::vector<LandauGaussFitOutput>& LandauGaussBatch::Run()
+{
+    results.assign(jobs.size(), LandauGaussFitOutput());
+
+    //only the first job with a key which is not in the cache is fitted:
+    std::vector<unsigned int>        tofit;
+    std::map<uint64_t, unsigned int> scheduled;
+    for(unsigned int i = 0; i < jobs.size(); ++i)
+    {
+        results[i].name = jobs[i].name;
+        results[i].hash = Hash(jobs[i], settings);
+
+        if(cache.find(results[i].hash) != cache.end())
+            results[i].cached = true;
+        else if(scheduled.find(results[i].hash) != scheduled.end())
+            results[i].cached = true;
+        else
+        {
+            scheduled[results[i].hash] = i;
+            tofit.push_back(i);
+        }
+    }
+
+    const unsigned int blocksize = 4;
+    unsigned int threads = ThreadFunctions::GetNumThreads(numthreads);
+    if(threads > (tofit.size() + blocksize - 1) / blocksize)
+        threads = (tofit.size() + blocksize - 1) / blocksize;
+    if(threads == 0)
+        threads = 1;
+
+    std::vector<FitContext>   contexts(threads);
+    std::atomic<unsigned int> nextblock(0);
+    auto worker = [&](FitContext& context)
+    {
+        unsigned int block;
+        while((block = nextblock++) * blocksize < tofit.size())
+        {
+            const unsigned int end = std::min<unsigned int>((block + 1) * blocksize,
+                                                            tofit.size());
+            for(unsigned int i = block * blocksize; i < end; ++i)
+            {
+                const LandauGaussFitJob& job = jobs[tofit[i]];
+                results[tofit[i]].result = LandauGaussFitFunctions::Fit(job.spectrum, job.start,
+                                                                        job.lower, job.upper,
+                                                                        settings);
+                context.fitted.push_back(std::make_pair(results[tofit[i]].hash,
+                                                        results[tofit[i]].result));
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned int i = 1; i < threads; ++i)
+        workers.push_back(std::thread(worker, std::ref(contexts[i])));
+    worker(contexts[0]);
+    for(auto& it : workers)
+        it.join();
+
+    for(auto& context : contexts)
+        for(auto& it : context.fitted)
+            cache[it.first] = it.second;
+
+    for(auto& it : results)
+        if(it.cached)
+            it.result = cache[it.hash];
+
+    return results;
+}
+
+const std::vector<LandauGaussFitOutput>& LandauGaussBatch::GetResults() const
+{
+    return results;
+}
+
+bool LandauGaussBatch::Write(std::string filename) const
+{
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::out);
+    if(!f.is_open())
+        return false;
+
+    f << "# name\thash\tcached\tstatus\tatlimit\tchi2\tndf\titerations"
+         "\tWidth\tWidthError\tMP\tMPError\tArea\tAreaError\tGSigma\tGSigmaError\n"
+      << "# status: " << int(LM_Converged) << " converged, " << int(LM_MaxIterations)
+      << " iteration limit, " << int(LM_Failed) << " failed, " << int(LM_TooFewPoints)
+      << " too few bins with entries\n";
+
+    for(auto& it : results)
+    {
+        const LMResult& result = it.result;
+
+        f << it.name << "\t" << std::hex << std::setw(16) << std::setfill('0') << it.hash
+          << std::dec << std::setfill(' ') << "\t" << (it.cached?1:0) << "\t" << result.status
+          << "\t" << (result.atlimit?1:0) << "\t" << result.chi2 << "\t" << result.ndf << "\t"
+          << result.iterations;
+        for(int i = 0; i < LG_NumParameters; ++i)
+            f << "\t" << ((result.parameters.size() > unsigned(i))?result.parameters[i]:0)
+              << "\t" << ((result.errors.size() > unsigned(i))?result.errors[i]:0);
+        f << "\n";
+    }
+
+    f.flush();
+    return f.good();
+}
+
+bool LandauGaussBatch::LoadCache(std::string filename)
+{
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::in);
+    if(!f.is_open())
+        return true;
+
+    std::string line;
+    while(std::getline(f, line))
+    {
+        if(line.length() == 0 || line[0] == '#')
+            continue;
+
+        std::stringstream s(line);
+        uint64_t     hash;
+        LMResult     result;
+        int          atlimit;
+        unsigned int numparameters;
+        s >> std::hex >> hash >> std::dec >> result.status >> atlimit >> result.chi2 >> result.ndf
+          >> result.iterations >> numparameters;
+        if(s.fail() || numparameters > 64)
+            return false;
+        result.atlimit = (atlimit != 0);
+
+        result.parameters.resize(numparameters);
+        result.covariance.resize(numparameters * numparameters);
+        for(auto& it : result.parameters)
+            s >> it;
+        for(auto& it : result.covariance)
+            s >> it;
+        if(s.fail())
+            return false;
+
+        result.errors.resize(numparameters);
+        for(unsigned int i = 0; i < numparameters; ++i)
+            result.errors[i] = std::sqrt(std::max(result.covariance[i * numparameters + i], 0.));
+
+        cache[hash] = result;
+    }
+
+    return true;
+}
+
+bool LandauGaussBatch::SaveCache(std::string filename) const
+{
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::out);
+    if(!f.is_open())
+        return false;
+
+    f << "# Landau-Gauss fit cache: hash status atlimit chi2 ndf iterations numparameters"
+         " parameters covariance\n";
+    f << std::setprecision(17);
+
+    for(auto& it : cache)
+    {
+        const LMResult& result = it.second;
+
+        f << std::hex << it.first << std::dec << " " << result.status << " "
+          << (result.atlimit?1:0) << " " << result.chi2 << " " << result.ndf << " "
+          << result.iterations << " " << result.parameters.size();
+        for(auto& value : result.parameters)
+            f << " " << value;
+        for(unsigned int i = 0; i < result.parameters.size() * result.parameters.size(); ++i)
+            f << " " << ((result.covariance.size() > i)?result.covariance[i]:0);
+        f << "\n";
+    }
+
+    f.flush();
+    return f.good();
+}
+
+unsigned int LandauGaussBatch::GetCacheSize() const
+{
+    return cache.size();
+}
+
+uint64_t LandauGaussBatch::Hash(const LandauGaussFitJob& job, const LMSettings& settings)
+{
+    uint64_t hash = fnvoffset;
+
+    HashVector(hash, job.spectrum.contents);
+    const double binning[4] = {job.spectrum.low, job.spectrum.binwidth, job.spectrum.rangestart,
+                               job.spectrum.rangeend};
+    HashBytes(hash, binning, sizeof(binning));
+    HashVector(hash, job.start);
+    HashVector(hash, job.lower);
+    HashVector(hash, job.upper);
+
+    const double steering[3] = {settings.tolerance, settings.lambda, settings.derivativestep};
+    HashBytes(hash, steering, sizeof(steering));
+    HashBytes(hash, &settings.maxiterations, sizeof(settings.maxiterations));
+
+    return hash;
+}
+
+#endif //landaugaussbatchsources
@@ -0,0 +1,124 @@
+#ifndef __LANDAUGAUSSBATCH
+#define __LANDAUGAUSSBATCH
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+#include "landaugaussfit.h"
+
+/*
+ * Batch fits of the Landau-Gauss convolution to many spectra (e.g. the ToT spectra of all layers,
+ * regions and cluster sizes of an analysis). The spectra are collected first and then fitted
+ * concurrently, every thread works on its own fit context. All results are written to one
+ * table. Results are cached with a hash of the bin contents and the fit settings as key, so a
+ * repeated analysis with a cache file only fits the spectra which changed.
+ */
+
+/**
+ * @brief LandauGaussFitJob is one spectrum to fit with its start values and limits
+ */
+struct LandauGaussFitJob
+{
+    std::string         name;
+    LandauGaussSpectrum spectrum;
+    std::vector<double> start;      //empty for LandauGaussFitFunctions::StartValues()
+    std::vector<double> lower;      //empty for LandauGaussFitFunctions::DefaultLimits()
+    std::vector<double> upper;
+};
+
+/**
+ * @brief LandauGaussFitOutput is the result for one job
+ */
+struct LandauGaussFitOutput
+{
+    LandauGaussFitOutput() : hash(0), cached(false) {}
+
+    std::string name;
+    uint64_t    hash;       //key of the result in the cache
+    LMResult    result;
+    bool        cached;     //the result was taken from the cache instead of fitting
+};
+
+/**
+ * @brief LandauGaussBatch collects spectra, fits them on several threads and writes the results
+ */
+class LandauGaussBatch
+{
+public:
+    /**
+     * @brief LandauGaussBatch creates an empty batch
+     * @param numthreads        - maximum number of threads, 0 for one per CPU core
+     * @param settings          - steering parameters of the fits
+     */
+    LandauGaussBatch(unsigned int numthreads = 0, const LMSettings& settings = LMSettings());
+
+    /**
+     * @brief Add adds a spectrum to fit
+     * @param job               - the spectrum with its name, start values and limits
+     */
+    void Add(const LandauGaussFitJob& job);
+    /**
+     * @brief Add adds a spectrum given as an array of bin contents
+     * @param name              - name of the spectrum in the output
+     * @param contents          - the bin contents
+     * @param numbins           - number of bins
+     * @param low               - lower edge of the first bin
+     * @param binwidth          - width of the bins
+     * @param rangestart        - start of the fit range
+     * @param rangeend          - end of the fit range
+     */
+    void Add(std::string name, const double* contents, int numbins, double low, double binwidth,
+             double rangestart = -1e10, double rangeend = 1e10);
+
+    void         Clear();
+    unsigned int GetNumJobs() const;
+
+    /**
+     * @brief Run fits all spectra added, results found in the cache (or for an identical spectrum
+     *      in the same batch) are reused
+     * @return                  - the results in the order of the jobs
+     */
+    const std::vector<LandauGaussFitOutput>& Run();
+    const std::vector<LandauGaussFitOutput>& GetResults() const;
+
+    /**
+     * @brief Write writes the results of Run() as a table with one line per spectrum
+     * @param filename          - the file to write
+     * @return                  - false if the file could not be written
+     */
+    bool Write(std::string filename) const;
+
+    /**
+     * @brief LoadCache adds the results stored in a cache file to the cache
+     * @param filename          - the file to read, a missing file is not an error
+     * @return                  - false if the file exists but could not be read completely
+     */
+    bool LoadCache(std::string filename);
+    /**
+     * @brief SaveCache writes all results in the cache (loaded and fitted) to a file
+     * @param filename          - the file to write
+     * @return                  - false if the file could not be written
+     */
+    bool SaveCache(std::string filename) const;
+    unsigned int GetCacheSize() const;
+
+    /**
+     * @brief Hash calculates the cache key of a job from the bin contents, binning, fit range,
+     *      start values, limits and fit settings (FNV-1a, 64 bit)
+     * @param job               - the job to calculate the key for
+     * @param settings          - the steering parameters of the fit
+     * @return                  - the key
+     */
+    static uint64_t Hash(const LandauGaussFitJob& job, const LMSettings& settings);
+
+private:
+    unsigned int                      numthreads;
+    LMSettings                        settings;
+    std::vector<LandauGaussFitJob>    jobs;
+    std::vector<LandauGaussFitOutput> results;
+    std::map<uint64_t, LMResult>      cache;
+};
+
+#endif //__LANDAUGAUSSBATCH
@@ -0,0 +1,197 @@
+#ifndef landaugaussfitsources
+#define landaugaussfitsources
+
+#include "landaugaussfit.h"
+
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+LandauGaussSpectrum::LandauGaussSpectrum() : low(0), binwidth(1), rangestart(-1e10),
+    rangeend(1e10)
+{
+
+}
+
+LandauGaussSpectrum::LandauGaussSpectrum(const uint32_t* counters, int numbins, double low,
+                                         double binwidth) :
+    contents(counters, counters + ((numbins > 0)?numbins:0)), low(low), binwidth(binwidth),
+    rangestart(-1e10), rangeend(1e10)
+{
+
+}
+
+//------------------------------------------------------------------------------------------------
+
+namespace {
+
+    /**
+     * @brief GetRange finds the bins with their centre in the fit range
+     * @param spectrum          - the spectrum to fit
+     * @param firstbin          - variable to write the first bin in the range to
+     * @param lastbin           - variable to write the last bin in the range to
+     * @return                  - false if no bin is in the range
+     */
+    bool GetRange(const LandauGaussSpectrum& spectrum, int& firstbin, int& lastbin)
+    {
+        firstbin = -1;
+        lastbin  = -1;
+        for(int i = 0; i < int(spectrum.contents.size()); ++i)
+        {
+            const double centre = spectrum.GetCentre(i);
+            if(centre < spectrum.rangestart || centre > spectrum.rangeend)
+                continue;
+            if(firstbin < 0)
+                firstbin = i;
+            lastbin = i;
+        }
+
+        return firstbin >= 0;
+    }
+
+}
+
+std::vector<double> LandauGaussFitFunctions::StartValues(const LandauGaussSpectrum& spectrum)
+{
+    const std::vector<double>& contents = spectrum.contents;
+
+    std::vector<double> start(LG_NumParameters, 0);
+    start[LG_Width] = spectrum.binwidth;
+    start[LG_Sigma] = spectrum.binwidth;
+
+    int firstbin;
+    int lastbin;
+    if(!GetRange(spectrum, firstbin, lastbin))
+        return start;
+
+    int    maxbin   = firstbin;
+    double integral = 0;
+    for(int i = firstbin; i <= lastbin; ++i)
+    {
+        integral += contents[i];
+        if(contents[i] > contents[maxbin])
+            maxbin = i;
+    }
+
+    const double half  = contents[maxbin] / 2;
+    int          left  = maxbin;
+    int          right = maxbin;
+    while(left > firstbin && contents[left - 1] > half)
+        --left;
+    while(right < lastbin && contents[right + 1] > half)
+        ++right;
+    //a Landau distribution has a FWHM of about 4 widths, the Gaussian of 2.4 sigmas:
+    const double fwhm = (right - left + 1) * spectrum.binwidth;
+
+    start[LG_Width] = fwhm / 8;
+    start[LG_MP]    = spectrum.GetCentre(maxbin);
+    start[LG_Area]  = integral * spectrum.binwidth;
+    start[LG_Sigma] = fwhm / 5;
+
+    return start;
+}
+
+void LandauGaussFitFunctions::DefaultLimits(const LandauGaussSpectrum& spectrum,
+                                            std::vector<double>& lower, std::vector<double>& upper)
+{
+    double integral = 0;
+    for(auto content : spectrum.contents)
+        integral += content;
+    const double length = spectrum.contents.size() * spectrum.binwidth;
+
+    lower.assign(LG_NumParameters, 0);
+    upper.assign(LG_NumParameters, 0);
+
+    lower[LG_MP]    = spectrum.GetCentre(0);
+    upper[LG_Width] = length;
+    upper[LG_MP]    = spectrum.GetCentre(int(spectrum.contents.size()) - 1);
+    upper[LG_Area]  = 1000 * integral * spectrum.binwidth;
+    upper[LG_Sigma] = length;
+}
+
+LMResult LandauGaussFitFunctions::Fit(const LandauGaussSpectrum& spectrum,
+                                      const std::vector<double>& start,
+                                      const std::vector<double>& lower,
+                                      const std::vector<double>& upper,
+                                      const LMSettings& settings)
+{
+    //as in ROOT's chi^2 fits, only bins with entries are used:
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> sigma;
+    int firstbin;
+    int lastbin;
+    if(!GetRange(spectrum, firstbin, lastbin))
+    {
+        firstbin = 0;
+        lastbin  = -1;
+    }
+    int firstused = 0;
+    int lastused  = -1;
+    for(int i = firstbin; i <= lastbin; ++i)
+    {
+        if(!(spectrum.contents[i] > 0))
+            continue;
+        if(x.empty())
+            firstused = i;
+        lastused = i;
+        x.push_back(spectrum.GetCentre(i));
+        y.push_back(spectrum.contents[i]);
+        sigma.push_back(std::sqrt(spectrum.contents[i]));
+    }
+
+    std::vector<double> defaultlower;
+    std::vector<double> defaultupper;
+    if(lower.empty() || upper.empty())
+        DefaultLimits(spectrum, defaultlower, defaultupper);
+
+    //the function calculates the values of all bins from the first to the last one used at once:
+    LandauGaussFunction function(lastused - firstused + 1, spectrum.GetCentre(firstused),
+                                 spectrum.binwidth);
+    auto model = [&function](double x, const double* parameters) {
+        return function(&x, parameters);
+    };
+
+    return LMFitFunctions::Fit(model, x.data(), y.data(), sigma.data(), x.size(),
+                               (start.empty())?StartValues(spectrum):start,
+                               (lower.empty())?defaultlower:lower,
+                               (upper.empty())?defaultupper:upper, settings);
+}
+
+std::vector<LMResult> LandauGaussFitFunctions::Fit(const std::vector<LandauGaussSpectrum>& spectra,
+                                                   unsigned int numthreads,
+                                                   const LMSettings& settings)
+{
+    std::vector<LMResult> results(spectra.size());
+
+    //the spectra are handed out in blocks to keep the contention on the counter low:
+    const unsigned int blocksize = 16;
+    numthreads = ThreadFunctions::GetNumThreads(numthreads);
+    if(numthreads > (spectra.size() + blocksize - 1) / blocksize)
+        numthreads = (spectra.size() + blocksize - 1) / blocksize;
+
+    std::atomic<unsigned int> nextblock(0);
+    auto worker = [&]()
+    {
+        unsigned int block;
+        while((block = nextblock++) * blocksize < spectra.size())
+        {
+            const unsigned int end = std::min<unsigned int>((block + 1) * blocksize,
+                                                            spectra.size());
+            for(unsigned int i = block * blocksize; i < end; ++i)
+                results[i] = Fit(spectra[i], std::vector<double>(), std::vector<double>(),
+                                 std::vector<double>(), settings);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numthreads; ++i)
+        threads.push_back(std::thread(worker));
+    worker();
+    for(auto& it : threads)
+        it.join();
+
+    return results;
+}
+
+#endif //landaugaussfitsources
@@ -0,0 +1,103 @@
+#ifndef __LANDAUGAUSSFIT
+#define __LANDAUGAUSSFIT
+
+#include <vector>
+#include <stdint.h>
+
+#include "landaugauss.h"
+#include "lmfit.h"
+#include "threads.h"
+
+/*
+ * Fits of the Landau-Gauss convolution to spectra without ROOT. The fit minimises the same chi^2
+ * as `langaufit()` (bins with entries in the fit range, errors sqrt(entries)) with the
+ * Levenberg-Marquardt fitter of lmfit.h and evaluates the function with LandauGaussFunction.
+ * There is no global state, so many spectra (e.g. the per-pixel ToT spectra of ToTSpectra) are
+ * fitted in parallel threads.
+ */
+
+/**
+ * @brief LandauGaussParameter gives the order of the parameters, which is the one of `langaufun()`
+ */
+enum LandauGaussParameter {
+    LG_Width            = 0,    //width of the Landau distribution
+    LG_MP               = 1,    //most probable value of the Landau distribution
+    LG_Area             = 2,
+    LG_Sigma            = 3,    //sigma of the Gaussian distribution
+    LG_NumParameters    = 4
+};
+
+/**
+ * @brief LandauGaussSpectrum is a histogram with equidistant bins to fit
+ */
+struct LandauGaussSpectrum
+{
+    LandauGaussSpectrum();
+    /**
+     * @brief LandauGaussSpectrum copies the counters of a spectrum (e.g. from
+     *      ToTSpectra::GetSpectrum())
+     * @param counters          - the bin contents
+     * @param numbins           - number of bins
+     * @param low               - lower edge of the first bin
+     * @param binwidth          - width of the bins
+     */
+    LandauGaussSpectrum(const uint32_t* counters, int numbins, double low, double binwidth);
+
+    double GetCentre(int bin) const { return low + (bin + 0.5) * binwidth; }
+
+    std::vector<double> contents;
+    double              low;            //lower edge of the first bin
+    double              binwidth;
+    double              rangestart;     //fit range, by default the whole spectrum
+    double              rangeend;
+};
+
+namespace LandauGaussFitFunctions {
+
+    /**
+     * @brief StartValues estimates the parameters from the peak of the spectrum: the most
+     *      probable value at the maximum, the area from the entries in the fit range and the
+     *      widths from the full width at half maximum
+     * @param spectrum          - the spectrum to fit
+     * @return                  - the LG_NumParameters start values
+     */
+    std::vector<double> StartValues(const LandauGaussSpectrum& spectrum);
+    /**
+     * @brief DefaultLimits sets the parameter limits of `fitLandauGaussToHistogram()`, scaled to
+     *      the spectrum: widths up to the spectrum length, the most probable value inside the
+     *      spectrum and an area up to 1000 times the one of the spectrum
+     * @param spectrum          - the spectrum to fit
+     * @param lower             - vector to write the lower limits to
+     * @param upper             - vector to write the upper limits to
+     */
+    void DefaultLimits(const LandauGaussSpectrum& spectrum, std::vector<double>& lower,
+                       std::vector<double>& upper);
+
+    /**
+     * @brief Fit fits the Landau-Gauss convolution to one spectrum
+     * @param spectrum          - the spectrum to fit
+     * @param start             - start values, empty for StartValues()
+     * @param lower             - lower parameter limits, empty for DefaultLimits()
+     * @param upper             - upper parameter limits, empty for DefaultLimits()
+     * @param settings          - steering parameters of the fit
+     * @return                  - parameters, covariance and status of the fit
+     */
+    LMResult Fit(const LandauGaussSpectrum& spectrum,
+                 const std::vector<double>& start = std::vector<double>(),
+                 const std::vector<double>& lower = std::vector<double>(),
+                 const std::vector<double>& upper = std::vector<double>(),
+                 const LMSettings& settings = LMSettings());
+    /**
+     * @brief Fit fits many spectra on several threads with the default start values and limits
+     * @param spectra           - the spectra to fit
+     * @param numthreads        - maximum number of threads, 0 for one per CPU core
+     * @param settings          - steering parameters of the fits
+     * @return                  - the fit results in the order of the spectra
+     */
+    std::vector<LMResult> Fit(const std::vector<LandauGaussSpectrum>& spectra,
+                              unsigned int numthreads = 0,
+                              const LMSettings& settings = LMSettings());
+
+}
+
+#endif //__LANDAUGAUSSFIT
@@ -0,0 +1,74 @@
+#ifndef lmfitsources
+#define lmfitsources
+
+#include "lmfit.h"
+
+bool LMFitFunctions::Solve(std::vector<double>& matrix, std::vector<double>& vector)
+{
+    const unsigned int size = vector.size();
+    if(matrix.size() != size * size)
+        return false;
+
+    //Cholesky decomposition (lower triangle, in place):
+    for(unsigned int j = 0; j < size; ++j)
+    {
+        double diagonal = matrix[j * size + j];
+        for(unsigned int k = 0; k < j; ++k)
+            diagonal -= matrix[j * size + k] * matrix[j * size + k];
+        if(!(diagonal > 0))
+            return false;
+        diagonal = std::sqrt(diagonal);
+        matrix[j * size + j] = diagonal;
+
+        for(unsigned int i = j + 1; i < size; ++i)
+        {
+            double value = matrix[i * size + j];
+            for(unsigned int k = 0; k < j; ++k)
+                value -= matrix[i * size + k] * matrix[j * size + k];
+            matrix[i * size + j] = value / diagonal;
+        }
+    }
+
+    //forward and backward substitution:
+    for(unsigned int i = 0; i < size; ++i)
+    {
+        for(unsigned int k = 0; k < i; ++k)
+            vector[i] -= matrix[i * size + k] * vector[k];
+        vector[i] /= matrix[i * size + i];
+    }
+    for(unsigned int i = size; i-- > 0; )
+    {
+        for(unsigned int k = i + 1; k < size; ++k)
+            vector[i] -= matrix[k * size + i] * vector[k];
+        vector[i] /= matrix[i * size + i];
+    }
+
+    return true;
+}
+
+bool LMFitFunctions::Invert(const std::vector<double>& matrix, std::vector<double>& inverse)
+{
+    const unsigned int size = std::sqrt(double(matrix.size())) + 0.5;
+    if(size * size != matrix.size())
+        return false;
+
+    //column by column with the unit vectors as right hand sides:
+    inverse.assign(size * size, 0);
+    std::vector<double> decomposition;
+    std::vector<double> column;
+    for(unsigned int j = 0; j < size; ++j)
+    {
+        decomposition = matrix;
+        column.assign(size, 0);
+        column[j] = 1;
+        if(!Solve(decomposition, column))
+            return false;
+
+        for(unsigned int i = 0; i < size; ++i)
+            inverse[i * size + j] = column[i];
+    }
+
+    return true;
+}
+
+#endif //lmfitsources
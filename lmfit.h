@@ -0,0 +1,300 @@
+#ifndef __LMFIT
+#define __LMFIT
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+/*
+ * Weighted least squares fits with the Levenberg-Marquardt algorithm. The fitter keeps all of its
+ * state in local variables (unlike ROOT's TMinuit and the global gMinuit), so independent fits
+ * can run in parallel threads. The model is passed as a functor, the derivatives are calculated
+ * numerically. Parameter limits are applied by projecting every step onto the allowed range.
+ */
+
+enum LMStatus {
+    LM_Converged        = 0,
+    LM_MaxIterations    = 1,    //the iteration limit was reached before the chi^2 settled
+    LM_Failed           = 2,    //the chi^2 of the start values or the normal equations are invalid
+    LM_TooFewPoints     = 3     //less data points than free parameters
+};
+
+/**
+ * @brief LMSettings contains the steering parameters of a fit
+ */
+struct LMSettings
+{
+    LMSettings() : maxiterations(200), tolerance(1e-10), lambda(1e-3), derivativestep(1e-7) {}
+
+    unsigned int maxiterations;
+    double       tolerance;         //relative change of chi^2 or the parameters to stop at
+    double       lambda;            //start value of the damping parameter
+    double       derivativestep;    //relative step for the numerical derivatives
+};
+
+/**
+ * @brief LMResult contains the parameters found and the quality of a fit
+ */
+struct LMResult
+{
+    LMResult() : chi2(0), ndf(0), iterations(0), status(LM_Failed), atlimit(false) {}
+
+    std::vector<double> parameters;
+    std::vector<double> errors;         //square roots of the diagonal of the covariance
+    std::vector<double> covariance;     //row-major, parameters.size()^2 entries
+    double              chi2;
+    unsigned int        ndf;
+    unsigned int        iterations;
+    int                 status;         //see LMStatus
+    bool                atlimit;        //at least one parameter is at one of its limits
+
+    bool Converged() const { return status == LM_Converged; }
+};
+
+namespace LMFitFunctions {
+
+    /**
+     * @brief Solve solves a symmetric positive definite linear system with a Cholesky
+     *      decomposition
+     * @param matrix            - the matrix (row-major, size^2 entries), it is overwritten
+     * @param vector            - the right hand side, it is replaced by the solution
+     * @return                  - false if the matrix is not positive definite
+     */
+    bool Solve(std::vector<double>& matrix, std::vector<double>& vector);
+    /**
+     * @brief Invert inverts a symmetric positive definite matrix
+     * @param matrix            - the matrix (row-major)
+     * @param inverse           - the matrix to write the inverse to
+     * @return                  - false if the matrix is not positive definite
+     */
+    bool Invert(const std::vector<double>& matrix, std::vector<double>& inverse);
+
+    /**
+     * @brief Fit minimises sum((y - model(x, p)) / sigma)^2
+     * @param model             - the model, called as model(x, parameters) with
+     *                              `const double* parameters`
+     * @param x                 - positions of the data points
+     * @param y                 - values of the data points
+     * @param sigma             - uncertainties of the values, nullptr for 1 everywhere
+     * @param n                 - number of data points
+     * @param start             - start values of the parameters
+     * @param lower             - lower limits of the parameters, empty for no limits
+     * @param upper             - upper limits of the parameters, empty for no limits
+     * @param settings          - steering parameters
+     * @return                  - the parameters with their covariance and the fit status
+     */
+    template<class Model>
+    LMResult Fit(Model model, const double* x, const double* y, const double* sigma,
+                 unsigned int n, const std::vector<double>& start,
+                 const std::vector<double>& lower = std::vector<double>(),
+                 const std::vector<double>& upper = std::vector<double>(),
+                 const LMSettings& settings = LMSettings());
+
+    /**
+     * @brief Jacobian calculates the derivatives of the weighted residuals numerically
+     * @param model             - the model, see Fit()
+     * @param x                 - positions of the data points
+     * @param sigma             - uncertainties of the values, nullptr for 1 everywhere
+     * @param n                 - number of data points
+     * @param parameters        - the parameters to calculate the derivatives at
+     * @param upper             - upper limits of the parameters, the derivative is taken
+     *                              backwards at the limit
+     * @param step              - relative step width
+     * @param values            - the model values at `parameters`
+     * @param jacobian          - the n x parameters.size() derivatives of model / sigma
+     */
+    template<class Model>
+    void Jacobian(Model& model, const double* x, const double* sigma, unsigned int n,
+                  const std::vector<double>& parameters, const std::vector<double>& upper,
+                  double step, const std::vector<double>& values, std::vector<double>& jacobian);
+
+}
+
+template<class Model>
+void LMFitFunctions::Jacobian(Model& model, const double* x, const double* sigma, unsigned int n,
+                              const std::vector<double>& parameters,
+                              const std::vector<double>& upper, double step,
+                              const std::vector<double>& values, std::vector<double>& jacobian)
+{
+    const unsigned int numparameters = parameters.size();
+    jacobian.resize(n * numparameters);
+
+    std::vector<double> shifted(parameters);
+    for(unsigned int j = 0; j < numparameters; ++j)
+    {
+        double h = step * std::max(std::fabs(parameters[j]), 1e-3);
+        if(upper.size() > j && parameters[j] + h > upper[j])
+            h = -h;
+
+        shifted[j] = parameters[j] + h;
+        for(unsigned int i = 0; i < n; ++i)
+        {
+            const double weight = (sigma != nullptr)?1. / sigma[i]:1.;
+            jacobian[i * numparameters + j] = (model(x[i], shifted.data()) - values[i]) / h
+                                                * weight;
+        }
+        shifted[j] = parameters[j];
+    }
+}
+
+template<class Model>
+LMResult LMFitFunctions::Fit(Model model, const double* x, const double* y, const double* sigma,
+                             unsigned int n, const std::vector<double>& start,
+                             const std::vector<double>& lower, const std::vector<double>& upper,
+                             const LMSettings& settings)
+{
+    const unsigned int numparameters = start.size();
+
+    LMResult result;
+    result.parameters = start;
+    if(n < numparameters || numparameters == 0)
+    {
+        result.status = LM_TooFewPoints;
+        return result;
+    }
+    result.ndf = n - numparameters;
+
+    //projection onto the allowed parameter range:
+    auto limit = [&](std::vector<double>& parameters)
+    {
+        for(unsigned int j = 0; j < numparameters; ++j)
+        {
+            if(lower.size() > j && parameters[j] < lower[j])
+                parameters[j] = lower[j];
+            if(upper.size() > j && parameters[j] > upper[j])
+                parameters[j] = upper[j];
+        }
+    };
+    auto evaluate = [&](const std::vector<double>& parameters, std::vector<double>& values)
+    {
+        double chi2 = 0;
+        for(unsigned int i = 0; i < n; ++i)
+        {
+            values[i] = model(x[i], parameters.data());
+            const double residual = (y[i] - values[i]) / ((sigma != nullptr)?sigma[i]:1.);
+            chi2 += residual * residual;
+        }
+        return chi2;
+    };
+
+    std::vector<double> parameters(start);
+    limit(parameters);
+    std::vector<double> values(n);
+    std::vector<double> trialvalues(n);
+    double chi2 = evaluate(parameters, values);
+    if(!std::isfinite(chi2))
+        return result;
+
+    std::vector<double> jacobian;
+    std::vector<double> alpha(numparameters * numparameters);
+    std::vector<double> beta(numparameters);
+    std::vector<double> matrix;
+    std::vector<double> step;
+    std::vector<double> trial(numparameters);
+
+    double lambda = settings.lambda;
+    result.status = LM_MaxIterations;
+    while(result.iterations < settings.maxiterations)
+    {
+        ++result.iterations;
+
+        //normal equations of the linearised problem:
+        Jacobian(model, x, sigma, n, parameters, upper, settings.derivativestep, values,
+                 jacobian);
+        for(unsigned int j = 0; j < numparameters; ++j)
+        {
+            beta[j] = 0;
+            for(unsigned int i = 0; i < n; ++i)
+                beta[j] += jacobian[i * numparameters + j] * (y[i] - values[i])
+                            / ((sigma != nullptr)?sigma[i]:1.);
+            for(unsigned int k = 0; k <= j; ++k)
+            {
+                double sum = 0;
+                for(unsigned int i = 0; i < n; ++i)
+                    sum += jacobian[i * numparameters + j] * jacobian[i * numparameters + k];
+                alpha[j * numparameters + k] = sum;
+                alpha[k * numparameters + j] = sum;
+            }
+        }
+
+        //increase the damping until the step reduces the chi^2:
+        bool improved = false;
+        double trialchi2 = chi2;
+        while(!improved && lambda < 1e12)
+        {
+            matrix = alpha;
+            for(unsigned int j = 0; j < numparameters; ++j)
+                matrix[j * numparameters + j] *= 1 + lambda;
+            step = beta;
+            if(Solve(matrix, step))
+            {
+                for(unsigned int j = 0; j < numparameters; ++j)
+                    trial[j] = parameters[j] + step[j];
+                limit(trial);
+
+                trialchi2 = evaluate(trial, trialvalues);
+                improved = std::isfinite(trialchi2) && trialchi2 <= chi2;
+            }
+            if(!improved)
+                lambda *= 10;
+        }
+
+        //no step reduces the chi^2 any more:
+        if(!improved)
+        {
+            result.status = LM_Converged;
+            break;
+        }
+
+        double maxchange = 0;
+        for(unsigned int j = 0; j < numparameters; ++j)
+            maxchange = std::max(maxchange, std::fabs(trial[j] - parameters[j])
+                                                / std::max(std::fabs(parameters[j]), 1e-12));
+
+        const double change = chi2 - trialchi2;
+        parameters.swap(trial);
+        values.swap(trialvalues);
+        chi2   = trialchi2;
+        lambda = std::max(lambda / 10, 1e-12);
+
+        if(change <= settings.tolerance * std::max(chi2, 1e-300)
+                || maxchange <= settings.tolerance)
+        {
+            result.status = LM_Converged;
+            break;
+        }
+    }
+
+    result.parameters = parameters;
+    result.chi2       = chi2;
+
+    for(unsigned int j = 0; j < numparameters; ++j)
+        if((lower.size() > j && parameters[j] <= lower[j])
+                || (upper.size() > j && parameters[j] >= upper[j]))
+            result.atlimit = true;
+
+    //covariance from the curvature at the minimum:
+    Jacobian(model, x, sigma, n, parameters, upper, settings.derivativestep, values, jacobian);
+    for(unsigned int j = 0; j < numparameters; ++j)
+        for(unsigned int k = 0; k <= j; ++k)
+        {
+            double sum = 0;
+            for(unsigned int i = 0; i < n; ++i)
+                sum += jacobian[i * numparameters + j] * jacobian[i * numparameters + k];
+            alpha[j * numparameters + k] = sum;
+            alpha[k * numparameters + j] = sum;
+        }
+    result.errors.assign(numparameters, 0);
+    if(Invert(alpha, result.covariance))
+    {
+        for(unsigned int j = 0; j < numparameters; ++j)
+            result.errors[j] = std::sqrt(std::max(result.covariance[j * numparameters + j], 0.));
+    }
+    else
+        result.covariance.assign(numparameters * numparameters, 0);
+
+    return result;
+}
+
+#endif //__LMFIT
@@ -0,0 +1,329 @@
+#ifndef offsetfindersources
+#define offsetfindersources
+
+#include "offsetfinder.h"
+
+#include <cmath>
+#include <algorithm>
+
+bool OffsetFinderFunctions::FFT(std::vector<std::complex<double> >& data, bool inverse)
+{
+    if(!FFT(data, Twiddles(data.size(), inverse)))
+        return false;
+
+    if(inverse)
+        for(auto& it : data)
+            it /= double(data.size());
+
+    return true;
+}
+
+std::vector<std::complex<double> > OffsetFinderFunctions::Twiddles(uint64_t size, bool inverse)
+{
+    const double pi = 3.14159265358979323846;
+    std::vector<std::complex<double> > twiddles(size / 2);
+    for(uint64_t i = 0; i < size / 2; ++i)
+        twiddles[i] = std::polar(1., ((inverse)?2:-2) * pi * i / size);
+
+    return twiddles;
+}
+
+bool OffsetFinderFunctions::FFT(std::vector<std::complex<double> >& data,
+                                const std::vector<std::complex<double> >& twiddles)
+{
+    const uint64_t size = data.size();
+    if(size == 0 || (size & (size - 1)) != 0 || twiddles.size() != size / 2)
+        return false;
+
+    //bit reversal permutation:
+    for(uint64_t i = 1, j = 0; i < size; ++i)
+    {
+        uint64_t bit = size >> 1;
+        for(; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if(i < j)
+            std::swap(data[i], data[j]);
+    }
+
+    //the smaller stages use every n-th twiddle factor of the largest stage:
+    for(uint64_t length = 2; length <= size; length <<= 1)
+    {
+        const uint64_t half = length / 2;
+        const uint64_t step = size / length;
+        for(uint64_t start = 0; start < size; start += length)
+            for(uint64_t k = 0; k < half; ++k)
+            {
+                //written out to avoid the special value handling of std::complex multiplication:
+                const std::complex<double>& w = twiddles[k * step];
+                const std::complex<double>& x = data[start + k + half];
+                std::complex<double> odd(x.real() * w.real() - x.imag() * w.imag(),
+                                         x.real() * w.imag() + x.imag() * w.real());
+                data[start + k + half]   = data[start + k] - odd;
+                data[start + k]         += odd;
+            }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------------------------
+
+RateCorrelator::RateCorrelator(unsigned int numlayers, unsigned int reference, long long binwidth,
+                               unsigned int numbins, unsigned int stride, unsigned int maxsegments,
+                               unsigned int opensegments) :
+    numlayers(numlayers), reference(reference), binwidth((binwidth > 0)?binwidth:1), numbins(2),
+    stride((stride > 0)?stride:1), maxsegments(maxsegments), opensegments(opensegments),
+    nextlimit(maxsegments), lastsegment(0), lastprocessed(-1), started(false), numsegments(0),
+    latehits(0)
+{
+    while(this->numbins < numbins)
+        this->numbins <<= 1;
+
+    twiddles = OffsetFinderFunctions::Twiddles(2 * this->numbins);
+
+    //the segments are zero padded to twice their length to avoid circular correlation:
+    crosspower.resize(numlayers, std::vector<std::complex<double> >(2 * this->numbins, 0.));
+    numhits.resize(numlayers, 0);
+}
+
+void RateCorrelator::Add(unsigned int layer, long long ts)
+{
+    if(layer < 1 || layer > numlayers || ts < 0)
+        return;
+
+    const long long seglength = binwidth * numbins;
+    long long segment = ts / seglength;
+
+    if(started && segment <= lastprocessed)
+    {
+        ++latehits;
+        return;
+    }
+
+    if(!started || segment > lastsegment)
+    {
+        lastsegment = segment;
+        started     = true;
+
+        //process the segments the data stream has passed:
+        while(segments.size() > 0 && segments.begin()->first + opensegments < lastsegment)
+        {
+            Process(segments.begin()->second);
+            segments.erase(segments.begin());
+        }
+        if(lastsegment - opensegments - 1 > lastprocessed)
+            lastprocessed = lastsegment - opensegments - 1;
+    }
+
+    if(segment % stride != 0)
+        return;
+
+    std::vector<std::vector<float> >& rates = segments[segment];
+    if(rates.size() == 0)
+        rates.resize(numlayers);
+    if(rates[layer - 1].size() == 0)
+        rates[layer - 1].resize(numbins, 0);
+
+    rates[layer - 1][(ts - segment * seglength) / binwidth] += 1;
+    ++numhits[layer - 1];
+}
+
+void RateCorrelator::Finish()
+{
+    for(auto& it : segments)
+        Process(it.second);
+    segments.clear();
+
+    lastprocessed = lastsegment;
+}
+
+void RateCorrelator::Process(std::vector<std::vector<float> >& rates)
+{
+    if(reference < 1 || reference > numlayers || rates[reference - 1].size() == 0)
+        return;
+
+    //the mean rate of the segment is subtracted, so uncorrelated data does not add a baseline:
+    auto transform = [&](const std::vector<float>& rate)
+    {
+        double mean = 0;
+        for(auto& it : rate)
+            mean += it;
+        mean /= numbins;
+
+        std::vector<std::complex<double> > spectrum(2 * numbins, 0.);
+        for(unsigned int i = 0; i < numbins; ++i)
+            spectrum[i] = rate[i] - mean;
+        OffsetFinderFunctions::FFT(spectrum, twiddles);
+
+        return spectrum;
+    };
+
+    std::vector<std::complex<double> > refspectrum = transform(rates[reference - 1]);
+
+    for(unsigned int layer = 0; layer < numlayers; ++layer)
+    {
+        if(layer == reference - 1 || rates[layer].size() == 0)
+            continue;
+
+        std::vector<std::complex<double> > spectrum = transform(rates[layer]);
+        for(unsigned int i = 0; i < 2 * numbins; ++i)
+        {
+            const std::complex<double>& r = refspectrum[i];
+            const std::complex<double>& x = spectrum[i];
+            crosspower[layer][i] += std::complex<double>(r.real() * x.real() + r.imag() * x.imag(),
+                                                         r.real() * x.imag() - r.imag() * x.real());
+        }
+    }
+
+    ++numsegments;
+    if(maxsegments > 0 && numsegments >= nextlimit)
+    {
+        stride    *= 2;
+        nextlimit += (maxsegments > 1)?maxsegments / 2:1;
+    }
+}
+
+std::vector<double> RateCorrelator::GetCorrelation(unsigned int layer) const
+{
+    if(layer < 1 || layer > numlayers)
+        return std::vector<double>();
+
+    std::vector<std::complex<double> > correlation = crosspower[layer - 1];
+    OffsetFinderFunctions::FFT(correlation, true);
+
+    //reorder from circular lags to -numbins/2 ... numbins/2 - 1:
+    const long long size = correlation.size();
+    std::vector<double> result(numbins);
+    for(long long i = 0; i < numbins; ++i)
+    {
+        long long lag = i - numbins / 2;
+        result[i] = correlation[(lag + size) % size].real();
+    }
+
+    return result;
+}
+
+std::vector<LayerOffset> RateCorrelator::GetOffsets(long long maxlag) const
+{
+    std::vector<LayerOffset> offsets(numlayers);
+
+    for(unsigned int layer = 1; layer <= numlayers; ++layer)
+    {
+        LayerOffset& result = offsets[layer - 1];
+        result.numhits   = numhits[layer - 1];
+        result.precision = binwidth;
+
+        if(numhits[layer - 1] == 0 || numsegments == 0)
+            continue;
+        if(layer == reference)
+        {
+            result.valid = true;
+            continue;
+        }
+
+        std::vector<double> correlation = GetCorrelation(layer);
+
+        double   sum   = 0;
+        double   sum2  = 0;
+        uint64_t count = 0;
+        long long peak = 0;
+        double   peakvalue = 0;
+        for(long long i = 0; i < numbins; ++i)
+        {
+            long long lag = (i - numbins / 2) * binwidth;
+            if(maxlag > 0 && std::abs(lag) > maxlag)
+                continue;
+
+            sum  += correlation[i];
+            sum2 += correlation[i] * correlation[i];
+            if(count == 0 || correlation[i] > peakvalue)
+            {
+                peakvalue = correlation[i];
+                peak      = lag;
+            }
+            ++count;
+        }
+
+        if(count < 2)
+            continue;
+
+        double mean  = sum / count;
+        double sigma = std::sqrt(std::max(0., sum2 / count - mean * mean));
+
+        //the layer is `peak` later than the reference, so the peak has to be subtracted:
+        result.offset       = -peak;
+        result.significance = (sigma > 0)?(peakvalue - mean) / sigma:0;
+        result.valid        = sigma > 0;
+    }
+
+    return offsets;
+}
+
+long long RateCorrelator::GetBinWidth() const
+{
+    return binwidth;
+}
+
+uint64_t RateCorrelator::GetNumSegments() const
+{
+    return numsegments;
+}
+
+uint64_t RateCorrelator::GetNumLateHits() const
+{
+    return latehits;
+}
+
+//------------------------------------------------------------------------------------------------
+
+OffsetFinder::OffsetFinder(unsigned int reference, long long binwidth, unsigned int numbins,
+                           long long coarsebinwidth, unsigned int coarsenumbins,
+                           unsigned int maxsegments) :
+    fine(4, reference, binwidth, numbins, 1, maxsegments),
+    coarse(4, reference, coarsebinwidth, coarsenumbins, 1, maxsegments)
+{
+
+}
+
+void OffsetFinder::Add(const Dataset& hit)
+{
+    fine.Add(hit.layer, hit.ts);
+    coarse.Add(hit.layer, hit.ts);
+}
+
+void OffsetFinder::Finish()
+{
+    fine.Finish();
+    coarse.Finish();
+}
+
+std::vector<LayerOffset> OffsetFinder::GetOffsets() const
+{
+    std::vector<LayerOffset> coarseoffsets = coarse.GetOffsets();
+    std::vector<LayerOffset> fineoffsets   = fine.GetOffsets();
+
+    std::vector<LayerOffset> offsets = coarseoffsets;
+    for(unsigned int i = 0; i < offsets.size(); ++i)
+    {
+        //use the fine value if it is compatible with the coarse one:
+        if(fineoffsets[i].valid && coarseoffsets[i].valid
+                && std::abs(fineoffsets[i].offset - coarseoffsets[i].offset)
+                    <= coarse.GetBinWidth())
+            offsets[i] = fineoffsets[i];
+    }
+
+    return offsets;
+}
+
+const RateCorrelator& OffsetFinder::GetFine() const
+{
+    return fine;
+}
+
+const RateCorrelator& OffsetFinder::GetCoarse() const
+{
+    return coarse;
+}
+
+#endif //offsetfindersources
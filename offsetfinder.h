@@ -0,0 +1,185 @@
+#ifndef __OFFSETFINDER
+#define __OFFSETFINDER
+
+#include <vector>
+#include <map>
+#include <complex>
+#include <stdint.h>
+
+#include "dataset.h"
+
+/*
+ * Automatic determination of the time stamp offsets between the layers of the telescope.
+ * The hit rate of every layer is binned on a time stamp grid. The cross correlation of the rate
+ * of each layer with the one of the reference layer shows a peak at the time offset between the
+ * layers, as particles traversing the telescope cause coincident hits.
+ * The time line is cut into segments of fixed length, the cross correlation is calculated with an
+ * FFT per segment and the cross power spectra of all segments are summed up (Welch method). So the
+ * memory needed does not depend on the length of the run and the data is processed in one pass.
+ */
+
+namespace OffsetFinderFunctions {
+
+    /**
+     * @brief FFT calculates the discrete Fourier transform in place
+     * @param data              - the data to transform, the size has to be a power of 2
+     * @param inverse           - calculate the inverse transform (including the 1/N factor)
+     * @return                  - false if the size of `data` is not a power of 2
+     */
+    bool FFT(std::vector<std::complex<double> >& data, bool inverse = false);
+    /**
+     * @brief FFT calculates the discrete Fourier transform in place with precalculated twiddle
+     *      factors. The inverse transform is calculated with the twiddle factors for the inverse
+     *      transform, but without the 1/N factor.
+     * @param data              - the data to transform, the size has to be a power of 2
+     * @param twiddles          - the twiddle factors from Twiddles() for the size of `data`
+     * @return                  - false if the sizes of `data` and `twiddles` do not match
+     */
+    bool FFT(std::vector<std::complex<double> >& data,
+             const std::vector<std::complex<double> >& twiddles);
+    /**
+     * @brief Twiddles calculates the twiddle factors for an FFT
+     * @param size              - the size of the transform (a power of 2)
+     * @param inverse           - calculate the factors for the inverse transform
+     * @return                  - the size / 2 factors exp(-+2 pi i k / size)
+     */
+    std::vector<std::complex<double> > Twiddles(uint64_t size, bool inverse = false);
+
+}
+
+/**
+ * @brief LayerOffset contains the offset found for one layer relative to the reference layer
+ */
+struct LayerOffset
+{
+    LayerOffset() : offset(0), precision(1), significance(0), numhits(0), valid(false) {}
+
+    long long offset;           //time stamp units to add to the layer to align it to the reference
+    long long precision;        //bin width of the correlation the offset was taken from
+    double    significance;     //peak height above the mean in standard deviations
+    uint64_t  numhits;          //hits of the layer in the analysed segments
+    bool      valid;            //false if the layer has no data
+};
+
+/**
+ * @brief RateCorrelator sums up the cross power spectra between the hit rate of a reference layer
+ *      and the other layers for segments of the time line. Only every `stride`-th segment is used.
+ *      To bound the computation time for long runs, the stride is doubled every time another
+ *      `maxsegments` / 2 segments have been processed after the first `maxsegments`, so the
+ *      segments used are spread over the whole run.
+ */
+class RateCorrelator
+{
+public:
+    /**
+     * @brief RateCorrelator initialises the correlator
+     * @param numlayers         - number of layers (layer numbers 1 to `numlayers` are accepted)
+     * @param reference         - layer number of the reference layer
+     * @param binwidth          - width of a rate bin in time stamp units
+     * @param numbins           - number of bins per segment (rounded up to a power of 2). The lag
+     *                              range covered is +- numbins / 2 * binwidth
+     * @param stride            - use only every `stride`-th segment
+     * @param maxsegments       - number of segments after which the stride is increased,
+     *                              0 for no limit
+     * @param opensegments      - number of segments kept open for hits arriving out of order
+     */
+    RateCorrelator(unsigned int numlayers = 4, unsigned int reference = 1, long long binwidth = 1,
+                   unsigned int numbins = 2048, unsigned int stride = 1,
+                   unsigned int maxsegments = 512, unsigned int opensegments = 4);
+
+    /**
+     * @brief Add adds a hit to the rate histograms
+     * @param layer             - layer number of the hit (1 to `numlayers`)
+     * @param ts                - time stamp of the hit
+     */
+    void Add(unsigned int layer, long long ts);
+    /**
+     * @brief Finish processes the remaining open segments. Call it after adding all hits.
+     */
+    void Finish();
+
+    /**
+     * @brief GetOffsets finds the peaks of the cross correlations
+     * @param maxlag            - only search for peaks within +- maxlag time stamp units,
+     *                              0 for the whole range
+     * @return                  - the offsets for all layers, index 0 is layer 1
+     */
+    std::vector<LayerOffset> GetOffsets(long long maxlag = 0) const;
+    /**
+     * @brief GetCorrelation calculates the cross correlation between the reference layer and
+     *      another layer
+     * @param layer             - layer number of the layer to correlate with the reference
+     * @return                  - the correlation for the lags -numbins/2 * binwidth to
+     *                              (numbins/2 - 1) * binwidth (empty on an invalid layer)
+     */
+    std::vector<double> GetCorrelation(unsigned int layer) const;
+
+    long long GetBinWidth() const;
+    uint64_t  GetNumSegments() const;
+    uint64_t  GetNumLateHits() const;
+
+private:
+    void Process(std::vector<std::vector<float> >& rates);
+
+    unsigned int numlayers;
+    unsigned int reference;
+    long long    binwidth;
+    unsigned int numbins;
+    unsigned int stride;
+    unsigned int maxsegments;
+    unsigned int opensegments;
+    uint64_t     nextlimit;             //number of processed segments for the next stride increase
+    std::vector<std::complex<double> > twiddles;
+
+    //rate histograms of the segments not processed yet (index is the segment number):
+    std::map<long long, std::vector<std::vector<float> > > segments;
+    long long lastsegment;              //newest segment seen
+    long long lastprocessed;            //newest segment already processed
+    bool      started;
+
+    std::vector<std::vector<std::complex<double> > > crosspower;  //summed spectra per layer
+    std::vector<uint64_t>                            numhits;     //hits per layer
+    uint64_t                                         numsegments;
+    uint64_t                                         latehits;
+};
+
+/**
+ * @brief OffsetFinder determines the time stamp offsets with two correlators: a coarse one
+ *      covering a wide range of offsets and a fine one for the precise value around the peak.
+ *      If the fine correlator does not confirm the coarse peak, the coarse value is used.
+ */
+class OffsetFinder
+{
+public:
+    /**
+     * @brief OffsetFinder initialises the finder
+     * @param reference         - layer number of the reference layer
+     * @param binwidth          - bin width of the fine correlator (in time stamp units)
+     * @param numbins           - number of bins per segment of the fine correlator
+     * @param coarsebinwidth    - bin width of the coarse correlator (in time stamp units)
+     * @param coarsenumbins     - number of bins per segment of the coarse correlator
+     * @param maxsegments       - number of segments after which the stride is increased
+     *                              (see RateCorrelator), 0 to use all segments
+     */
+    OffsetFinder(unsigned int reference = 1, long long binwidth = 1, unsigned int numbins = 2048,
+                 long long coarsebinwidth = 64, unsigned int coarsenumbins = 8192,
+                 unsigned int maxsegments = 512);
+
+    void Add(const Dataset& hit);
+    void Finish();
+
+    /**
+     * @brief GetOffsets combines the results of the two correlators
+     * @return                  - the offsets for layers 1 to 4
+     */
+    std::vector<LayerOffset> GetOffsets() const;
+
+    const RateCorrelator& GetFine() const;
+    const RateCorrelator& GetCoarse() const;
+
+private:
+    RateCorrelator fine;
+    RateCorrelator coarse;
+};
+
+#endif //__OFFSETFINDER
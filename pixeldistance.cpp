@@ -0,0 +1,33 @@
+#ifndef pixeldistancesources
+#define pixeldistancesources
+
+#include "pixeldistance.h"
+
+#include <cmath>
+
+uint64_t PixelDistanceFunctions::ISqrt(uint64_t value)
+{
+    uint64_t root = uint64_t(std::sqrt(double(value)));
+    //correct rounding errors of the floating point root:
+    while(root > 0 && root * root > value)
+        --root;
+    while((root + 1) * (root + 1) <= value)
+        ++root;
+
+    return root;
+}
+
+double PixelDistanceFunctions::Distance(int dcolumn, int drow)
+{
+    return std::sqrt(double(Distance2(dcolumn, drow)));
+}
+
+//------------------------------------------------------------------------------------------------
+
+PixelNeighbourhood::PixelNeighbourhood(long long limit2, bool inclusive, int columnweight) :
+    maximum((inclusive)?limit2:limit2 - 1), weight((columnweight > 0)?columnweight:1)
+{
+
+}
+
+#endif //pixeldistancesources
@@ -0,0 +1,81 @@
+#ifndef __PIXELDISTANCE
+#define __PIXELDISTANCE
+
+#include <stdint.h>
+
+/*
+ * Distances between ATLASPix3 pixels in integer arithmetic. The pixels are 150 um wide and 50 um
+ * high, so distances are calculated in multiples of 50 um:
+ *      distance^2 = 9 * dcolumn^2 + drow^2
+ * Comparing the squared distances in integers gives the same result as comparing the truncated
+ * floating point distance to an integer limit, but avoids pow() and sqrt() in the inner loops.
+ */
+
+namespace PixelDistanceFunctions {
+
+    //squared width of a pixel in units of its height:
+    const int columnweight = 9;
+
+    /**
+     * @brief Distance2 calculates the squared distance between two pixels
+     * @param dcolumn           - column difference
+     * @param drow              - row difference
+     * @return                  - the squared distance in units of (50 um)^2
+     */
+    inline long long Distance2(int dcolumn, int drow)
+    {
+        return columnweight * (long long)(dcolumn) * dcolumn + (long long)(drow) * drow;
+    }
+
+    /**
+     * @brief ISqrt calculates the square root rounded down
+     * @param value             - the value to calculate the root for
+     * @return                  - the largest integer r with r * r <= value
+     */
+    uint64_t ISqrt(uint64_t value);
+
+    /**
+     * @brief Distance calculates the distance between two pixels
+     * @param dcolumn           - column difference
+     * @param drow              - row difference
+     * @return                  - the distance in units of 50 um
+     */
+    double Distance(int dcolumn, int drow);
+
+}
+
+/**
+ * @brief PixelNeighbourhood decides whether two pixels are closer than a fixed distance using
+ *      only integer operations
+ */
+class PixelNeighbourhood
+{
+public:
+    /**
+     * @brief PixelNeighbourhood sets up the check for a distance limit
+     * @param limit2            - the squared distance limit in units of (50 um)^2
+     * @param inclusive         - also accept pixels exactly at the limit
+     * @param columnweight      - weight of the squared column difference (9 for the pixel size
+     *                              of 150 x 50 um^2)
+     */
+    PixelNeighbourhood(long long limit2 = 1, bool inclusive = false,
+                       int columnweight = PixelDistanceFunctions::columnweight);
+
+    /**
+     * @brief Contains checks the distance of two pixels
+     * @param dcolumn           - column difference
+     * @param drow              - row difference
+     * @return                  - true if columnweight * dcolumn^2 + drow^2 is below the limit
+     *                              (or equal for an inclusive limit)
+     */
+    bool Contains(int dcolumn, int drow) const
+    {
+        return weight * (long long)(dcolumn) * dcolumn + (long long)(drow) * drow <= maximum;
+    }
+
+private:
+    long long maximum;      //largest accepted squared distance
+    int       weight;       //weight of the squared column difference
+};
+
+#endif //__PIXELDISTANCE
@@ -4,49 +4,44 @@
 #include <vector>
 #include <list>
 #include <algorithm>
+#include <chrono>
+#include <random>
 
 #include "dataset.cpp"
+#include "binaryfile.cpp"
+#include "hitfile.cpp"
+#include "hitsort.cpp"
+#include "hitfilter.cpp"
 #include "object_drawing.cpp"
 
-std::list<Dataset> LoadFile(std::string filename)
+/**
+ * @brief LoadFile loads all valid hits from a decoded text file. A binary copy of the hits is
+ *      stored next to the text file ("<filename>.hitcache") and used on later calls as long as
+ *      size and modification time of the text file do not change. The text is parsed by
+ *      HitReader, like in the other analysis macros, so all of them use the same cache content.
+ * @param filename           - the text file to load
+ * @param usecache           - set to false to always parse the text file and not write a cache
+ * @return                   - the hits in the order of the file
+ */
+std::list<Dataset> LoadFile(std::string filename, bool usecache = true)
 {
     if(filename == "")
         return std::list<Dataset>();
 
-    std::fstream f;
-    f.open(filename.c_str(), std::ios::in);
-
-    if(!f.is_open())
+    HitReader reader;
+    if(!reader.Open(filename, usecache))
     {
         std::cerr << "Could not open \"" << filename << "\"" << std::endl;
         return std::list<Dataset>();
     }
 
-    std::list<Dataset> data;
-
-    std::string line;
-    std::getline(f, line);
-    Dataset fieldorder;
-
-    while(f.good())
-    {
-        if(line[0] == '#')
-        {
-            fieldorder = DatasetFunctions::FindOrder(line);
+    if(reader.FromCache())
+        std::cout << "Loading hits from cache \"" << HitCacheName(filename) << "\"" << std::endl;
 
-            std::cout << Dataset::GetHeader(false) << "\n" << fieldorder.ToString() << std::endl;
-        }
-        else
-        {
-            Dataset dat = DatasetFunctions::Construct(line, fieldorder);
-            if(dat.is_valid())
-                data.push_back(dat);
-        }
-
-        std::getline(f, line);
-    }
-
-    f.close();
+    std::list<Dataset> data;
+    Dataset hit;
+    while(reader.Next(hit))
+        data.push_back(hit);
 
     return data;
 }
@@ -137,7 +132,8 @@ int RemoveSingleOutliers(std::list<Dataset>& data, int stepsize = 150e6)
 }
 
 void SortFile(std::string filename, std::string outfile, long long stepsize = 150e6,
-              long long singlestepsize = 150e6, int ignorefirst = 0)
+              long long singlestepsize = 150e6, int ignorefirst = 0, bool usecache = true,
+              int sortmethod = SM_Auto)
 {
     if(filename == "")
     {
@@ -145,7 +141,7 @@ void SortFile(std::string filename, std::string outfile, long long stepsize = 15
         return;
     }
 
-    std::list<Dataset> data = LoadFile(filename);
+    std::list<Dataset> data = LoadFile(filename, usecache);
     std::cout << "Loaded " << data.size() << " hits" << std::endl;
 
     TGraph* grloaded = new TGraph();
@@ -157,25 +153,20 @@ void SortFile(std::string filename, std::string outfile, long long stepsize = 15
         data.pop_front();
     std::cout << "removed the first " << ignorefirst << " elements" << std::endl;
 
-    int removed = RemoveSingleOutliers(data, singlestepsize);
-    std::cout << "  removed " << removed << " outliers from single hit wrong TS" << std::endl;
-
-    removed += RemoveOutliers(data, stepsize);
-    std::cout << "  removed " << removed << " outliers in total" << std::endl;
+    std::vector<Dataset> sorteddata(data.begin(), data.end());
+    data.clear();
 
-    removed += RemoveSingleOutliers(data, singlestepsize);
-    std::cout << "  removed " << removed << " outliers in total (after second single hit clean)"
+    OutlierCounts removed = RemoveOutliersInPlace(sorteddata, stepsize, singlestepsize);
+    std::cout << "  removed " << removed.singlefirst << " outliers from single hit wrong TS\n"
+              << "  removed " << removed.jumps << " outliers from TS jumps\n"
+              << "  removed " << removed.singlesecond
+              << " outliers from single hit wrong TS (second clean)\n"
+              << "  removed " << removed.input - removed.output << " outliers in total"
               << std::endl;
 
-    std::vector<Dataset> sorteddata;
-    sorteddata.reserve(data.size());
-
     TGraph* grunsorted = new TGraph();
-    for(const auto& it : data)
-    {
+    for(const auto& it : sorteddata)
         grunsorted->SetPoint(grunsorted->GetN(), grunsorted->GetN(), it.ts);
-        sorteddata.push_back(it);
-    }
     DrawTGraph(grunsorted, nullptr, "unsorted TSs", "Hit Index", "ext. TS");
 
     TGraph* grdiff = new TGraph();
@@ -185,8 +176,18 @@ void SortFile(std::string filename, std::string outfile, long long stepsize = 15
                              grunsorted->GetY()[i] - grunsorted->GetY()[i-1]);
     DrawTGraph(grdiff, nullptr, "TS differences", "Hit Index", "TS difference");
 
-    std::sort(sorteddata.begin(), sorteddata.end());
-    std::cout << "sorted data" << std::endl;
+    int usedmethod = sortmethod;
+    SortDisorder disorder = SortHits(sorteddata, sortmethod, 0, &usedmethod);
+    std::cout << "sorted data" << "\n"
+              << "  ascending runs:         " << disorder.numruns << "\n"
+              << "  ascending runs (layer): " << disorder.numlayerruns << std::endl;
+    if(usedmethod == SM_Adaptive)
+        std::cout << "  merged runs:            " << disorder.numsortedruns
+                  << ((disorder.perlayer)?" (layers separated)":"") << "\n"
+                  << "  max. displacement:      " << disorder.maxdisplacement << std::endl;
+    else
+        std::cout << "  sorted with " << ((usedmethod == SM_Radix)?"radix sort":"std::sort")
+                  << std::endl;
 
     TGraph* grsorted = new TGraph();
     for(const auto& it : sorteddata)
@@ -209,10 +210,216 @@ void SortFile(std::string filename, std::string outfile, long long stepsize = 15
               << "    outfile:        \"" << outfile << "\"\n"
               << "    stepsize:        " << stepsize << "\n"
               << "    singlestepsize:  " << singlestepsize << "\n"
-              << "    ignorefirst:     " << ignorefirst << std::endl;
+              << "    ignorefirst:     " << ignorefirst << "\n"
+              << "    usecache:        " << (usecache?"true":"false") << "\n"
+              << "    sortmethod:      " << sortmethod << std::endl;
 
             f.flush();
             f.close();
         }
     }
 }
+
+
+/**
+ * @brief SortFileExternal sorts files too large to be loaded into memory at once. The hits are
+ *      read sequentially, sorted in blocks fitting into `memorybudget` and temporarily stored
+ *      in binary files next to `outfile`. These blocks are then merged into the output file.
+ *      The outliers are removed with the same criteria as in SortFile() while reading the
+ *      data. In contrast to SortFile(), no plots are generated.
+ * @param filename           - the decoded file to sort
+ * @param outfile            - the file to write the sorted data to
+ * @param memorybudget       - memory to use for buffering hits in bytes
+ * @param ignorefirst        - number of hits to skip at the beginning of the file
+ * @param usecache           - use (and generate) the binary cache of the input file
+ * @param removeoutliers     - remove hits with wrong time stamps before sorting
+ * @param stepsize           - maximum TS difference to the previous hit (see OutlierFilter)
+ * @param singlestepsize     - TS difference marking single hits as outliers
+ */
+void SortFileExternal(std::string filename, std::string outfile, long long memorybudget = 2e9,
+                      int ignorefirst = 0, bool usecache = true, bool removeoutliers = true,
+                      long long stepsize = 150e6, long long singlestepsize = 150e6)
+{
+    if(filename == "" || outfile == "")
+    {
+        std::cerr << "no filename passed" << std::endl;
+        return;
+    }
+
+    HitReader reader;
+    if(!reader.Open(filename, usecache))
+    {
+        std::cerr << "Could not open \"" << filename << "\"" << std::endl;
+        return;
+    }
+
+    ExternalSorter sorter(memorybudget, outfile);
+    OutlierFilter  filter(stepsize, singlestepsize);
+
+    Dataset hit;
+    Dataset filtered;
+    int skipped = 0;
+    long long numread = 0;
+    bool success = true;
+    while(reader.Next(hit) && success)
+    {
+        if(skipped < ignorefirst)
+        {
+            ++skipped;
+            continue;
+        }
+
+        if(removeoutliers)
+        {
+            filter.Add(hit);
+            while(filter.Next(filtered) && success)
+                success = sorter.Add(filtered);
+        }
+        else
+            success = sorter.Add(hit);
+
+        if(++numread % 1000000 == 0)
+            std::cout << "\r loaded " << numread << " hits" << std::flush;
+    }
+    filter.Flush();
+    while(filter.Next(filtered) && success)
+        success = sorter.Add(filtered);
+    std::cout << "\r loaded " << numread << " hits" << std::endl;
+    reader.Close();
+
+    if(!success)
+    {
+        std::cerr << "Error sorting the data" << std::endl;
+        return;
+    }
+
+    if(removeoutliers)
+    {
+        const OutlierCounts& removed = filter.GetCounts();
+        std::cout << "  removed " << removed.singlefirst << " outliers from single hit wrong TS\n"
+                  << "  removed " << removed.jumps << " outliers from TS jumps\n"
+                  << "  removed " << removed.singlesecond
+                  << " outliers from single hit wrong TS (second clean)" << std::endl;
+    }
+
+    std::fstream f;
+    f.open(outfile.c_str(), std::ios::out);
+    if(!f.is_open())
+    {
+        std::cerr << "Error saving data to \"" << outfile << "\"" << std::endl;
+        return;
+    }
+
+    f << Dataset::GetHeader(false) << std::endl;
+
+    success = sorter.Finish([&f](const Dataset* hits, uint64_t numhits) {
+        for(uint64_t i = 0; i < numhits; ++i)
+            f << hits[i].ToString() << "\n";
+        return f.good();
+    });
+
+    f << std::flush;
+    f.close();
+
+    const ExternalSortStats& stats = sorter.GetStats();
+    if(!success)
+        std::cerr << "Error saving data to \"" << outfile << "\"" << std::endl;
+    else
+        std::cout << "Wrote data to \"" << outfile << "\"" << std::endl;
+
+    std::cout << "  sorted hits:   " << stats.numhits << "\n"
+              << "  sorted runs:   " << stats.numruns << "\n"
+              << "  spilled bytes: " << stats.bytesspilled << "\n"
+              << "  peak memory:   " << stats.peakrss << " kB" << std::endl;
+
+    f.open((outfile + ".call").c_str(), std::ios::out | std::ios::app);
+    if(f.is_open())
+    {
+        f << "# function call of \"SortFileExternal()\" from \"sortdata.cpp\"\n"
+          << "    filename:       \"" << filename << "\"\n"
+          << "    outfile:        \"" << outfile << "\"\n"
+          << "    memorybudget:    " << memorybudget << "\n"
+          << "    ignorefirst:     " << ignorefirst << "\n"
+          << "    usecache:        " << (usecache?"true":"false") << "\n"
+          << "    removeoutliers:  " << (removeoutliers?"true":"false") << "\n"
+          << "    stepsize:        " << stepsize << "\n"
+          << "    singlestepsize:  " << singlestepsize << std::endl;
+
+        f.flush();
+        f.close();
+    }
+}
+
+/**
+ * @brief SortBenchmark compares the sorting methods on randomly generated hits. The time stamps
+ *      are spread over one minute of 25 ns steps and are either fully random or sorted with
+ *      small local disorder.
+ *      Note that 10^8 hits need about 6.4 GB of memory per copy of the data.
+ * @param numhits            - number of hits to generate
+ * @param numthreads         - threads for the radix sort, 0 for one per CPU core
+ * @param nearlysorted       - generate nearly sorted data instead of random time stamps
+ */
+void SortBenchmark(long long numhits = 1e8, int numthreads = 0, bool nearlysorted = false)
+{
+    std::mt19937_64 generator(42);
+    std::vector<Dataset> data(numhits);
+    for(long long i = 0; i < numhits; ++i)
+    {
+        if(nearlysorted)
+            data[i].ts = 2400000000LL * i / numhits + generator() % 64;
+        else
+            data[i].ts = generator() % 2400000000LL;
+        data[i].column = generator() % 132;
+        data[i].row    = generator() % 372;
+        data[i].layer  = generator() % 4 + 1;
+    }
+    std::cout << "generated " << numhits << " hits" << std::endl;
+
+    const int methods[] = {SM_Std, SM_Radix, SM_Adaptive};
+    const char* names[] = {"std::sort", "radix sort", "adaptive sort"};
+    for(int i = 0; i < 3; ++i)
+    {
+        std::vector<Dataset> copy(data);
+
+        auto start = std::chrono::steady_clock::now();
+        SortHits(copy, methods[i], numthreads);
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+        std::cout << "  " << names[i] << ": " << duration.count() << " s" << std::endl;
+    }
+}
+
+/**
+ * @brief SampleSortScaling measures the run time of the parallel sample sort on random hits for
+ *      1, 4, 16 and 32 threads
+ * @param numhits            - number of hits to generate
+ */
+void SampleSortScaling(long long numhits = 1e8)
+{
+    std::mt19937_64 generator(42);
+    std::vector<Dataset> data(numhits);
+    for(long long i = 0; i < numhits; ++i)
+    {
+        data[i].ts     = generator() % 2400000000LL;
+        data[i].column = generator() % 132;
+        data[i].row    = generator() % 372;
+        data[i].layer  = generator() % 4 + 1;
+    }
+    std::cout << "generated " << numhits << " hits" << std::endl;
+
+    const unsigned int numthreads[] = {1, 4, 16, 32};
+    double singlethread = 0;
+    for(int i = 0; i < 4; ++i)
+    {
+        std::vector<Dataset> copy(data);
+
+        auto start = std::chrono::steady_clock::now();
+        ParallelSampleSort(copy, numthreads[i]);
+        std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+        if(i == 0)
+            singlethread = duration.count();
+        std::cout << "  " << numthreads[i] << " threads: " << duration.count() << " s (speedup "
+                  << singlethread / duration.count() << ")" << std::endl;
+    }
+}
@@ -39,6 +39,10 @@
 #include <list>
 #include <algorithm>
 #include <utility>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
 
 #include "LambertW-master/LambertW.h"
 #include "landau_gauss_ROOT/Langau.cxx"
@@ -46,6 +50,22 @@
 #include "retrieve_data.cpp"
 
 #include "dataset.cpp"
+#include "totcalculation.cpp"
+#include "binaryfile.cpp"
+#include "hitfile.cpp"
+#include "hitsort.cpp"
+#include "pixeldistance.cpp"
+#include "hitjoin.cpp"
+#include "fileoperations.cpp"
+#include "alignment.cpp"
+#include "clustering.cpp"
+#include "clusterfile.cpp"
+#include "totcalibration.cpp"
+#include "landaugauss.cpp"
+#include "lmfit.cpp"
+#include "landaugaussfit.cpp"
+#include "landaugaussbatch.cpp"
+#include "inthistogram.cpp"
 
 /*
  * Important: Due to the templates used in the LambertW implementation, it has to
@@ -67,6 +87,80 @@ bool TestFitSuccess()
     return minuitstatus.compare("CONVERGED ") == 0 || minuitstatus.compare("OK        ") == 0;
 }
 
+/**
+ * @brief langaufitfast does the same fit as `langaufit()` from "landau_gauss_ROOT/Langau.cxx", but
+ *      evaluates the convolution with LandauGaussFunction, which calculates the values for all bins
+ *      in the fit range at once with a tabulated Landau density
+ * @param his               - histogram to fit
+ * @param fitrange          - lower and upper boundary of the fit range
+ * @param startvalues       - start values of the four parameters
+ * @param parlimitslo       - lower parameter limits
+ * @param parlimitshi       - upper parameter limits
+ * @param fitparams         - array to write the fitted parameters to
+ * @return                  - the fitted function
+ */
+TF1* langaufitfast(TH1* his, double* fitrange, double* startvalues, double* parlimitslo,
+                   double* parlimitshi, double* fitparams)
+{
+    std::string funname = std::string("Fitfcn_") + his->GetName();
+
+    TF1* ffitold = (TF1*) gROOT->GetListOfFunctions()->FindObject(funname.c_str());
+    if(ffitold)
+        delete ffitold;
+
+    //cache the bins covered by the fit range:
+    const int firstbin = std::max(his->FindBin(fitrange[0]), 1);
+    const int lastbin  = std::min(his->FindBin(fitrange[1]), his->GetNbinsX());
+    LandauGaussFunction function(lastbin - firstbin + 1, his->GetBinCenter(firstbin),
+                                 his->GetBinWidth(firstbin));
+
+    TF1* ffit = new TF1(funname.c_str(), function, fitrange[0], fitrange[1], 4);
+    ffit->SetParameters(startvalues);
+    ffit->SetParNames("Width ","MP    ","Area  ","GSigma");
+
+    for(int i = 0; i < 4; ++i)
+        ffit->SetParLimits(i, parlimitslo[i], parlimitshi[i]);
+
+    his->Fit(funname.c_str(), "RB0");
+
+    ffit->GetParameters(fitparams);
+
+    return ffit;
+}
+
+/**
+ * @brief CheckLandauGauss compares the fast evaluation of the Landau-Gauss convolution to
+ *      `langaufun()` for a range of Landau widths and Gaussian sigmas
+ * @return                  - the maximum deviation relative to the maximum of the function
+ */
+double CheckLandauGauss()
+{
+    double maxdeviation = 0;
+
+    for(double width = 0.05; width <= 20; width *= 1.5)
+        for(double sigma = 0.05; sigma <= 20; sigma *= 1.5)
+        {
+            double parameters[4] = {width, 0, 1, sigma};
+
+            double maximum   = 0;
+            double deviation = 0;
+            for(double x = -10 * (width + sigma); x <= 100 * (width + sigma);
+                    x += 0.05 * (width + sigma))
+            {
+                const double reference = langaufun(&x, parameters);
+                maximum   = std::max(maximum, std::fabs(reference));
+                deviation = std::max(deviation, std::fabs(
+                                        LandauGaussFunctions::Evaluate(x, parameters) - reference));
+            }
+            if(maximum > 0)
+                maxdeviation = std::max(maxdeviation, deviation / maximum);
+        }
+
+    std::cout << "Maximum relative deviation from langaufun(): " << maxdeviation << std::endl;
+
+    return maxdeviation;
+}
+
 /**
  * fits a Landau-Gauß-Distribution to the histogram. To do so, it uses an implementation from CERN which has to
  *      be included manually ("langau.cxx" in "landau_gauss_ROOT/")
@@ -74,10 +168,12 @@ bool TestFitSuccess()
  * @param histogram     - the histogram to fit the distribution to
  * @param outputfile    - file to save the resulting parameters to
  * @param draw          - creates a plot of the histogram and the fit if true
+ * @param fast          - evaluates the convolution with the tabulated Landau density (see
+ *                          landaugauss.h) instead of `langaufun()`
  * @return              - a TF1 pointer to the fitted function
  */
 TF1* fitLandauGaussToHistogram(TH1* histogram, std::string outputfile = "", bool draw = false,
-                               double rangestart = -1e10, double rangeend = 1e10)
+                               double rangestart = -1e10, double rangeend = 1e10, bool fast = true)
 {
     if(histogram == 0)
     {
@@ -112,7 +208,8 @@ TF1* fitLandauGaussToHistogram(TH1* histogram, std::string outputfile = "", bool
                                  hist->Integral()*hist->GetBinWidth(0), 100};
     double resultvalues[4] = {0, 0, 0, 0};
 
-    TF1* func = langaufit(hist, range, startvalues, parlimitslo, parlimitshi, resultvalues);
+    TF1* func = (fast)?langaufitfast(hist, range, startvalues, parlimitslo, parlimitshi, resultvalues)
+                      :langaufit(hist, range, startvalues, parlimitslo, parlimitshi, resultvalues);
 
     if(draw)
     {
@@ -188,6 +285,61 @@ TF1* fitLandauGaussToHistogram(TH1* histogram, std::string outputfile = "", bool
     return func;
 }
 
+/**
+ * @brief FitLandauGaussBatch fits the Landau-Gauss convolution to many histograms at once without
+ *      ROOT's fitter (see landaugaussbatch.h), the histograms are fitted on several threads
+ * @param histograms        - the histograms to fit, their names are used in the output
+ * @param outputfile        - file to write the table of all results to, "" for no output
+ * @param cachefile         - file with the results of earlier calls, histograms with the same
+ *                              contents and fit range are not fitted again. The file is updated
+ *                              with the new results. "" for no cache
+ * @param rangestart        - start of the fit range
+ * @param rangeend          - end of the fit range
+ * @param numthreads        - maximum number of threads, 0 for one per CPU core
+ * @return                  - the results in the order of the histograms
+ */
+std::vector<LandauGaussFitOutput> FitLandauGaussBatch(const std::vector<TH1*>& histograms,
+                                                      std::string outputfile = "",
+                                                      std::string cachefile = "",
+                                                      double rangestart = -1e10,
+                                                      double rangeend = 1e10,
+                                                      unsigned int numthreads = 0)
+{
+    LandauGaussBatch batch(numthreads);
+    if(cachefile != "" && !batch.LoadCache(cachefile))
+        std::cout << "Could not read fit cache \"" << cachefile << "\"" << std::endl;
+
+    std::vector<double> contents;
+    for(auto histogram : histograms)
+    {
+        if(histogram == nullptr)
+            continue;
+
+        contents.resize(histogram->GetNbinsX());
+        for(int i = 0; i < histogram->GetNbinsX(); ++i)
+            contents[i] = histogram->GetBinContent(i + 1);
+
+        batch.Add(histogram->GetName(), contents.data(), contents.size(),
+                  histogram->GetBinLowEdge(1), histogram->GetBinWidth(1), rangestart, rangeend);
+    }
+
+    const std::vector<LandauGaussFitOutput>& results = batch.Run();
+
+    unsigned int numcached = 0;
+    for(auto& it : results)
+        if(it.cached)
+            ++numcached;
+    std::cout << "Fitted " << (results.size() - numcached) << " histograms, " << numcached
+              << " results reused from the cache or identical histograms" << std::endl;
+
+    if(outputfile != "" && !batch.Write(outputfile))
+        std::cout << "Could not write fit results to \"" << outputfile << "\"" << std::endl;
+    if(cachefile != "" && !batch.SaveCache(cachefile))
+        std::cout << "Could not write fit cache \"" << cachefile << "\"" << std::endl;
+
+    return results;
+}
+
 TCanvas* DrawTGraph(TGraph* gr, TCanvas* c = nullptr, std::string xtitle = "",
                  std::string ytitle = "", std::string drawoptions = "AP")
 {
@@ -287,8 +439,18 @@ TCanvas* DrawTH2(TH2* hist, TCanvas* c = nullptr, std::string xtitle = "", std::
     return c;
 }
 
+/**
+ * @brief DrawHitMap generates a histogram of the hit positions
+ * @param liste              - the data to process
+ * @param layer              - the layer to select from the data, put 0 to use all data
+ * @param groupPixX          - number of columns per bin
+ * @param groupPixY          - number of rows per bin
+ * @param title              - title of the histogram
+ * @param numthreads         - number of threads to fill the histogram, 0 for one per CPU core
+ * @return                   - the generated histogram or a nullpointer on an error
+ */
 TH2* DrawHitMap(std::list<Dataset>* liste, int layer = 0, int groupPixX = 1, int groupPixY = 1,
-                  std::string title = "")
+                  std::string title = "", unsigned int numthreads = 0)
 {
     if(liste == nullptr)
         return nullptr;
@@ -299,53 +461,55 @@ TH2* DrawHitMap(std::list<Dataset>* liste, int layer = 0, int groupPixX = 1, int
     TH2* hist = new TH2I(sname.str().c_str(),title.c_str(), 132 / groupPixX, -0.5,131.5,
                                                             372 / groupPixY, -0.5, 371.5);
 
+    std::vector<const Dataset*> hits;
     for(auto& it : *liste)
     {
         if(layer == 0 || it.layer == layer)
-            hist->Fill(it.column, it.row);
+            hits.push_back(&it);
     }
 
+    IntHistogram2D hitmap(132 / groupPixX, -0.5, 131.5, 372 / groupPixY, -0.5, 371.5);
+    IntHistogramFunctions::Fill(hitmap, hits.size(),
+                                [&](IntHistogram2D& histogram, uint64_t start, uint64_t end) {
+        for(uint64_t i = start; i < end; ++i)
+            histogram.Fill(hits[i]->column, hits[i]->row);
+    }, numthreads);
+    hitmap.CopyTo(hist);
+
     return hist;
 }
 
-std::list<Dataset>* LoadFile(std::string filename, int maxcounter = 0)
+/**
+ * @brief LoadFile loads the hits from a decoded text file. After the first complete load of a
+ *      file, a binary copy of the hits is stored next to it ("<filename>.hitcache") and used on
+ *      later calls instead of parsing the text again. The cache is regenerated automatically
+ *      if size or modification time of the text file change. The text is parsed by HitReader
+ *      (lines starting with '#' set the field order), so the cache content does not depend on
+ *      the macro which created it.
+ * @param filename           - the text file to load
+ * @param maxcounter         - maximum number of (valid) hits to load, 0 for all
+ * @param usecache           - set to false to always parse the text file and not write a cache
+ * @return                   - a new list containing the hits or a nullptr on an error
+ */
+std::list<Dataset>* LoadFile(std::string filename, int maxcounter = 0, bool usecache = true)
 {
-    std::fstream f;
-    f.open(filename.c_str(), std::ios::in);
-
-    if(!f.is_open())
+    HitReader reader;
+    if(!reader.Open(filename, usecache))
         return nullptr;
 
-//    TH1* histcol = new TH1I("testcol", "Occurrence of Column 123", 10000, 0, 20000000);
-//    TH1* histrow = new TH1I("testrow", "Occurrence of Row 71", 10000, 0, 20000000);
-
-    //get rid of content line at the beginning:
-    char text[200];
-    f.getline(text, 200, '\n');
-    //read the order of the data fields from the header line:
-    Dataset fieldorder = DatasetFunctions::FindOrder(text);
+    if(reader.FromCache())
+        std::cout << "Loading hits from cache \"" << HitCacheName(filename) << "\"" << std::endl;
 
-    
+    //the cache is only written if the file is read to the end:
     std::list<Dataset>* hits = new std::list<Dataset>();
     int counter = 0;
-
-    while(!f.eof() && (counter < maxcounter || maxcounter == 0))
+    Dataset hit;
+    while((counter < maxcounter || maxcounter == 0) && reader.Next(hit))
     {
-        std::string line = "";
-        std::getline(f, line, '\n');
-        Dataset dat = DatasetFunctions::Construct(line, fieldorder);
-        if(dat.is_valid())
-            hits->push_back(dat);
-//        if(dat.column == 123 && dat.layer == 3)
-//            histcol->Fill(counter);
-//        if(dat.row == 71 && dat.layer == 3)
-//            histrow->Fill(counter);
+        hits->push_back(hit);
         ++counter;
     }
 
-//    DrawTH1(histcol, nullptr, "Time (au)", "Occurrences per Time");
-//    DrawTH1(histrow, nullptr, "Time (au)", "Occurrences per Time");
-
     return hits;
 }
 
@@ -401,6 +565,24 @@ void RemoveInvalidHits(std::list<Dataset>* liste, bool hard = false)
     return;
 }
 
+/**
+ * @brief TimeSort sorts the hits in the list by time stamp (in the order defined by
+ *      Dataset::operator<). Nearly sorted data is handled in linear time.
+ * @param liste              - the list to sort
+ * @param method             - the sorting algorithm to use (see SortMethod in hitsort.h),
+ *                              SM_Sample sorts with the parallel sample sort
+ * @param numthreads         - number of threads to use, 0 for one per CPU core
+ */
+void TimeSort(std::list<Dataset>* liste, int method = SM_Auto, unsigned int numthreads = 0)
+{
+    if(liste == nullptr || liste->size() < 2)
+        return;
+
+    std::vector<Dataset> data(liste->begin(), liste->end());
+    SortHits(data, method, numthreads);
+    std::copy(data.begin(), data.end(), liste->begin());
+}
+
 /**
  * @brief GetLayerData creates a new list with data for only one layer
  * @param liste              - input data to search for hits
@@ -435,36 +617,59 @@ struct TimestampPlots {
     TH2I* ts2corrhist;
 };
 
-double EvalToT(const Dataset& hit, int tot, double timerescale = 1,
-               std::map<Dataset, TF1*>* calibration = nullptr)
-{
-    if(calibration != nullptr)
+/**
+ * @brief TimestampCounters contains the histograms of TimestampPlots filled by one thread of
+ *      DecodeToT()
+ */
+struct TimestampCounters {
+    TimestampCounters(int numbins, double totlow, double tothigh, double maxtot) :
+        tothist(numbins, totlow, tothigh), ts1hist(1024, -0.5, 1023.5), ts2hist(128, -0.5, 127.5),
+        ts1corrhist(1024, -0.5, 1023.5, numbins, -0.5, maxtot),
+        ts2corrhist(128, -0.5, 127.5, numbins, -0.5, maxtot) {}
+
+    void Clear()
     {
-        double caltot = tot * timerescale;
-        TF1* calfunc = (*calibration)[hit];
-        if(calfunc != nullptr)
-        {
-            caltot = calfunc->Eval(caltot);
-            return caltot;
-        }
-        else
-            return -1;
+        tothist.Clear();
+        ts1hist.Clear();
+        ts2hist.Clear();
+        ts1corrhist.Clear();
+        ts2corrhist.Clear();
     }
+    bool Merge(const TimestampCounters& other)
+    {
+        return tothist.Merge(other.tothist) && ts1hist.Merge(other.ts1hist)
+                && ts2hist.Merge(other.ts2hist) && ts1corrhist.Merge(other.ts1corrhist)
+                && ts2corrhist.Merge(other.ts2corrhist);
+    }
+
+    IntHistogram1D tothist;
+    IntHistogram1D ts1hist;
+    IntHistogram1D ts2hist;
+    IntHistogram2D ts1corrhist;
+    IntHistogram2D ts2corrhist;
+};
+
+/**
+ * @brief EvalToT converts the ToT of a hit to charge
+ * @param hit                - the hit providing the pixel address
+ * @param tot                - the ToT value of the hit
+ * @param timerescale        - factor to convert the ToT to the units of the calibration
+ * @param calibration        - the calibration of the matrix, the ToT is returned unchanged for
+ *                              a nullptr
+ * @return                   - the charge or -1 for a pixel without calibration
+ */
+inline double EvalToT(const Dataset& hit, int tot, double timerescale = 1,
+                      const ToTCalibration* calibration = nullptr)
+{
+    if(calibration != nullptr)
+        return calibration->Eval(hit.column, hit.row, tot * timerescale);
     else
         return tot;
 }
 
 int CalculateToT(int ts1, int ts2, int ts1div, int ts2div, int overflow)
 {
-    int its1 = (ts1 % 1024) * ts1div;
-    int its2 = (ts2 % 128) * ts2div;
-    its1 = its1 % (128 * ts2div);
-    its2 = its2 % (1024 * ts1div);
-    int tot = its2 - its1;
-    if(tot < 0)
-        tot += overflow;
-
-    return tot;
+    return ToTCalculationFunctions::CalculateToT(ts1, ts2, ts1div, ts2div, overflow);
 }
 
 /**
@@ -475,12 +680,19 @@ int CalculateToT(int ts1, int ts2, int ts1div, int ts2div, int overflow)
  * @param tsstepdown         - clock divider for the main clock
  * @param totstepdown        - clock divider for the tot clock
  * @param binscale           - factor to increase the bin width in the histogram
+ * @param timerescale        - factor to convert the ToT to the units of the calibration
+ * @param timescale          - factor for the values filled into the ToT histogram
+ * @param calibration        - ToT calibration to convert the ToT to charge, nullptr for none
+ * @param approximatetot     - use the vectorisable approximation for the calibration
+ *                              (see ToTCalibrationFunctions::LambertW0())
+ * @param numthreads         - number of threads to fill the histograms, 0 for one per CPU core
  * @return                   - the generated histogram or a nullpointer on an error
  */
 TimestampPlots DecodeToT(std::list<Dataset>* liste, int layer = 0, int tsstepdown = 1,
                          int ts2stepdown = 2, int binscale = 1, double timerescale = 1.,
                          const double timescale = 25,
-                         std::map<Dataset, TF1*>* calibration = nullptr)
+                         const ToTCalibration* calibration = nullptr,
+                         bool approximatetot = false, unsigned int numthreads = 0)
 {
     if(liste == nullptr)
         return TimestampPlots();
@@ -522,21 +734,75 @@ TimestampPlots DecodeToT(std::list<Dataset>* liste, int layer = 0, int tsstepdow
     if(range > 1024 * tsstepdown)
         range = 1024 * tsstepdown;
 
+    std::vector<const Dataset*> hits;
     for(auto& it : *liste)
     {
         if(it.layer == layer || layer == 0)
+            hits.push_back(&it);
+    }
+
+    //the ToT (and the charge) is calculated for blocks of hits, every thread fills its own
+    //histograms:
+    const ToTCalculator totcalculator(tsstepdown, ts2stepdown, range);
+    auto fill = [&](TimestampCounters& counters, uint64_t start, uint64_t end) {
+        const unsigned int  blocksize = 4096;
+        std::vector<short>  shortts(blocksize);
+        std::vector<short>  shortts2(blocksize);
+        std::vector<int>    pixels(blocksize);
+        std::vector<int>    tots(blocksize);
+        std::vector<double> charges(blocksize);
+
+        for(uint64_t block = start; block < end; block += blocksize)
         {
-            int tot = CalculateToT(it.shortts % 1024, it.shortts2 % 128, tsstepdown, ts2stepdown, range);
+            const unsigned int n = (end - block < blocksize)?(end - block):blocksize;
+            for(unsigned int i = 0; i < n; ++i)
+            {
+                shortts[i]  = hits[block + i]->shortts;
+                shortts2[i] = hits[block + i]->shortts2;
+            }
+            totcalculator.Calculate(n, shortts.data(), shortts2.data(), tots.data());
 
-            result.tothist->Fill(EvalToT(it, tot, timerescale, calibration) * timescale);
+            if(calibration != nullptr)
+            {
+                for(unsigned int i = 0; i < n; ++i)
+                {
+                    pixels[i]  = ToTCalibration::GetIndex(hits[block + i]->column,
+                                                          hits[block + i]->row);
+                    charges[i] = tots[i] * timerescale;
+                }
+                calibration->Eval(n, pixels.data(), charges.data(), charges.data(),
+                                  approximatetot);
+                for(unsigned int i = 0; i < n; ++i)
+                    counters.tothist.Fill(charges[i] * timescale);
+            }
+            else
+            {
+                for(unsigned int i = 0; i < n; ++i)
+                    counters.tothist.Fill(tots[i] * timescale);
+            }
+
+            for(unsigned int i = 0; i < n; ++i)
+            {
+                const int ts1 = hits[block + i]->ts % 1024;
+                const int ts2 = hits[block + i]->ts2 % 128;
 
-            result.ts1corrhist->Fill(it.ts % 1024, tot);
-            result.ts2corrhist->Fill(it.ts2 % 128, tot);
+                counters.ts1corrhist.Fill(ts1, tots[i]);
+                counters.ts2corrhist.Fill(ts2, tots[i]);
 
-            result.ts1hist->Fill(it.ts % 1024);
-            result.ts2hist->Fill(it.ts2 % 128);
+                counters.ts1hist.Fill(ts1);
+                counters.ts2hist.Fill(ts2);
+            }
         }
-    }
+    };
+
+    TimestampCounters counters(numbins / binscale, -0.5 * histwidth, end * histwidth, maxtot);
+    IntHistogramFunctions::Fill(counters, hits.size(), fill, numthreads);
+
+    counters.tothist.CopyTo(result.tothist);
+    counters.ts1hist.CopyTo(result.ts1hist);
+    counters.ts2hist.CopyTo(result.ts2hist);
+    counters.ts1corrhist.CopyTo(result.ts1corrhist);
+    counters.ts2corrhist.CopyTo(result.ts2corrhist);
 
     return result;
 }
@@ -599,6 +865,13 @@ CorrRes Correlate(std::list<Dataset>* layerone, std::list<Dataset>* layertwo,
     sfailt << "corrfailhistTime_" << histcnt;
     TH1* fhistT = new TH1I(sfailt.str().c_str(), "", 100000, -0.5 * 25, 49999.5 * 25);
 
+    //the loops fill these counters, they are copied into the ROOT histograms at the end:
+    IntHistogram2D corcountX(132, -0.5, 131.5, 132, -0.5, 131.5);
+    IntHistogram2D corcountY(372, -0.5, 371.5, 372, -0.5, 372.5);
+    IntHistogram1D tscount(10000, -5000.5 * 25, 4999.5 * 25);
+    IntHistogram1D fcountX(100000, -0.5 * 50, 699.5 * 50);
+    IntHistogram1D fcountT(100000, -0.5 * 25, 49999.5 * 25);
+
     //debug graphs:
     TGraph* gronepos = new TGraph(0);
     TGraph* grtwopos = new TGraph(0);
@@ -632,34 +905,35 @@ CorrRes Correlate(std::list<Dataset>* layerone, std::list<Dataset>* layertwo,
             ++debug_counter;
             if(std::abs((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/)) < tdist)
             {
-                long long thisdist = sqrt(pow(itone.column - ittwo->column, 2) * 9
-                                           + pow(itone.row - ittwo->row, 2));
+                long long thisdist = PixelDistanceFunctions::ISqrt(
+                        PixelDistanceFunctions::Distance2(itone.column - ittwo->column,
+                                                          itone.row - ittwo->row));
                 //the pixels are 3 times as wide as high, so calculate in multiples of 50um:
                 if(thisdist < xdist)
                 {
-                    corhistX->Fill(itone.column, ittwo->column);
-                    corhistY->Fill(itone.row, ittwo->row);
+                    corcountX.Fill(itone.column, ittwo->column);
+                    corcountY.Fill(itone.row, ittwo->row);
 
-                    tshist->Fill(((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/)) * 25);
+                    tscount.Fill(((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/)) * 25);
 
                     newmatch = ittwo;
                     newmatchpos = ittwopos; //debug
                 }
                 else
-                    fhistX->Fill(thisdist * 50);
+                    fcountX.Fill(thisdist * 50);
 
                 outofrangecounter = 0;
             }
             else if((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/) < -3*tdist)
             {
                 //std::cout << "forward: " << debug_counter << std::endl;
-                fhistT->Fill(std::abs(itone.ts - ittwo->ts));
+                fcountT.Fill(std::abs(itone.ts - ittwo->ts));
                 if(++outofrangecounter >= 20)
                     break;
             }
             else
             {
-                fhistT->Fill(std::abs(itone.ts - ittwo->ts));
+                fcountT.Fill(std::abs(itone.ts - ittwo->ts));
                 outofrangecounter = 0;
             }
 
@@ -697,33 +971,34 @@ CorrRes Correlate(std::list<Dataset>* layerone, std::list<Dataset>* layertwo,
 
             if(std::abs((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/)) < tdist)
             {
-                long long thisdist = sqrt(pow(itone.column - ittwo->column, 2) * 9
-                                          + pow(itone.row - ittwo->row, 2));
+                long long thisdist = PixelDistanceFunctions::ISqrt(
+                        PixelDistanceFunctions::Distance2(itone.column - ittwo->column,
+                                                          itone.row - ittwo->row));
                 if(thisdist < xdist)
                 {
-                    corhistX->Fill(itone.column, ittwo->column);
-                    corhistY->Fill(itone.row, ittwo->row);
+                    corcountX.Fill(itone.column, ittwo->column);
+                    corcountY.Fill(itone.row, ittwo->row);
 
-                    tshist->Fill(((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/)) * 25);
+                    tscount.Fill(((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/)) * 25);
 
                     newmatch = ittwo;
                     newmatchpos = ittwopos; //debug
                 }
                 else
-                    fhistX->Fill(thisdist * 50);
+                    fcountX.Fill(thisdist * 50);
 
                 outofrangecounter = 0;
             }
             else if((itone.ts /*% 1024*/) - (ittwo->ts /*% 1024*/) > 3*tdist)
             {
                 //std::cout << "backwards: " << debug_counter << std::endl;
-                fhistT->Fill(std::abs(itone.ts - ittwo->ts));
+                fcountT.Fill(std::abs(itone.ts - ittwo->ts));
                 if(++outofrangecounter >= 20)
                     break;
             }
             else
             {
-                fhistT->Fill(std::abs(itone.ts - ittwo->ts));
+                fcountT.Fill(std::abs(itone.ts - ittwo->ts));
                 outofrangecounter = 0;
             }
 
@@ -779,6 +1054,12 @@ CorrRes Correlate(std::list<Dataset>* layerone, std::list<Dataset>* layertwo,
 //    leg->Draw("same");
     //end debug graph drawing
 
+    corcountX.CopyTo(corhistX);
+    corcountY.CopyTo(corhistY);
+    tscount.CopyTo(tshist);
+    fcountX.CopyTo(fhistX);
+    fcountT.CopyTo(fhistT);
+
     CorrRes result;
     result.spacecorrelationX = corhistX;
     result.spacecorrelationY = corhistY;
@@ -800,6 +1081,255 @@ CorrRes Correlate(std::list<Dataset>* layerone, std::list<Dataset>* layertwo,
     return result;
 }
 
+/**
+ * @brief FillCorrelation converts the counters of a layer correlation into the histograms
+ *      returned by Correlate()
+ * @param counts             - the result of HitJoinFunctions::CorrelateHits()
+ * @param debug              - generate graphs with the search window for every hit of the
+ *                              first layer (if recorded in `counts`)
+ * @return                   - a container with pointers to the histograms, see Correlate()
+ */
+CorrRes FillCorrelation(const CorrelationCounts& counts, bool debug = false)
+{
+    static int histcnt = 0;
+    std::stringstream six("");
+    six << "sortedcorrhistX_" << ++histcnt;
+    std::stringstream siy("");
+    siy << "sortedcorrhistY_" << histcnt;
+    TH2* corhistX = new TH2I(six.str().c_str(), "", 132, -0.5, 131.5, 132, -0.5, 131.5);
+    TH2* corhistY = new TH2I(siy.str().c_str(), "", 372, -0.5, 371.5, 372, -0.5, 372.5);
+
+    std::stringstream sits("");
+    sits << "sortedcorrhist_ts_" << histcnt;
+    TH1* tshist = new TH1I(sits.str().c_str(), "", 10000, -5000.5 * 25, 4999.5 * 25);
+
+    std::stringstream sfailx("");
+    sfailx << "sortedcorrfailhistSpace_" << histcnt;
+    TH1* fhistX = new TH1I(sfailx.str().c_str(), "", 100000, -0.5 * 50, 699.5 * 50);
+    std::stringstream sfailt("");
+    sfailt << "sortedcorrfailhistTime_" << histcnt;
+    TH1* fhistT = new TH1I(sfailt.str().c_str(), "", 100000, -0.5 * 25, 49999.5 * 25);
+
+    counts.columns.CopyTo(corhistX);
+    counts.rows.CopyTo(corhistY);
+    counts.timedifference.CopyTo(tshist);
+    counts.spacefail.CopyTo(fhistX);
+    counts.timefail.CopyTo(fhistT);
+
+    CorrRes result;
+    result.spacecorrelationX = corhistX;
+    result.spacecorrelationY = corhistY;
+    result.timedistance      = tshist;
+    result.failhistT         = fhistT;
+    result.failhistX         = fhistX;
+    result.iteratorone       = nullptr;
+    result.iteratortwo       = nullptr;
+    result.startingpoint     = nullptr;
+
+    if(debug)
+    {
+        result.iteratorone   = new TGraph(0);
+        result.iteratortwo   = new TGraph(0);
+        result.startingpoint = new TGraph(0);
+        for(unsigned int i = 0; i < counts.windowbegin.size(); ++i)
+        {
+            result.iteratorone->SetPoint(i, i, i);
+            result.iteratortwo->SetPoint(i, i, counts.windowend[i]);
+            result.startingpoint->SetPoint(i, i, counts.windowbegin[i]);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief CorrelateSorted calculates the correlation of the data provided for two layers like
+ *      Correlate(), but on time sorted arrays using the time window join from hitjoin.h. All
+ *      pairs within the time window are considered and the effort is linear in the number of
+ *      hits and pairs, independent of the order of the hits and of the stop heuristic of
+ *      Correlate(). The time rejection histogram has a different definition than the one of
+ *      Correlate(): it contains the time stamp differences of all pairs with
+ *      timedist <= |dt| < 3 * timedist instead of the pairs visited by the search of Correlate().
+ * @param layerone           - time sorted data for the first layer (for X axis in plots)
+ * @param layertwo           - time sorted data for the second layer (for Y axis in plots)
+ * @param spacedist          - maximum spatial distance to be considered (in um)
+ * @param timedist           - maximum time distance to be considered (in s)
+ * @param debug              - generate graphs with the search window for every hit of `layerone`
+ * @return                   - a container with pointers to the histograms, see Correlate()
+ */
+CorrRes CorrelateSorted(const std::vector<Dataset>& layerone, const std::vector<Dataset>& layertwo,
+                            double spacedist, double timedist, bool debug = false)
+{
+    if(layerone.size() == 0 || layertwo.size() == 0)
+        return CorrRes{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+
+    if(!HitJoinFunctions::IsTimeSorted(layerone.data(), layerone.size())
+            || !HitJoinFunctions::IsTimeSorted(layertwo.data(), layertwo.size()))
+    {
+        std::cerr << "CorrelateSorted: data is not sorted by time stamp" << std::endl;
+        return CorrRes{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+    }
+
+    long long tdist = timedist / 25e-9 + 1;
+    long long xdist = spacedist / 50e-6 + 1;
+
+    CorrelationCounts counts(tdist, xdist);
+    HitJoinFunctions::CorrelateHits(layerone, layertwo, counts, nullptr, debug);
+
+    return FillCorrelation(counts, debug);
+}
+
+/**
+ * @brief CorrelateLayers correlates all pairs of the passed layers concurrently, see
+ *      CorrelateSorted() for details on the correlation. Every pair is processed on its own
+ *      thread, the histograms are generated afterwards on the calling thread.
+ * @param layers             - time sorted data for every layer
+ * @param spacedist          - maximum spatial distance to be considered (in um)
+ * @param timedist           - maximum time distance to be considered (in s)
+ * @param debug              - generate graphs with the search window for every hit
+ * @param numthreads         - maximum number of threads to use, 0 for one per CPU core
+ * @return                   - the results for all pairs (i, j) with i < j in the order
+ *                              (0,1), (0,2), ..., (1,2), ... Pairs with an empty or unsorted
+ *                              layer contain nullpointers
+ */
+std::vector<CorrRes> CorrelateLayers(const std::vector<std::vector<Dataset> >& layers,
+                                     double spacedist, double timedist, bool debug = false,
+                                     unsigned int numthreads = 0)
+{
+    long long tdist = timedist / 25e-9 + 1;
+    long long xdist = spacedist / 50e-6 + 1;
+
+    std::vector<bool> usable(layers.size(), true);
+    for(unsigned int i = 0; i < layers.size(); ++i)
+    {
+        if(!HitJoinFunctions::IsTimeSorted(layers[i].data(), layers[i].size()))
+        {
+            std::cerr << "CorrelateLayers: data of layer " << (i+1)
+                      << " is not sorted by time stamp" << std::endl;
+            usable[i] = false;
+        }
+        else if(layers[i].size() == 0)
+            usable[i] = false;
+    }
+
+    std::vector<LayerPair> allpairs;
+    std::vector<LayerPair> pairs;
+    uint64_t total = 0;
+    for(unsigned int i = 0; i < layers.size(); ++i)
+        for(unsigned int j = i + 1; j < layers.size(); ++j)
+        {
+            allpairs.push_back(LayerPair(i, j));
+            if(usable[i] && usable[j])
+            {
+                pairs.push_back(LayerPair(i, j));
+                total += layers[i].size();
+            }
+        }
+
+    std::atomic<uint64_t> progress(0);
+    std::atomic<bool>     done(false);
+    std::vector<CorrelationCounts> counts;
+    std::thread worker([&](){
+        counts = HitJoinFunctions::CorrelateLayerPairs(layers, pairs, tdist, xdist, numthreads,
+                                                       &progress, debug);
+        done = true;
+    });
+
+    //the progress is printed from here instead of from the workers:
+    while(!done)
+    {
+        std::cout << progress << "/" << total << " done\r";
+        std::cout.flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    worker.join();
+    std::cout << total << "/" << total << " done" << std::endl;
+
+    std::vector<CorrRes> results;
+    unsigned int index = 0;
+    for(auto& it : allpairs)
+    {
+        if(usable[it.one] && usable[it.two])
+            results.push_back(FillCorrelation(counts[index++], debug));
+        else
+            results.push_back(CorrRes{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+                                      nullptr, nullptr});
+    }
+
+    return results;
+}
+
+/**
+ * @brief MeasureDistanceCheck measures the time for a spatial check (see PixelDistanceBenchmark())
+ * @param name               - name of the method for the output
+ * @param deltas             - column and row differences to check (size has to be a power of 2)
+ * @param numpairs           - number of checks to perform
+ * @param reference          - duration of the reference method for the speedup, 0 for none
+ * @param check              - the check to measure, called as check(dcolumn, drow)
+ * @return                   - the duration in seconds
+ */
+template<class Check>
+double MeasureDistanceCheck(std::string name, const std::vector<std::pair<short, short> >& deltas,
+                            unsigned long long numpairs, double reference, Check check)
+{
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long accepted = 0;
+    const unsigned long long mask = deltas.size() - 1;
+    for(unsigned long long i = 0; i < numpairs; ++i)
+    {
+        const std::pair<short, short>& delta = deltas[i & mask];
+        if(check(delta.first, delta.second))
+            ++accepted;
+    }
+    double duration = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                        - start).count();
+
+    std::cout << name << ": " << duration << " s (" << duration / numpairs * 1e9
+              << " ns per pair, " << accepted << " accepted";
+    if(reference > 0)
+        std::cout << ", speedup " << reference / duration;
+    std::cout << ")" << std::endl;
+
+    return duration;
+}
+
+/**
+ * @brief PixelDistanceBenchmark compares the spatial check of the correlation inner loop in
+ *      floating point (as in Correlate()) with the integer check of PixelNeighbourhood
+ * @param numpairs           - number of pixel pairs to check per method
+ * @param spacedist          - distance limit (in m), as passed to CorrelateSorted()
+ */
+void PixelDistanceBenchmark(unsigned long long numpairs = 1e8, double spacedist = 150e-6*15)
+{
+    const long long xdist = spacedist / 50e-6 + 1;
+
+    //random column and row differences within the matrix:
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> columns(-131, 131);
+    std::uniform_int_distribution<int> rows(-371, 371);
+    const unsigned int numdeltas = 1 << 20;
+    std::vector<std::pair<short, short> > deltas(numdeltas);
+    for(auto& it : deltas)
+        it = std::make_pair(short(columns(generator)), short(rows(generator)));
+
+    std::cout << "Checking " << numpairs << " pixel pairs against a distance of " << xdist
+              << " x 50 um" << std::endl;
+
+    double reference = MeasureDistanceCheck("floating point", deltas, numpairs, 0,
+        [&](int dcol, int drow)
+    {
+        long long thisdist = sqrt(pow(dcol, 2) * 9 + pow(drow, 2));
+        return thisdist < xdist;
+    });
+
+    const PixelNeighbourhood nearby(xdist * xdist);
+    MeasureDistanceCheck("integer", deltas, numpairs, reference,
+        [&](int dcol, int drow)
+    {
+        return nearby.Contains(dcol, drow);
+    });
+}
+
 struct Extent{
 	int startcol;
 	int endcol;
@@ -839,111 +1369,55 @@ struct Extent{
 	}
 };
 
+/**
+ * @brief Clusterise groups the hits of one layer into clusters of hits close in space and time
+ * @param liste              - the hits to group
+ * @param spacedist          - maximum distance of neighbouring hits in a cluster (in m)
+ * @param timedist           - time window for neighbouring hits in a cluster (in s)
+ * @param numthreads         - maximum number of threads, 0 for one per CPU core
+ * @return                   - the clusters ordered by their first hit, nullptr on no data
+ */
 std::list<std::pair<Extent, std::list<Dataset> > >* Clusterise(std::list<Dataset>* liste, 
-					double spacedist = 150e-6, double timedist = 75e-9)
+					double spacedist = 150e-6, double timedist = 75e-9,
+					unsigned int numthreads = 0)
 {
 	if(liste == nullptr || liste->size() == 0)
 		return nullptr;
 
-	//container to remove data from:
-	std::list<Dataset> rawhits;
-	rawhits.insert(rawhits.end(), liste->begin(), liste->end());
-	
-	auto doneclusters = new std::list<std::pair<Extent, std::list<Dataset> > >();
-	auto clusters = new std::list<std::pair<Extent, std::list<Dataset> > >();
+	std::vector<Dataset> hits(liste->begin(), liste->end());
+	if(!HitJoinFunctions::IsTimeSorted(hits.data(), hits.size()))
+		std::stable_sort(hits.begin(), hits.end(),
+						 [](const Dataset& a, const Dataset& b) { return a.ts < b.ts; });
 	
 	const int deltat = int(ceil(timedist / 25e-9));
 	const int deltax = int(ceil(spacedist / 50e-6));
+	//hits up to deltax apart are neighbours (deltax^2 >= 9 dcol^2 + drow^2):
+	const PixelNeighbourhood nearby(deltax * deltax, true);
 	
-	Extent newcluster;
-	newcluster.Fill(rawhits.front(), deltax);
-	
-	std::list<Dataset> neueliste;
-	neueliste.push_back(rawhits.front());
-	clusters->push_back(std::make_pair(newcluster, neueliste));
-	rawhits.pop_front();
-	
-	auto it = rawhits.begin();
-	bool addedone = false;
-	
-	std::cout << "Clusters\tremaining hits\n" << clusters->size() << "\t\t" << rawhits.size() << "          \r";
+	ClusterList list;
+	ClusteringFunctions::ClusterParallel(hits.data(), hits.size(), deltat, nearby,
+										 [](const Dataset& hit) { return hit.ts; }, list,
+										 numthreads);
 	
-	while(rawhits.size() > 0)
+	auto clusters = new std::list<std::pair<Extent, std::list<Dataset> > >();
+	for(uint64_t k = 0; k < list.GetNumClusters(); ++k)
 	{
-		bool aborted = false;
-		for(auto& cit : *clusters)
-		{
-			//coarse check for being closeby:
-			if(cit.first.Inside(*it, deltat))
-			{
-				bool found = false;
-				//precise check with the hits inside the cluster:
-				for(auto& hit : cit.second)
-				{
-					//take care of 150x50µm² pixels of ATLASPix3:
-					if(pow(deltax, 2) <= pow(hit.column - it->column, 2) * 3 + pow(hit.row - it->row, 2))
-					{
-						cit.second.push_back(*it);		//add to cluster
-						cit.first.Extend(*it, deltax);  //update "closeby" area
-						it = rawhits.erase(it);			//remove from unclustered list
-						addedone = true;				//store that a hit was added in this cycle
-						found = true;					//to restart the search with the next hit
-
-						std::cout << clusters->size() << "\t\t" << rawhits.size() << "\r";
-						std::cout.flush();
-
-						break;					
-					}
-				}
-				
-				if(found)	//do not check other clusters if the hit was already added to one
-					break;
-			}
-			//abort the search if the clusters are too early for the hits
-			else if(cit.first.LongAgo(*it, 100 * deltat))
-			{
-				aborted = true;
-				break;
-			}
-		}
+		Extent extent;
+		extent.Fill(hits[list.hits[list.offsets[k]]], deltax);
 		
-		if(rawhits.size() == 0)
-			break;
-			
-		++it;
-		if(it == rawhits.end() || aborted)
+		std::list<Dataset> clusterhits;
+		for(uint64_t i = list.offsets[k]; i < list.offsets[k + 1]; ++i)
 		{
-			//create a new cluster if no hit could be added to an existing cluster:
-			if(addedone == false)
-			{
-				doneclusters->insert(doneclusters->end(), clusters->begin(), clusters->end());
-				clusters->clear();
-				
-				Extent newcluster;
-				newcluster.Fill(rawhits.front(), deltax);
-				std::list<Dataset> neueliste;
-				neueliste.push_back(rawhits.front());
-				clusters->push_back(std::make_pair(newcluster, neueliste));
-				
-				rawhits.pop_front();
-			}
-			else
-				addedone = false;
-			
-			it = rawhits.begin();
-			
-			std::cout << clusters->size() + doneclusters->size() << "\t\t" << rawhits.size() << "          \r";
-			std::cout.flush();
+			clusterhits.push_back(hits[list.hits[i]]);
+			extent.Extend(hits[list.hits[i]], deltax);
 		}
+		
+		clusters->push_back(std::make_pair(extent, clusterhits));
 	}
 	
-	std::cout << std::endl;
+	std::cout << clusters->size() << " clusters from " << hits.size() << " hits" << std::endl;
 	
-	doneclusters->insert(doneclusters->end(), clusters->begin(), clusters->end());
-	delete clusters;
-	clusters = nullptr;
-	
-	return doneclusters;
+	return clusters;
 }
 
 struct ClusteringResult{
@@ -976,15 +1450,354 @@ ClusteringResult AnalyseClusters(std::list<std::pair<Extent, std::list<Dataset>
 	return result;
 }
 
+/**
+ * @brief WriteClusterFile clusters the hits of all layers and stores the clusters in a binary
+ *      cluster file (see clusterfile.h). The pixel lists refer to the hit cache of the text file,
+ *      which is created if it does not exist yet. No alignment is applied to the hits.
+ * @param filename           - input data to cluster
+ * @param clusterfile        - the cluster file to write
+ * @param spacedist          - maximum distance of neighbouring hits in a cluster (in m)
+ * @param timedist           - time window for neighbouring hits in a cluster (in s)
+ * @param ts1div             - clock divider of TS1, used for the ToT sums of the clusters
+ * @param ts2div             - clock divider of TS2
+ * @param writepixels        - store the hit indices of the clusters
+ * @param numthreads         - maximum number of threads, 0 for one per CPU core
+ * @return                   - false if no data was loaded or the file could not be written
+ */
+bool WriteClusterFile(std::string filename, std::string clusterfile, double spacedist = 300e-6,
+                      double timedist = 300e-9, int ts1div = 1, int ts2div = 2,
+                      bool writepixels = true, unsigned int numthreads = 0)
+{
+    //the pixel lists are indices into the hit cache, so it has to exist:
+    MappedHitFile cache;
+    if(!cache.Open(HitCacheName(filename), filename))
+    {
+        delete LoadFile(filename);
+        if(!cache.Open(HitCacheName(filename), filename))
+        {
+            std::cout << "could not load hits from \"" << filename << "\"" << std::endl;
+            return false;
+        }
+    }
+
+    ClusterFileWriter writer;
+    if(!writer.Open(clusterfile, filename, writepixels))
+    {
+        std::cout << "could not open \"" << clusterfile << "\"" << std::endl;
+        return false;
+    }
+
+    const int deltat = int(ceil(timedist / 25e-9));
+    const int deltax = int(ceil(spacedist / 50e-6));
+    const PixelNeighbourhood nearby(deltax * deltax, true);
+
+    auto time = [](const Dataset& hit) { return hit.ts; };
+    //the ToT sums are taken from the ToT values calculated for the whole layer:
+    auto notot = [](const Dataset&) { return 0; };
+    const ToTCalculator totcalculator(ts1div, ts2div);
+
+    for(int layer = 1; layer <= 4; ++layer)
+    {
+        //time ordered indices of the hits with valid addresses:
+        std::vector<uint64_t> indices;
+        for(uint64_t i = 0; i < cache.size(); ++i)
+        {
+            const Dataset& hit = cache[i];
+            if(hit.layer == layer && hit.column >= 0 && hit.column <= 131
+                    && hit.row >= 0 && hit.row <= 371)
+                indices.push_back(i);
+        }
+        std::stable_sort(indices.begin(), indices.end(), [&](uint64_t a, uint64_t b) {
+            return cache[a].ts < cache[b].ts;
+        });
+
+        std::vector<Dataset> hits;
+        std::vector<short>   shortts;
+        std::vector<short>   shortts2;
+        hits.reserve(indices.size());
+        shortts.reserve(indices.size());
+        shortts2.reserve(indices.size());
+        for(auto index : indices)
+        {
+            hits.push_back(cache[index]);
+            shortts.push_back(cache[index].shortts);
+            shortts2.push_back(cache[index].shortts2);
+        }
+        std::vector<int> tots(hits.size());
+        totcalculator.Calculate(hits.size(), shortts.data(), shortts2.data(), tots.data());
+
+        ClusterList list;
+        ClusteringFunctions::ClusterParallel(hits.data(), hits.size(), deltat, nearby, time,
+                                             list, numthreads);
+
+        std::vector<Dataset>  clusterhits;
+        std::vector<uint64_t> pixels;
+        for(uint64_t k = 0; k < list.GetNumClusters(); ++k)
+        {
+            clusterhits.clear();
+            pixels.clear();
+            int totsum = 0;
+            for(uint64_t i = list.offsets[k]; i < list.offsets[k + 1]; ++i)
+            {
+                clusterhits.push_back(hits[list.hits[i]]);
+                pixels.push_back(indices[list.hits[i]]);
+                totsum += tots[list.hits[i]];
+            }
+
+            ClusterRecord record = ClusterFileFunctions::Summarise(clusterhits.begin(),
+                                                                   clusterhits.end(), layer,
+                                                                   time, notot);
+            record.tot = totsum;
+            if(!writer.Add(record, pixels.data()))
+            {
+                std::cout << "could not write \"" << clusterfile << "\"" << std::endl;
+                writer.Discard();
+                return false;
+            }
+        }
+
+        std::cout << "Layer " << layer << ": " << list.GetNumClusters() << " clusters from "
+                  << hits.size() << " hits" << std::endl;
+    }
+
+    if(!writer.Close())
+    {
+        std::cout << "could not write \"" << clusterfile << "\"" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief LoadClusterFile rebuilds the clusters of one layer from a cluster file with pixel lists
+ *      in the format returned by Clusterise()
+ * @param clusterfile        - the cluster file to read
+ * @param filename           - the text file the cluster file was generated from, its hit cache
+ *                              provides the hits
+ * @param layer              - the layer to load the clusters of
+ * @param spacedist          - distance used for the extent of the clusters (in m)
+ * @return                   - the clusters of the layer, nullptr if the files could not be read
+ *                              or the cluster file does not contain pixel lists
+ */
+std::list<std::pair<Extent, std::list<Dataset> > >* LoadClusterFile(std::string clusterfile,
+                    std::string filename, int layer, double spacedist = 300e-6)
+{
+    MappedClusterFile clusters;
+    if(!clusters.Open(clusterfile, filename))
+    {
+        std::cerr << "could not open \"" << clusterfile << "\" for \"" << filename << "\""
+                  << std::endl;
+        return nullptr;
+    }
+    if(!clusters.HasPixels())
+    {
+        std::cerr << "\"" << clusterfile << "\" does not contain pixel lists" << std::endl;
+        return nullptr;
+    }
+
+    MappedHitFile cache;
+    if(!cache.Open(HitCacheName(filename), filename))
+    {
+        std::cerr << "could not open the hit cache of \"" << filename << "\"" << std::endl;
+        return nullptr;
+    }
+
+    const int deltax = int(ceil(spacedist / 50e-6));
+
+    auto result = new std::list<std::pair<Extent, std::list<Dataset> > >();
+    for(uint64_t k = 0; k < clusters.size(); ++k)
+    {
+        const ClusterRecord& record = clusters[k];
+        if(record.layer != layer || record.size == 0)
+            continue;
+
+        const uint64_t* pixels = clusters.Pixels(k);
+        Extent extent;
+        extent.Fill(cache[pixels[0]], deltax);
+
+        std::list<Dataset> clusterhits;
+        for(uint32_t i = 0; i < record.size; ++i)
+        {
+            if(pixels[i] >= cache.size())
+            {
+                std::cerr << "invalid pixel index in \"" << clusterfile << "\"" << std::endl;
+                delete result;
+                return nullptr;
+            }
+            clusterhits.push_back(cache[pixels[i]]);
+            extent.Extend(cache[pixels[i]], deltax);
+        }
+
+        result->push_back(std::make_pair(extent, clusterhits));
+    }
+
+    return result;
+}
+
+/**
+ * @brief AnalyseClusterFile draws the cluster size and shape distributions of all layers from
+ *      the records of a cluster file and the time differences in the clusters from the pixel
+ *      lists, without clustering the hits again
+ * @param clusterfile        - the cluster file to analyse
+ * @param filename           - the text file the cluster file was generated from, only needed for
+ *                              the time differences (skipped on an empty string)
+ * @param outputprefix       - prefix for storing plots, nothing will be saved on an empty string
+ * @return                   - false if the cluster file could not be read
+ */
+bool AnalyseClusterFile(std::string clusterfile, std::string filename = "",
+                        std::string outputprefix = "")
+{
+    MappedClusterFile clusters;
+    if(!clusters.Open(clusterfile, filename))
+    {
+        std::cout << "could not open \"" << clusterfile << "\"" << std::endl;
+        return false;
+    }
+
+    MappedHitFile cache;
+    bool withdelays = filename != "" && clusters.HasPixels()
+                        && cache.Open(HitCacheName(filename), filename);
+
+    static int filecnt = 0;
+    ++filecnt;
+
+    TH1* sizehist[4];
+    TH1* delayhist[4];
+    TH2* shapehist[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        std::stringstream name("");
+        name << "_" << filecnt << "_L" << (i+1);
+        sizehist[i]  = new TH1I(("hist_clusterfilesize" + name.str()).c_str(), "",
+                                40, 0.5, 40.5);
+        delayhist[i] = new TH1I(("hist_clusterfiletimedistr" + name.str()).c_str(), "",
+                                40, -20.5, 19.5);
+        shapehist[i] = new TH2I(("hist_clusterfileshape" + name.str()).c_str(), "",
+                                10, 0.5, 10.5, 20, 0.5, 20.5);
+    }
+
+    for(uint64_t k = 0; k < clusters.size(); ++k)
+    {
+        const ClusterRecord& record = clusters[k];
+        if(record.layer < 1 || record.layer > 4)
+            continue;
+
+        const int i = record.layer - 1;
+        sizehist[i]->Fill(record.size);
+        shapehist[i]->Fill(record.endcolumn - record.startcolumn + 1,
+                           record.endrow - record.startrow + 1);
+
+        if(withdelays)
+        {
+            const uint64_t* pixels = clusters.Pixels(k);
+            for(uint32_t j = 0; j < record.size; ++j)
+                if(pixels[j] < cache.size())
+                    delayhist[i]->Fill(record.time - cache[pixels[j]].ts);
+        }
+    }
+
+    for(int i = 0; i < 4; ++i)
+    {
+        if(sizehist[i]->GetEntries() == 0)
+        {
+            std::cout << "no clusters. -> Skipping layer " << (i+1) << std::endl;
+            continue;
+        }
+
+        sizehist[i]->SetTitle((std::string("Cluster Size Distribution Layer ")
+                                + char(49+i)).c_str());
+        TCanvas* c = DrawTH1(sizehist[i], nullptr, "Clustersize (# pixels)", "Counts");
+        c->SetLogy(1);
+        if(outputprefix != "")
+            c->SaveAs((outputprefix + "_clustersize_L" + char(49+i) + ".pdf").c_str());
+
+        shapehist[i]->SetTitle((std::string("Cluster Shape Layer ") + char(49+i)).c_str());
+        c = DrawTH2(shapehist[i], nullptr, "Columns", "Rows", "Counts", "colz");
+        if(outputprefix != "" && c != nullptr)
+            c->SaveAs((outputprefix + "_clustershape_L" + char(49+i) + ".pdf").c_str());
+
+        if(withdelays)
+        {
+            delayhist[i]->SetTitle((std::string("Time Difference in a cluster for Layer ")
+                                    + char(49+i)).c_str());
+            c = DrawTH1(delayhist[i], nullptr, "Time Difference (in 25ns)", "Counts");
+            c->SetLogy(1);
+            if(outputprefix != "")
+                c->SaveAs((outputprefix + "_clustertimedifference_L" + char(49+i)
+                            + ".pdf").c_str());
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Align determines the spatial alignment of all layers to a reference layer from hits
+ *      coincident in time and writes it to a file to be used with Analysis()
+ * @param filename           - input data to analyse
+ * @param alignmentfile      - file to write the alignment parameters to
+ * @param reference          - layer number of the reference layer
+ * @param samplestep         - use only every `samplestep`-th hit of the reference layer
+ * @param timedist           - time window for coincident hits (in s)
+ * @param numthreads         - maximum number of threads, 0 for one per CPU core
+ * @return                   - false if no data was loaded or the file could not be written
+ */
+bool Align(std::string filename, std::string alignmentfile, unsigned int reference = 1,
+           unsigned int samplestep = 1, double timedist = 1875e-9, unsigned int numthreads = 0)
+{
+    std::list<Dataset>* fullset = LoadFile(filename);
+
+    if(fullset == nullptr || fullset->size() == 0)
+    {
+        std::cout << "no data loaded. Aborting" << std::endl;
+        return false;
+    }
+
+    std::vector<std::vector<Dataset> > layers(4);
+    for(int i = 0; i < 4; ++i)
+    {
+        std::list<Dataset>* layerdata = GetLayerData(fullset, i+1);
+        RemoveInvalidHits(layerdata, true);
+        TimeSort(layerdata);
+        layers[i].assign(layerdata->begin(), layerdata->end());
+        delete layerdata;
+    }
+    delete fullset;
+
+    AlignmentSettings settings;
+    settings.timedist   = timedist / 25e-9;
+    settings.samplestep = samplestep;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<AlignmentResult> results = AlignmentFunctions::AlignLayers(layers, reference,
+                                                                           settings, numthreads);
+    std::cout << "Alignment took "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+              << " s" << std::endl;
+
+    AlignmentFunctions::PrintReport(std::cout, results);
+
+    if(!AlignmentFunctions::Save(alignmentfile, results))
+    {
+        std::cout << "could not write \"" << alignmentfile << "\"" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * @brief Analysis analysis method to call all other methods to perform everything in one go
  * @param filename           - input data to analyse
  * @param outputprefix       - prefix for storing plots, nothing will be saved on an empty string
  * @param performcorrelation - execute the layer to layer correlations on true, skip them on false
  * @param generatedebuggraphs - generate more plots for debugging during correlation of layers
+ * @param alignmentfile      - file with the spatial alignment of the layers (see Align()), no
+ *                              alignment is applied on an empty string
  */
 void Analysis(std::string filename, std::string outputprefix = "", bool performcorrelation = true,
-              const bool generatedebuggraphs = false)
+              const bool generatedebuggraphs = false, std::string alignmentfile = "")
 {
     std::list<Dataset>* fullset = LoadFile(filename);
 
@@ -1013,10 +1826,40 @@ void Analysis(std::string filename, std::string outputprefix = "", bool performc
     		  << std::endl;
 
 
+    //the time stamp check of RemoveInvalidHits() compares neighbours in readout order, so the
+    //  data is cleaned before sorting it and before the alignment changes any address:
     for(int i = 0; i < 4; ++i)
-    {
         RemoveInvalidHits(layerdata[i], true);
 
+    //hits moved out of the matrix by the alignment are removed afterwards:
+    if(alignmentfile != "")
+    {
+        std::vector<AlignmentParameters> alignment = AlignmentFunctions::Load(alignmentfile);
+        if(alignment.size() == 0)
+            std::cout << "could not load alignment from \"" << alignmentfile << "\"" << std::endl;
+        for(int i = 0; i < 4; ++i)
+        {
+            AlignmentFunctions::Apply(layerdata[i]->begin(), layerdata[i]->end(), alignment);
+            RemoveInvalidHits(layerdata[i]);
+        }
+    }
+
+    //the correlation and clustering rely on time ordered data:
+    for(int i = 0; i < 4; ++i)
+        TimeSort(layerdata[i]);
+
+    //all layer pairs are correlated concurrently before generating the plots:
+    std::vector<CorrRes> correlations;
+    if(performcorrelation)
+    {
+        std::vector<std::vector<Dataset> > layers(4);
+        for(int i = 0; i < 4; ++i)
+            layers[i].assign(layerdata[i]->begin(), layerdata[i]->end());
+        correlations = CorrelateLayers(layers, 150e-6*15, 1875e-9, generatedebuggraphs); //1250e-9);
+    }
+
+    for(int i = 0; i < 4; ++i)
+    {
         if(layerdata[i]->size() == 0)
         {
             std::cout << "no data. -> Skipping layer " << (i+1) << std::endl;
@@ -1087,11 +1930,11 @@ void Analysis(std::string filename, std::string outputprefix = "", bool performc
         //        c->SaveAs((outputprefix + "_Packages_L" + char(i+49) + ".pdf").c_str());
         //}
 
-        //correlations:
+        //correlations (the pairs are stored in the order (0,1), (0,2), (0,3), (1,2), ...):
         for(int j = i + 1; j < 4 && performcorrelation; ++j)
         {
             std::string ending = std::string("L") + char(i+49) + "_L" + char(j+49);
-            CorrRes result = Correlate(layerdata[i], layerdata[j], 150e-6*15, 1875e-9, generatedebuggraphs); //1250e-9);
+            CorrRes result = correlations[i * (7 - i) / 2 + j - i - 1];
 
             if(result.spacecorrelationX != nullptr)
                 result.spacecorrelationX->SetTitle(("X correlation " + ending).c_str());
@@ -1135,7 +1978,7 @@ void Analysis(std::string filename, std::string outputprefix = "", bool performc
             TCanvas* c4 = DrawTH1(result.failhistT, nullptr, "Time Difference (ns)", "Counts");
             TCanvas* c5 = DrawTH1(result.failhistX, nullptr, "Space Distance (in um)", "Counts");
             TCanvas* c6 = nullptr;
-            if(generatedebuggraphs)
+            if(generatedebuggraphs && result.iteratorone != nullptr)
             {
                 c6 = DrawTGraph(result.iteratorone, nullptr, "Step", "Iterator Position", "AL");
                 DrawTGraph(result.iteratortwo, c6,"","","Lsame");
@@ -1199,115 +2042,25 @@ void Analysis(std::string filename, std::string outputprefix = "", bool performc
 
 double InvToT(double* value, double* pars)
 {
-    double result = pars[0] / pars[2] * utl::LambertW(0, pars[2] / pars[0] * pars[1]
-            * exp((value[0] - pars[3] - pars[2] * pars[1])/pars[0])) + pars[1];
-    return result;
+    return ToTCalibrationFunctions::InvToT(value[0], pars[0], pars[1], pars[2], pars[3]);
 }
 
-bool sortvector(const std::pair<Dataset, TF1*> lhs, const std::pair<Dataset, TF1*> rhs)
-{
-    return lhs.first.column < rhs.first.column
-            || (lhs.first.column == rhs.first.column && lhs.first.row < rhs.first.row);
-}
-
-
-
-std::map<Dataset, TF1*> LoadToTCalibration(std::string filename)
+/**
+ * @brief LoadToTCalibration reads the ToT calibration of a matrix from a binary calibration file
+ *      or the text file of the injection scan fits. Text files can be converted with
+ *      ToTCalibrationFunctions::ConvertText() to skip the parsing.
+ * @param filename           - the file to read
+ * @return                   - the calibration, without any calibrated pixels on an error
+ */
+ToTCalibration LoadToTCalibration(std::string filename)
 {
-    if(filename == "")
-        return std::map<Dataset, TF1*>();
-
-    std::fstream f;
-    f.open(filename.c_str(), std::ios::in);
-
-    if(!f.is_open())
-        return std::map<Dataset, TF1*>();
-
-    std::vector<std::pair<Dataset, TF1*> > data;
-    data.reserve(49110);
-
-    std::string text;
-    Dataset pix;
-    TF1* fitfunc = nullptr;
-
-    f >> text;
-
-    while(!f.eof())
-    {
-        if(text[0] == '#')
-        {
-            f >> text;
-            //header line (not used):
-            if(text.find("Fit") != std::string::npos)
-                std::getline(f, text);
-            else if(text.find("Pixel") != std::string::npos)
-            {
-                if(fitfunc != nullptr)
-                    data.push_back(std::make_pair(pix, fitfunc));
-
-                if((data.size() % 100) == 0)
-                    std::cout << "loaded fits for " << data.size() << " pixels\r" << std::flush;
-
-                std::getline(f, text);
-                int start = text.find('(');
-                int ende  = text.find(')');
-                text = text.substr(start, ende - start + 1);
-                pix = Dataset(text);
-
-                static int cnt = 0;
-                std::stringstream s("");
-                s << "totcal_" << ++cnt;
-                //fitfunc = new TF1(s.str().c_str(), "[0]*log((x-[1])/[1]) + [2] * x + [3]", 0, 2);
-                //inverse ToT function
-                fitfunc = new TF1(s.str().c_str(), InvToT, 0, 128, 4);
-            }
-        }
-        else
-        {
-            double value, valerror;
-            std::string plusminus;
-            f >> value >> plusminus >> valerror;
-            if(text.find("x0") != std::string::npos)
-            {
-                fitfunc->SetParameter(1, value);
-                fitfunc->SetParError(1, valerror);
-                fitfunc->SetRange(value, 2);
-            }
-            else if(text.find("offset") != std::string::npos)
-            {
-                fitfunc->SetParameter(3, value);
-                fitfunc->SetParError(3, valerror);
-            }
-            else if(text.find("lnscale") != std::string::npos)
-            {
-                fitfunc->SetParameter(0, value);
-                fitfunc->SetParError(0, valerror);
-            }
-            else if(text.find("linear") != std::string::npos)
-            {
-                fitfunc->SetParameter(2, value);
-                fitfunc->SetParError(2, valerror);
-            }
-        }
-        f >> text;
-    }
-    std::cout << std::endl;
-
-    f.close();
-
-    if(fitfunc != nullptr)
-        data.push_back(std::make_pair(pix, fitfunc));
-
-    std::sort(data.begin(), data.end(), sortvector);
-
-    std::map<Dataset, TF1*> datamap;
-
-    datamap.insert(data.begin(), data.end());
+    ToTCalibration calibration;
+    if(calibration.Open(filename) || ToTCalibrationFunctions::LoadText(filename, calibration))
+        std::cout << "loaded fits for " << calibration.GetNumCalibrated() << " pixels"
+                  << std::endl;
 
-    return datamap;
+    return calibration;
 }
- 
- 
 
 bool WriteToFile(std::string filename, std::string data)
 {
@@ -1325,7 +2078,7 @@ bool WriteToFile(std::string filename, std::string data)
 }
 
 void EqualisedToT(std::string filename, std::string totcal, std::string outputprefix = "",
-                  bool dataoutput = false)
+                  bool dataoutput = false, bool approximatetot = false)
 {
     std::list<Dataset>* fullset = LoadFile(filename);
 
@@ -1359,7 +2112,7 @@ void EqualisedToT(std::string filename, std::string totcal, std::string outputpr
                   << std::endl;
 
     //Load ToTCalibration:
-    std::map<Dataset, TF1*> totcalibration = LoadToTCalibration(totcal);
+    ToTCalibration totcalibration = LoadToTCalibration(totcal);
 
     TCanvas* c = nullptr;
 
@@ -1382,7 +2135,8 @@ void EqualisedToT(std::string filename, std::string totcal, std::string outputpr
     }
 
     //calibrated ToT:
-    TimestampPlots calresult = DecodeToT(layerdata[i], 0, 1, 8, 1, 0.25/*3.2/2*/, 5463, &totcalibration);
+    TimestampPlots calresult = DecodeToT(layerdata[i], 0, 1, 8, 1, 0.25/*3.2/2*/, 5463,
+                                         &totcalibration, approximatetot);
     TH1* histtotcal = calresult.tothist;
     histtotcal->SetTitle((std::string("calibrated ToT Layer ") + char(i + 49)).c_str());
     TF1* langau = fitLandauGaussToHistogram(histtotcal, "", false, 3200, 10000);
@@ -1486,15 +2240,34 @@ void EqualisedToT(std::string filename, std::string totcal, std::string outputpr
     sname << "tot_cluster_hist_cal_" << histcnt;
     TH1* hist_clustercal = new TH1I(sname.str().c_str(), "", 2048 / binscale, -0.5 * timescale,
                          99999.5);
+    //the calibration of all hits is evaluated in one go:
+    std::vector<int>    pixels;
+    std::vector<int>    ts1;
+    std::vector<int>    ts2;
+    for(auto& it : *clusters)
+        for(auto& hit : it.second)
+        {
+            pixels.push_back(ToTCalibration::GetIndex(hit.column, hit.row));
+            ts1.push_back(hit.ts % 1024);
+            ts2.push_back(hit.ts2 % 128);
+        }
+    std::vector<int> tots(pixels.size());
+    ToTCalculator(1, 8, 1024).Calculate(tots.size(), ts1.data(), ts2.data(), tots.data());
+    std::vector<double> charges(tots.size());
+    for(unsigned int k = 0; k < tots.size(); ++k)
+        charges[k] = tots[k] * 0.25;
+    totcalibration.Eval(charges.size(), pixels.data(), charges.data(), charges.data(),
+                        approximatetot);
+
+    unsigned int index = 0;
     for(auto& it : *clusters)
     {
         double charge    = 0;
         double chargecal = 0;
-        for(auto& hit : it.second)
+        for(unsigned int k = 0; k < it.second.size(); ++k, ++index)
         {
-            int tot = CalculateToT(hit.ts % 1024, hit.ts2 % 128, 1, 8, 1024);
-            charge += tot; //EvalToT(hit, tot, 0.25, nullptr);
-            chargecal += EvalToT(hit, tot, 0.25, &totcalibration);
+            charge    += tots[index];
+            chargecal += charges[index];
         }
 
         hist_cluster->Fill(charge * timescale);
@@ -1580,14 +2353,6 @@ void EqualisedToT(std::string filename, std::string totcal, std::string outputpr
                       << "_fitparameters.dat\"" << std::endl;
     }
 
-    //clear memory:
-    for(auto& it : totcalibration)
-    {
-        delete it.second;
-        it.second = nullptr;
-    }
-    totcalibration.clear();
-
     //if(outputprefix != "")
     //    rootfileoutput.Close();
 }
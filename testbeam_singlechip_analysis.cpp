@@ -37,6 +37,10 @@
 #include <utility>
 #include <math.h>
 
+#include "pixeldistance.cpp"
+#include "totcalculation.cpp"
+#include "clustering.cpp"
+
 typedef long long longlong;
 
 /**
@@ -632,22 +636,37 @@ TH1I* DecodeToT(std::list<Dataset>* liste, int layer = 0, int tsstepdown = 1, in
     if(range > 1024 * tsstepdown)
         range = 1024 * tsstepdown;
 
-    for(auto& it : *liste)
-    {
-        if(it.layer == layer || layer == 0)
+    //the ToT is calculated for blocks of hits:
+    const ToTCalculator totcalculator(tsstepdown, totstepdown, range);
+    const unsigned int  blocksize = 4096;
+    std::vector<int>    ts1;
+    std::vector<int>    ts2;
+    std::vector<int>    tots(blocksize);
+    auto processblock = [&]() {
+        totcalculator.Calculate(ts1.size(), ts1.data(), ts2.data(), tots.data());
+        for(unsigned int i = 0; i < ts1.size(); ++i)
         {
-            int ts1 = (it.ts % 1024) * tsstepdown;
-            int ts2 = (it.tot % 128) * totstepdown;
-            ts1 = ts1 % (128 * totstepdown);
-            ts2 = ts2 % (1024 * tsstepdown);
-            int tot = ts2 - ts1;
-            if(tot < 0)
-                tot += range;
+            int tot = tots[i];
             if(tot * timescale < 60000) //debug
                 tot += 128 * totstepdown;//debug
             hist->Fill(tot * timescale);
         }
+        ts1.clear();
+        ts2.clear();
+    };
+
+    for(auto& it : *liste)
+    {
+        if(it.layer == layer || layer == 0)
+        {
+            ts1.push_back(it.ts % 1024);
+            ts2.push_back(it.tot % 128);
+            if(ts1.size() == blocksize)
+                processblock();
+        }
     }
+    if(ts1.size() > 0)
+        processblock();
 
     return hist;
 }
@@ -742,263 +761,32 @@ std::string Rightalign(unsigned long long number, unsigned int length, AlignPara
     return s.str();
 }
 
-std::list<std::pair<Extent, std::list<Dataset> > >* Clusterise(std::list<Dataset>* liste, 
-                        double spacedist = 150e-6, double timedist = 75e-9, bool direct = false,
-                        std::list<std::pair<Extent, std::list<Dataset> > >* lastclusters = nullptr)
+/**
+ * @brief CollectClusters takes the closed clusters from a streaming clusterer
+ * @param clusterer          - the clusterer to take the clusters from
+ * @param spacedist          - maximum distance of neighbouring hits in a cluster (in m)
+ * @return                   - the closed clusters with their extents, oldest first
+ */
+template<class Clusterer>
+std::list<std::pair<Extent, std::list<Dataset> > >* CollectClusters(Clusterer& clusterer,
+                                                                    double spacedist)
 {
-    if(liste == nullptr || liste->size() == 0)
-            return nullptr;
-
-    //container to remove data from:
-    std::list<Dataset>* rawhits = (direct)?liste:new std::list<Dataset>();
-    if(direct)
-        rawhits = liste;
-    else
-    {
-        rawhits = new std::list<Dataset>();
-        rawhits->insert(rawhits->end(), liste->begin(), liste->end());
-    }
-
-    bool checkoldclusters = lastclusters != nullptr;
-
-    unsigned int listsize = liste->size();
-    unsigned int sizewidth = log10(listsize);
-    //parameter for right alignment of number output (progress):
-    AlignParams clusterpars;    //for clusters
-    AlignParams hitpars;        //for unprocessed hits
-
-    auto doneclusters = new std::list<std::pair<Extent, std::list<Dataset> > >();
-    auto clusters = new std::list<std::pair<Extent, std::list<Dataset> > >();
-
-    const int deltat = int(ceil(timedist / 25e-9));
     const int deltax = int(ceil(spacedist / 50e-6));
-    double deltaxsquared = pow(deltax, 2);
-    double deltat100 = deltat * 100.;
-    double deltat200 = deltat * 200.;
-
-    Extent newcluster;
-    newcluster.Fill(rawhits->front(), deltax);
-
-    std::list<Dataset> neueliste;
-    neueliste.push_back(rawhits->front());
-    clusters->push_back(std::make_pair(newcluster, neueliste));
-    rawhits->pop_front();
 
-    auto it = rawhits->begin();
-    int addedone = 0;
-
-    std::cout << "Clusters  /  remaining hits:\n"
-              << Rightalign(clusters->size() + doneclusters->size(),
-                             sizewidth, &clusterpars)
-              << " / " << Rightalign(rawhits->size(), sizewidth, &hitpars) << "\r";
+    auto clusters = new std::list<std::pair<Extent, std::list<Dataset> > >();
 
-    while(rawhits->size() > 0)
+    std::vector<Dataset> hits;
+    while(clusterer.Pop(hits))
     {
-        bool markasold = false;
-        auto oldcluster = clusters->front();
-        if(checkoldclusters)
-        {
-            bool alllongago = true;
-            for(auto cit = lastclusters->rbegin(); cit != lastclusters->rend(); ++cit)
-            {
-                if(cit->first.Inside(*it, deltat))
-                {
-                    for(auto& hit : cit->second)
-                    {
-                        if(deltaxsquared <= pow(hit.column - it->column, 2) * 9
-                                                + pow(hit.row - it->row, 2))
-                        {
-                            markasold = true;
-                            oldcluster = *cit;
-                            break;
-                        }
-                    }
-
-                    alllongago = false;
-                }
-                //abort the search if the clusters are too early for the hits
-                else if(cit->first.LongAgo(*it, deltat200))
-                {
-                //    alllongago = false;
-                    break;
-                }
-            }
-            if(alllongago)
-            {
-                checkoldclusters = false;
-                std::cout << std::endl << "ended checking old clusters" << std::endl;
-            }
-        }
-
-        bool aborted = false;
-        bool found   = false;
-        auto cit = clusters->rbegin();
-        while(cit != clusters->rend())
-        {
-            bool foundone = false;
-            found = false;
-            //coarse check for being closeby:
-            while(cit->first.Inside(*it, deltat))
-            {
-                found = false;
-                //precise check with the hits inside the cluster:
-                for(auto& hit : cit->second)
-                {
-                    //take care of 150x50µm² pixels of ATLASPix3:
-                    if(deltaxsquared <= pow(hit.column - it->column, 2) * 9 + pow(hit.row - it->row, 2))
-                    {
-                        cit->second.push_back(*it);		//add to cluster
-                        if(markasold)
-                        {
-                            if(cit->first.previoussize == 0)
-                            {
-                                for(auto& ohit : oldcluster.second)
-                                {
-                                    cit->second.push_back(ohit);
-                                    cit->first.Extend(ohit, deltax);
-                                }
-                                cit->first.previoussize = oldcluster.second.size();
-                            }
-                        }
-                        cit->first.Extend(*it, deltax);  //update "closeby" area
-                        it = rawhits->erase(it);			//remove from unclustered list
-                        ++addedone;				//store that a hit was added in this cycle
-                        found = true;					//to restart the search with the next hit
-                        foundone = true;
-
-                        //print every 50 processed hits the numbers:
-                        if((rawhits->size() % 50) == 0)
-                        {
-                            std::cout << Rightalign(clusters->size() + doneclusters->size(),
-                                                    sizewidth, &clusterpars)
-                                      << " / " << Rightalign(rawhits->size(), sizewidth, &hitpars)
-                                      << "\r";
-                            std::cout.flush();
-                        }
-
-                        break;
-                    }
-                }
-
-                if(!found)
-                    break;
-            }
-            if(foundone)
-            {
-                cit = clusters->rbegin();
-                continue;
-            }
-            //abort the search if the clusters are too early for the hits
-            //else if(cit->first.LongAgo(*it, deltat100))
-            if(cit->first.LongAgo(*it, deltat100))
-            {
-                aborted = true;
-                break;
-            }
+        Extent extent;
+        extent.Fill(hits.front(), deltax);
+        for(auto& it : hits)
+            extent.Extend(it, deltax);
 
-            ++cit;
-        }
-
-        if(rawhits->size() == 0)
-            break;
-
-        //retry first hits as some other hits were added to clusters:
-        if(addedone > 5 && it != rawhits->begin())
-        {
-            it = rawhits->begin();
-            addedone = 0;
-        }
-        else
-            ++it;
-
-        if(it == rawhits->end() || aborted)
-        {
-            //create a new cluster if no hit could be added to an existing cluster:
-            if(addedone == 0)
-            {
-                doneclusters->insert(doneclusters->end(), clusters->begin(), clusters->end());
-                clusters->clear();
-
-                Extent newcluster;
-                newcluster.Fill(rawhits->front(), deltax);
-                std::list<Dataset> neueliste;
-                neueliste.push_back(rawhits->front());
-                if(checkoldclusters)
-                {
-                    bool alllongago = true;
-                    for(auto cit = lastclusters->rbegin();  cit != lastclusters->rend(); ++cit)
-                    {
-                        if(cit->first.Inside(rawhits->front(), deltat))
-                        {
-                            for(auto& hit : cit->second)
-                            {
-                                alllongago = false;
-                                if(deltaxsquared <= pow(hit.column - rawhits->front().column, 2) * 9
-                                                        + pow(hit.row - rawhits->front().row, 2))
-                                {
-                                    markasold = true;
-                                    oldcluster = *cit;
-                                    break;
-                                }
-                            }
-                            alllongago = false;
-                        }
-                        else if(cit->first.LongAgo(*it, deltat200))
-                        {
-                            //alllongago = false;
-                            break;
-                        }
-                    }
-                    if(alllongago)
-                    {
-                        checkoldclusters = false;
-                        std::cout << std::endl << "ended checking old clusters" << std::endl;
-                    }
-
-                    if(markasold)
-                    {
-                        for(auto& ohit : oldcluster.second)
-                        {
-                            neueliste.push_back(ohit);
-                            newcluster.Extend(ohit, deltat);
-                        }
-                        newcluster.previoussize = oldcluster.second.size();
-                    }
-                }
-
-                clusters->push_back(std::make_pair(newcluster, neueliste));
-
-                rawhits->pop_front();
-            }
-            else
-                addedone = 0;
-
-            it = rawhits->begin();
-
-            //print every 50 processed hits the numbers:
-            if((rawhits->size() % 50) == 0)
-            {
-                std::cout << Rightalign(clusters->size() + doneclusters->size(),
-                                        sizewidth, &clusterpars)
-                          << " / " << Rightalign(rawhits->size(), sizewidth, &hitpars) << "\r";
-                std::cout.flush();
-            }
-
-            std::cout.flush();
-        }
+        clusters->push_back(std::make_pair(extent, std::list<Dataset>(hits.begin(), hits.end())));
     }
 
-    std::cout << std::endl;
-
-    if(clusters->size() > 0)
-        doneclusters->insert(doneclusters->end(), clusters->begin(), clusters->end());
-    delete clusters;
-    clusters = nullptr;
-
-    if(!direct)
-        delete rawhits;
-
-    return doneclusters;
+    return clusters;
 }
 
 ///this function is a gaussian revolved around a point (par[0]|par[1]) with
@@ -1181,7 +969,7 @@ clusterpos FindSize(std::list<Dataset>& pixels, TH2I* corrhist, bool print = fal
                     if(i != 0 || j != 0)
                     {
                         diff += std::abs(hist->GetBinContent(x,y) - hist->GetBinContent(x+i,y+j))
-                                / sqrt(pow(i, 2) * 9. + pow(j, 2));
+                                / PixelDistanceFunctions::Distance(i, j);
                     }
                 }
             }
@@ -1866,8 +1654,13 @@ void Analysis(std::string filename, bool restrictive, std::string outputprefix =
     TCanvas*           cpid              = nullptr;
 
     unsigned long long numberofclusters  = 0;
+    const double       clusterspacedist  = 200e-6;   //300e-6;
+    const int          clusterdeltax     = int(ceil(clusterspacedist / 50e-6));
+    const int          clusterdeltat     = int(ceil(300e-9 / 25e-9));
+    auto               clustertime       = [](const Dataset& hit) { return hit.timestamp; };
+    StreamingClusterer<Dataset, decltype(clustertime)> clusterer(clusterdeltat,
+                        PixelNeighbourhood(clusterdeltax * clusterdeltax, true), clustertime);
     std::list<std::pair<Extent, std::list<Dataset> > >* clusters = nullptr;
-    std::list<std::pair<Extent, std::list<Dataset> > >* lastclusters = nullptr;
     ClusteringResult   fullclusterresult = ClusteringResult();
     TCanvas*           cpxcnt            = nullptr;
     TCanvas*           csize             = nullptr;
@@ -1995,22 +1788,29 @@ void Analysis(std::string filename, bool restrictive, std::string outputprefix =
         if(endreached && outputprefix != "")
             cpid = Save(cpid, outputprefix + "_packages.pdf", outfile, "PackageIDs", keepclean);
 
-        //Clustering:
-        int lastclusterssize = 0;
-        if(lastclusters != nullptr)
-            delete lastclusters;
+        //Clustering: the chunks are streamed through the clusterer, which returns the clusters
+        //  not extendable by later hits
         if(clusters != nullptr)
+            delete clusters;
+
         {
-            lastclusters = clusters;
-            lastclusterssize = clusters->size();
+            std::vector<Dataset> chunk(fullset->begin(), fullset->end());
+            if(saveram)
+                fullset->clear();
+            std::stable_sort(chunk.begin(), chunk.end(),
+                             [](const Dataset& a, const Dataset& b)
+                                { return a.timestamp < b.timestamp; });
+            clusterer.Add(chunk.begin(), chunk.end());
         }
+        if(endreached)
+            clusterer.Finish();
 
-        clusters = Clusterise(fullset, 200e-6, 300e-9, saveram, lastclusters);  //300e-6, 300e-9);
-        for(auto& it : *clusters)
-            if(it.first.previoussize == 0)
-                ++numberofclusters;
-        std::cout << "Clustering done. now analysing them..." << std::endl;
-        fullclusterresult = AnalyseClusters(clusters, &fullclusterresult, sqrtpixels);
+        clusters = CollectClusters(clusterer, clusterspacedist);
+        numberofclusters += clusters->size();
+        std::cout << "Clustering done (" << clusterer.GetNumOpenClusters()
+                  << " clusters still open). now analysing them..." << std::endl;
+        if(clusters->size() > 0)
+            fullclusterresult = AnalyseClusters(clusters, &fullclusterresult, sqrtpixels);
 
         //clustering result general numbers:
         {
@@ -2300,8 +2100,6 @@ void Analysis(std::string filename, bool restrictive, std::string outputprefix =
     }
     if(clusters != nullptr)
         delete clusters;
-    if(lastclusters != nullptr)
-        delete lastclusters;
     //end of loop area
     datasource.Close();
 
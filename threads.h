@@ -0,0 +1,27 @@
+#ifndef __THREADS
+#define __THREADS
+
+#include <thread>
+
+/*
+ * Common helper of the multi-threaded parts of the analysis (sorting, joining, clustering,
+ * alignment, histogram filling and the fits).
+ */
+
+namespace ThreadFunctions {
+
+    /**
+     * @brief GetNumThreads translates a requested number of threads into the one to use
+     * @param numthreads        - requested number of threads, 0 for one per CPU core
+     * @return                  - the number of threads to use (at least 1)
+     */
+    inline unsigned int GetNumThreads(unsigned int numthreads)
+    {
+        if(numthreads == 0)
+            numthreads = std::thread::hardware_concurrency();
+        return (numthreads > 0)?numthreads:1;
+    }
+
+}
+
+#endif //__THREADS
@@ -0,0 +1,63 @@
+#ifndef totcalculationsources
+#define totcalculationsources
+
+#include "totcalculation.h"
+
+ToTCalculator::ToTCalculator(int ts1div, int ts2div, int overflow) : ts1div(ts1div),
+    ts2div(ts2div), overflow(overflow), ts1shift(-1), ts2shift(-1), ts1mask(0), ts2mask(0),
+    ts1table(1024), ts2table(128)
+{
+    if(this->overflow <= 0)
+    {
+        this->overflow = 128 * ts2div;
+        if(this->overflow > 1024 * ts1div)
+            this->overflow = 1024 * ts1div;
+    }
+
+    for(int i = 0; i < 1024; ++i)
+        ts1table[i] = (i * ts1div) % (128 * ts2div);
+    for(int i = 0; i < 128; ++i)
+        ts2table[i] = (i * ts2div) % (1024 * ts1div);
+
+    auto log2 = [](int value) {
+        if(value <= 0 || (value & (value - 1)) != 0)
+            return -1;
+        int shift = 0;
+        while((1 << shift) < value)
+            ++shift;
+        return shift;
+    };
+
+    const int shift1 = log2(ts1div);
+    const int shift2 = log2(ts2div);
+    if(shift1 >= 0 && shift2 >= 0)
+    {
+        ts1shift = shift1;
+        ts2shift = shift2;
+        //the ranges 128 * ts2div and 1024 * ts1div are powers of two as well:
+        ts1mask  = 128 * ts2div - 1;
+        ts2mask  = 1024 * ts1div - 1;
+    }
+}
+
+int ToTCalculator::GetTS1Divider() const
+{
+    return ts1div;
+}
+
+int ToTCalculator::GetTS2Divider() const
+{
+    return ts2div;
+}
+
+int ToTCalculator::GetOverflow() const
+{
+    return overflow;
+}
+
+bool ToTCalculator::IsPowerOfTwo() const
+{
+    return ts1shift >= 0;
+}
+
+#endif //totcalculationsources
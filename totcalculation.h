@@ -0,0 +1,130 @@
+#ifndef __TOTCALCULATION
+#define __TOTCALCULATION
+
+#include <vector>
+
+/*
+ * Calculation of the ToT from the two time stamps of a hit. The time stamp of the hit (TS1,
+ * 10 bits) and the one of the falling edge (TS2, 7 bits) run on clocks divided from the same
+ * base clock, so both are scaled to the base clock, wrapped at the range of the other one and
+ * subtracted. ToTCalculator does this for arrays of hits with the modulo operations replaced by
+ * shifts and masks for power-of-two dividers or by lookup tables for the others, so the loops
+ * have no divisions and no branches and can be vectorised by the compiler.
+ */
+
+namespace ToTCalculationFunctions {
+
+    /**
+     * @brief CalculateToT calculates the ToT of a single hit. Only the lower 10 bits of `ts1` and
+     *      the lower 7 bits of `ts2` are used.
+     * @param ts1               - the time stamp of the hit
+     * @param ts2               - the ToT time stamp of the hit
+     * @param ts1div            - clock divider of TS1 (1 for the base clock)
+     * @param ts2div            - clock divider of TS2
+     * @param overflow          - value added to negative differences
+     * @return                  - the ToT in units of the base clock
+     */
+    inline int CalculateToT(int ts1, int ts2, int ts1div, int ts2div, int overflow)
+    {
+        const int its1 = ((ts1 & 1023) * ts1div) % (128 * ts2div);
+        const int its2 = ((ts2 & 127) * ts2div) % (1024 * ts1div);
+        const int tot  = its2 - its1;
+
+        return (tot < 0)?tot + overflow:tot;
+    }
+
+}
+
+/**
+ * @brief ToTCalculator calculates the ToT for fixed clock dividers
+ */
+class ToTCalculator
+{
+public:
+    /**
+     * @brief ToTCalculator prepares the calculation for a pair of clock dividers
+     * @param ts1div            - clock divider of TS1 (1 for the base clock)
+     * @param ts2div            - clock divider of TS2
+     * @param overflow          - value added to negative differences, 0 for the smaller one
+     *                              of the two time stamp ranges
+     */
+    ToTCalculator(int ts1div = 1, int ts2div = 2, int overflow = 0);
+
+    int  GetTS1Divider() const;
+    int  GetTS2Divider() const;
+    int  GetOverflow() const;
+    bool IsPowerOfTwo() const;
+
+    /**
+     * @brief Calculate calculates the ToT of a single hit (see
+     *      ToTCalculationFunctions::CalculateToT())
+     * @param ts1               - the time stamp of the hit
+     * @param ts2               - the ToT time stamp of the hit
+     * @return                  - the ToT in units of the base clock
+     */
+    inline int Calculate(int ts1, int ts2) const;
+    /**
+     * @brief Calculate calculates the ToT of many hits
+     * @param n                 - number of hits
+     * @param ts1               - the time stamps of the hits (any integer type)
+     * @param ts2               - the ToT time stamps of the hits
+     * @param tot               - array of n values to write the results to
+     */
+    template<class T>
+    void Calculate(unsigned int n, const T* ts1, const T* ts2, int* tot) const;
+
+private:
+    int ts1div;
+    int ts2div;
+    int overflow;
+
+    //shifts and masks for power-of-two dividers, the shifts are -1 otherwise:
+    int ts1shift;
+    int ts2shift;
+    int ts1mask;
+    int ts2mask;
+
+    //scaled and wrapped time stamps for all 1024 TS1 and 128 TS2 values:
+    std::vector<int> ts1table;
+    std::vector<int> ts2table;
+};
+
+inline int ToTCalculator::Calculate(int ts1, int ts2) const
+{
+    const int tot = ts2table[ts2 & 127] - ts1table[ts1 & 1023];
+
+    return (tot < 0)?tot + overflow:tot;
+}
+
+template<class T>
+void ToTCalculator::Calculate(unsigned int n, const T* ts1, const T* ts2, int* tot) const
+{
+    if(IsPowerOfTwo())
+    {
+        const int shift1 = ts1shift;
+        const int shift2 = ts2shift;
+        const int mask1  = ts1mask;
+        const int mask2  = ts2mask;
+        const int wrap   = overflow;
+        for(unsigned int i = 0; i < n; ++i)
+        {
+            const int its1 = ((int(ts1[i]) & 1023) << shift1) & mask1;
+            const int its2 = ((int(ts2[i]) & 127) << shift2) & mask2;
+            const int diff = its2 - its1;
+            tot[i] = (diff < 0)?diff + wrap:diff;
+        }
+    }
+    else
+    {
+        const int* table1 = ts1table.data();
+        const int* table2 = ts2table.data();
+        const int  wrap   = overflow;
+        for(unsigned int i = 0; i < n; ++i)
+        {
+            const int diff = table2[int(ts2[i]) & 127] - table1[int(ts1[i]) & 1023];
+            tot[i] = (diff < 0)?diff + wrap:diff;
+        }
+    }
+}
+
+#endif //__TOTCALCULATION
@@ -0,0 +1,402 @@
+#ifndef totcalibrationsources
+#define totcalibrationsources
+
+#include "totcalibration.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+const int ToTCalibration::columns;
+const int ToTCalibration::rows;
+const int ToTCalibration::numpixels;
+const size_t ToTCalibration::datasize;
+
+ToTCalibrationFileHeader::ToTCalibrationFileHeader() : version(ToTCalibrationFileVersion),
+    columns(ToTCalibration::columns), rows(ToTCalibration::rows),
+    numparameters(ToTCalibration::P_NumParameters), numcalibrated(0)
+{
+    std::memcpy(magic, "AP3TOTC", sizeof(magic));
+    std::fill(reserved, reserved + 7, 0);
+}
+
+//------------------------------------------------------------------------------------------------
+
+ToTCalibration::ToTCalibration() : numcalibrated(0),
+    buffer((datasize + sizeof(float) - 1) / sizeof(float), 0)
+{
+    SetPointers(reinterpret_cast<char*>(&buffer[0]));
+}
+
+ToTCalibration::ToTCalibration(const ToTCalibration& other) : numcalibrated(other.numcalibrated),
+    buffer((datasize + sizeof(float) - 1) / sizeof(float))
+{
+    SetPointers(reinterpret_cast<char*>(&buffer[0]));
+    std::memcpy(&buffer[0], other.parameters[0], datasize);
+}
+
+ToTCalibration::ToTCalibration(ToTCalibration&& other) : numcalibrated(other.numcalibrated),
+    file(std::move(other.file))
+{
+    //the arrays of a vector and the mapping stay in place on a move:
+    buffer.swap(other.buffer);
+    for(int i = 0; i < P_NumParameters; ++i)
+    {
+        parameters[i] = other.parameters[i];
+        errors[i]     = other.errors[i];
+    }
+    status = other.status;
+
+    other.buffer.resize((datasize + sizeof(float) - 1) / sizeof(float), 0);
+    other.SetPointers(reinterpret_cast<char*>(&other.buffer[0]));
+    other.numcalibrated = 0;
+}
+
+ToTCalibration::~ToTCalibration()
+{
+
+}
+
+ToTCalibration& ToTCalibration::operator=(ToTCalibration other)
+{
+    numcalibrated = other.numcalibrated;
+    file          = std::move(other.file);
+    buffer.swap(other.buffer);
+    for(int i = 0; i < P_NumParameters; ++i)
+    {
+        parameters[i] = other.parameters[i];
+        errors[i]     = other.errors[i];
+    }
+    status = other.status;
+
+    return *this;
+}
+
+void ToTCalibration::SetPointers(char* data)
+{
+    for(int i = 0; i < P_NumParameters; ++i)
+    {
+        parameters[i] = reinterpret_cast<float*>(data) + i * numpixels;
+        errors[i]     = reinterpret_cast<float*>(data) + (P_NumParameters + i) * numpixels;
+    }
+    status = reinterpret_cast<unsigned char*>(data)
+                + 2 * P_NumParameters * numpixels * sizeof(float);
+}
+
+void ToTCalibration::Clear()
+{
+    if(file.is_open() || buffer.size() == 0)
+    {
+        file.Close();
+        buffer.assign((datasize + sizeof(float) - 1) / sizeof(float), 0);
+        SetPointers(reinterpret_cast<char*>(&buffer[0]));
+    }
+    else
+        std::fill(buffer.begin(), buffer.end(), 0);
+
+    numcalibrated = 0;
+}
+
+bool ToTCalibration::Set(int column, int row, const double* parameters, const double* errors,
+                         unsigned char status)
+{
+    const int index = GetIndex(column, row);
+    if(index < 0)
+        return false;
+
+    for(int i = 0; i < P_NumParameters; ++i)
+    {
+        this->parameters[i][index] = parameters[i];
+        this->errors[i][index]     = (errors != nullptr)?errors[i]:0;
+    }
+
+    if((this->status[index] & S_Calibrated) != 0)
+        --numcalibrated;
+    if((status & S_Calibrated) != 0)
+        ++numcalibrated;
+    this->status[index] = status;
+
+    return true;
+}
+
+bool ToTCalibration::IsCalibrated(int column, int row) const
+{
+    return (GetStatus(column, row) & S_Calibrated) != 0;
+}
+
+unsigned char ToTCalibration::GetStatus(int column, int row) const
+{
+    const int index = GetIndex(column, row);
+    return (index >= 0)?status[index]:0;
+}
+
+double ToTCalibration::GetParameter(int column, int row, int parameter) const
+{
+    const int index = GetIndex(column, row);
+    if(index < 0 || parameter < 0 || parameter >= P_NumParameters)
+        return 0;
+
+    return parameters[parameter][index];
+}
+
+double ToTCalibration::GetError(int column, int row, int parameter) const
+{
+    const int index = GetIndex(column, row);
+    if(index < 0 || parameter < 0 || parameter >= P_NumParameters)
+        return 0;
+
+    return errors[parameter][index];
+}
+
+unsigned int ToTCalibration::GetNumCalibrated() const
+{
+    return numcalibrated;
+}
+
+bool ToTCalibration::Open(std::string filename)
+{
+    Clear();
+
+    //writable: Set() only changes the mapped pages of this process
+    if(!file.Open(filename, true))
+        return false;
+
+    ToTCalibrationFileHeader header;
+    ToTCalibrationFileHeader expected;
+    if(file.size() != sizeof(ToTCalibrationFileHeader) + datasize)
+    {
+        file.Close();
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if(std::strncmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != ToTCalibrationFileVersion || header.columns != expected.columns
+            || header.rows != expected.rows || header.numparameters != expected.numparameters)
+    {
+        file.Close();
+        return false;
+    }
+
+    buffer.clear();
+    buffer.shrink_to_fit();
+    SetPointers(file.data() + sizeof(ToTCalibrationFileHeader));
+    numcalibrated = header.numcalibrated;
+
+    return true;
+}
+
+bool ToTCalibration::Save(std::string filename) const
+{
+    if(filename == "")
+        return false;
+
+    ToTCalibrationFileHeader header;
+    header.numcalibrated = numcalibrated;
+
+    AtomicFileWriter file;
+    if(!file.Open(filename))
+        return false;
+
+    file.stream().write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.stream().write(reinterpret_cast<const char*>(parameters[0]), std::streamsize(datasize));
+
+    return file.Commit();
+}
+
+void ToTCalibration::Eval(unsigned int n, const int* pixels, const double* tot, double* charge,
+                          bool approximate) const
+{
+    //the parameters are gathered into contiguous blocks for the conversion:
+    const unsigned int blocksize = 256;
+    double blockparameters[P_NumParameters][blocksize];
+
+    for(unsigned int start = 0; start < n; start += blocksize)
+    {
+        const unsigned int size = (n - start < blocksize)?(n - start):blocksize;
+
+        for(unsigned int i = 0; i < size; ++i)
+        {
+            const int index = (pixels[start + i] >= 0 && pixels[start + i] < numpixels)?
+                                  pixels[start + i]:0;
+            for(int p = 0; p < P_NumParameters; ++p)
+                blockparameters[p][i] = parameters[p][index];
+        }
+
+        ToTCalibrationFunctions::InvToT(size, tot + start, blockparameters[P_LnScale],
+                                        blockparameters[P_X0], blockparameters[P_Linear],
+                                        blockparameters[P_Offset], charge + start, approximate);
+
+        for(unsigned int i = 0; i < size; ++i)
+        {
+            const int index = pixels[start + i];
+            if(index < 0 || index >= numpixels || (status[index] & S_Calibrated) == 0)
+                charge[start + i] = -1;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------------------
+
+void ToTCalibrationFunctions::InvToT(unsigned int n, const double* tot, const double* lnscale,
+                                     const double* x0, const double* linear,
+                                     const double* offset, double* charge, bool approximate)
+{
+    if(!approximate)
+    {
+        for(unsigned int i = 0; i < n; ++i)
+            charge[i] = InvToT(tot[i], lnscale[i], x0[i], linear[i], offset[i]);
+
+        return;
+    }
+
+    //the library exp() prevents vectorisation, so it is evaluated in a separate loop:
+    for(unsigned int i = 0; i < n; ++i)
+        charge[i] = linear[i] / lnscale[i] * x0[i]
+                        * exp((tot[i] - offset[i] - linear[i] * x0[i]) / lnscale[i]);
+
+    for(unsigned int i = 0; i < n; ++i)
+        charge[i] = lnscale[i] / linear[i] * LambertW0(charge[i]) + x0[i];
+}
+
+double ToTCalibrationFunctions::CheckLambertW0(double maxx, double step)
+{
+    double maxdeviation = 0;
+
+    for(double x = 0; x < maxx; x += step)
+    {
+        const double w = utl::LambertW<0>(x);
+        const double deviation = (w > 0)?std::fabs(LambertW0(x) - w) / w
+                                        :std::fabs(LambertW0(x) - w);
+        if(deviation > maxdeviation)
+            maxdeviation = deviation;
+    }
+
+    //the offset of 1e-300 in LambertW0() dominates below 1e-290:
+    for(double exponent = -290; exponent < 300; exponent += 0.001)
+    {
+        const double x = std::pow(10., exponent);
+        const double w = utl::LambertW<0>(x);
+        const double deviation = std::fabs(LambertW0(x) - w) / w;
+        if(deviation > maxdeviation)
+            maxdeviation = deviation;
+    }
+
+    return maxdeviation;
+}
+
+//------------------------------------------------------------------------------------------------
+
+bool ToTCalibrationFunctions::LoadText(std::string filename, ToTCalibration& calibration)
+{
+    calibration.Clear();
+
+    if(filename == "")
+        return false;
+
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::in);
+
+    if(!f.is_open())
+        return false;
+
+    std::string text;
+    int    column = -1;
+    int    row    = -1;
+    bool   inpixel = false;
+    double parameters[ToTCalibration::P_NumParameters] = {0};
+    double errors[ToTCalibration::P_NumParameters]     = {0};
+
+    f >> text;
+
+    while(!f.eof())
+    {
+        if(text[0] == '#')
+        {
+            f >> text;
+            //header line (not used):
+            if(text.find("Fit") != std::string::npos)
+                std::getline(f, text);
+            else if(text.find("Pixel") != std::string::npos)
+            {
+                if(inpixel && !calibration.Set(column, row, parameters, errors))
+                    std::cerr << "Pixel (" << column << "|" << row << ") is outside of the matrix"
+                              << std::endl;
+
+                //the address is given as "(column|row)":
+                std::getline(f, text);
+                std::string::size_type start = text.find('(');
+                std::string::size_type split = text.find('|', start);
+                std::string::size_type ende  = text.find(')', start);
+                column = -1;
+                row    = -1;
+                if(start != std::string::npos && split != std::string::npos
+                        && ende != std::string::npos)
+                {
+                    std::stringstream s(text.substr(start + 1, split - start - 1) + " "
+                                        + text.substr(split + 1, ende - split - 1));
+                    s >> column >> row;
+                }
+
+                inpixel = true;
+                for(int i = 0; i < ToTCalibration::P_NumParameters; ++i)
+                {
+                    parameters[i] = 0;
+                    errors[i]     = 0;
+                }
+            }
+        }
+        else
+        {
+            double value, valerror;
+            std::string plusminus;
+            f >> value >> plusminus >> valerror;
+
+            int parameter = -1;
+            if(text.find("x0") != std::string::npos)
+                parameter = ToTCalibration::P_X0;
+            else if(text.find("offset") != std::string::npos)
+                parameter = ToTCalibration::P_Offset;
+            else if(text.find("lnscale") != std::string::npos)
+                parameter = ToTCalibration::P_LnScale;
+            else if(text.find("linear") != std::string::npos)
+                parameter = ToTCalibration::P_Linear;
+
+            if(parameter >= 0)
+            {
+                parameters[parameter] = value;
+                errors[parameter]     = valerror;
+            }
+        }
+        f >> text;
+    }
+
+    f.close();
+
+    if(inpixel && !calibration.Set(column, row, parameters, errors))
+        std::cerr << "Pixel (" << column << "|" << row << ") is outside of the matrix"
+                  << std::endl;
+
+    return true;
+}
+
+bool ToTCalibrationFunctions::ConvertText(std::string textfile, std::string binaryfile)
+{
+    ToTCalibration calibration;
+    if(!LoadText(textfile, calibration))
+    {
+        std::cerr << "Could not read \"" << textfile << "\"" << std::endl;
+        return false;
+    }
+
+    if(!calibration.Save(binaryfile))
+    {
+        std::cerr << "Could not write \"" << binaryfile << "\"" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+#endif //totcalibrationsources
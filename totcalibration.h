@@ -0,0 +1,313 @@
+#ifndef __TOTCALIBRATION
+#define __TOTCALIBRATION
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#include "LambertW-master/LambertW.h"
+#include "binaryfile.h"
+
+/*
+ * The ToT calibration of a matrix consists of the four parameters of the inverse ToT function
+ * (see ToTCalibrationFunctions::InvToT()) for every pixel. They are stored as one dense
+ * 132 x 372 array per parameter (indexed by column * 372 + row), so looking up the calibration
+ * of a hit is a multiplication and an addition instead of a search.
+ * The tables are written by the calibration fit in fit_totcalibration.cpp and read by the
+ * analysis, e.g. for the calibrated ToT spectra of DecodeToT().
+ */
+
+namespace ToTCalibrationFunctions {
+
+    /**
+     * @brief InvToT converts a ToT value to the injected charge with the inverse of the ToT
+     *      function fitted to the injection scans
+     * @param tot               - the ToT value to convert
+     * @param lnscale           - scale of the logarithmic part
+     * @param x0                - threshold of the logarithmic part
+     * @param linear            - slope of the linear part
+     * @param offset            - ToT offset
+     * @return                  - the charge in units of the injection scan
+     */
+    inline double InvToT(double tot, double lnscale, double x0, double linear, double offset)
+    {
+        return lnscale / linear * utl::LambertW<0>(linear / lnscale * x0
+                                    * exp((tot - offset - linear * x0) / lnscale)) + x0;
+    }
+
+    /**
+     * @brief FastLog calculates the natural logarithm without branches or library calls, so
+     *      loops using it can be vectorised. The absolute deviation from log() is below 2e-13.
+     * @param x                 - a positive, normal, finite number
+     * @return                  - the logarithm of x
+     */
+    inline double FastLog(double x);
+
+    /**
+     * @brief LambertW0 approximates the principal branch of the Lambert W function for
+     *      non-negative arguments with Winitzki's start value and one step of Fritsch's
+     *      iteration (as in LambertW-master/LambertW.cc). The relative deviation from
+     *      utl::LambertW<0>() is below 1e-8 (see CheckLambertW0()). The calculation has no
+     *      branches, so loops over it can be vectorised by the compiler (e.g. with -O3).
+     *      The evaluation order matters, the function must not be compiled with -ffast-math.
+     * @param x                 - the argument, x >= 0
+     * @return                  - W_0(x)
+     */
+    inline double LambertW0(double x);
+
+    /**
+     * @brief InvToT converts an array of ToT values to charge (see InvToT() above)
+     * @param n                 - number of values
+     * @param tot               - the ToT values
+     * @param lnscale           - the parameters of the pixels the ToT values belong to, ...
+     * @param x0                - ...
+     * @param linear            - ...
+     * @param offset            - ...
+     * @param charge            - array of n values to write the results to, can be `tot`
+     * @param approximate       - use LambertW0() instead of utl::LambertW<0>()
+     */
+    void InvToT(unsigned int n, const double* tot, const double* lnscale, const double* x0,
+                const double* linear, const double* offset, double* charge,
+                bool approximate = false);
+
+    /**
+     * @brief CheckLambertW0 compares LambertW0() to utl::LambertW<0>() on the grid of
+     *      LambertW-master/test_accuracy.cxx and on a logarithmic grid up to 1e300
+     * @param maxx              - end of the linear grid
+     * @param step              - step width of the linear grid
+     * @return                  - the maximum relative deviation found
+     */
+    double CheckLambertW0(double maxx = 30, double step = 1e-4);
+
+}
+
+inline double ToTCalibrationFunctions::FastLog(double x)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+
+    //biased exponent with the mantissa moved to [sqrt(0.5), sqrt(2)):
+    const uint64_t exponent = (bits + 0x00095f619980c433ull) >> 52;
+    bits -= (exponent - 1023) << 52;
+    double mantissa;
+    std::memcpy(&mantissa, &bits, sizeof(mantissa));
+
+    //exponent as double without an integer conversion (not vectorisable before AVX-512):
+    const uint64_t exponentbits = exponent | 0x4330000000000000ull;
+    double power;
+    std::memcpy(&power, &exponentbits, sizeof(power));
+    power -= 4503599627370496. + 1023;
+
+    //log(m) = 2 atanh((m - 1) / (m + 1)):
+    const double s  = (mantissa - 1) / (mantissa + 1);
+    const double s2 = s * s;
+    const double series = 1 + s2 * (1. / 3 + s2 * (1. / 5 + s2 * (1. / 7 + s2 * (1. / 9
+                            + s2 * (1. / 11 + s2 * (1. / 13 + s2 * (1. / 15)))))));
+
+    return 2 * s * series + power * 0.6931471805599453;
+}
+
+inline double ToTCalibrationFunctions::LambertW0(double x)
+{
+    //keeps x normal for x = 0 (W_0(x) = x for small x):
+    x += 1e-300;
+
+    //log(1 + x) with the rounding of 1 + x corrected for small x:
+    const double onex = 1 + x;
+    const double l    = FastLog(onex) + (x - (onex - 1)) / onex;
+
+    //Winitzki's approximation:
+    const double w = l * (1 - FastLog(1 + l) / (2 + l));
+
+    //Fritsch's iteration:
+    const double z  = FastLog(x / w) - w;
+    const double w1 = w + 1;
+    const double q  = 2 * w1 * (w1 + 2. / 3 * z);
+
+    return w * (1 + z / w1 * (q - z) / (q - 2 * z));
+}
+
+/**
+ * @brief ToTCalibrationFileHeader is the fixed size (64 bytes) header of a binary calibration
+ *      file. It is followed by the parameter arrays, the error arrays (P_NumParameters arrays of
+ *      `columns` x `rows` floats each) and the status array (one byte per pixel).
+ */
+struct ToTCalibrationFileHeader
+{
+    ToTCalibrationFileHeader();
+
+    char     magic[8];          //"AP3TOTC" + '\0'
+    uint32_t version;           //format version, see ToTCalibrationFileVersion
+    uint32_t columns;
+    uint32_t rows;
+    uint32_t numparameters;
+    uint32_t numcalibrated;     //number of pixels with the S_Calibrated flag
+    uint32_t reserved[7];
+};
+
+const uint32_t ToTCalibrationFileVersion = 1;
+
+/**
+ * @brief ToTCalibration holds the parameters of the inverse ToT function for all pixels of one
+ *      matrix. The arrays are either owned by the object or a private mapping of a binary
+ *      calibration file, so opening a file does not read or convert anything.
+ */
+class ToTCalibration
+{
+public:
+    static const int columns   = 132;
+    static const int rows      = 372;
+    static const int numpixels = columns * rows;
+
+    //order as in the parameter array of the ROOT function InvToT():
+    enum Parameter {
+        P_LnScale   = 0,
+        P_X0        = 1,
+        P_Linear    = 2,
+        P_Offset    = 3,
+        P_NumParameters
+    };
+
+    //flags in the status of a pixel:
+    enum Status {
+        S_Calibrated    = 1,    //parameters are set and used by Eval()
+        S_NotConverged  = 2,    //the fit did not converge
+        S_AtLimit       = 4     //a parameter of the fit is at its limit
+    };
+
+    ToTCalibration();
+    ToTCalibration(const ToTCalibration& other);
+    ToTCalibration(ToTCalibration&& other);
+    ~ToTCalibration();
+
+    ToTCalibration& operator=(ToTCalibration other);
+
+    /**
+     * @brief Clear removes the calibration of all pixels
+     */
+    void Clear();
+
+    /**
+     * @brief Set stores the calibration of a pixel
+     * @param column            - column of the pixel
+     * @param row               - row of the pixel
+     * @param parameters        - the P_NumParameters parameters in the order of `Parameter`
+     * @param errors            - the uncertainties of the parameters, nullptr for none
+     * @param status            - the status flags of the pixel, without S_Calibrated the
+     *                              pixel is not used by Eval()
+     * @return                  - false if the address is outside of the matrix
+     */
+    bool Set(int column, int row, const double* parameters, const double* errors = nullptr,
+             unsigned char status = S_Calibrated);
+
+    bool          IsCalibrated(int column, int row) const;
+    unsigned char GetStatus(int column, int row) const;
+    double        GetParameter(int column, int row, int parameter) const;
+    double        GetError(int column, int row, int parameter) const;
+    unsigned int  GetNumCalibrated() const;
+
+    /**
+     * @brief Open maps a binary calibration file. Changes with Set() are not written to the
+     *      file.
+     * @param filename          - the file to open
+     * @return                  - false if the file could not be opened or is not a valid
+     *                              calibration file, the table is empty in this case
+     */
+    bool Open(std::string filename);
+    /**
+     * @brief Save writes the table to a binary calibration file. The file only gets its final
+     *      name after it was written completely.
+     * @param filename          - the file to write
+     * @return                  - true on success
+     */
+    bool Save(std::string filename) const;
+
+    /**
+     * @brief GetIndex calculates the position of a pixel in the parameter arrays
+     * @param column            - column of the pixel
+     * @param row               - row of the pixel
+     * @return                  - the index or -1 for an address outside of the matrix
+     */
+    static int GetIndex(int column, int row);
+
+    /**
+     * @brief Eval converts a ToT value of a pixel to charge
+     * @param column            - column of the pixel
+     * @param row               - row of the pixel
+     * @param tot               - the ToT value to convert
+     * @return                  - the charge or -1 for a pixel without calibration
+     */
+    inline double Eval(int column, int row, double tot) const;
+    /**
+     * @brief Eval converts the ToT values of many hits to charge. The parameters are collected
+     *      in blocks, so the conversion itself runs over contiguous arrays.
+     * @param n                 - number of values
+     * @param pixels            - the indices of the pixels (see GetIndex())
+     * @param tot               - the ToT values to convert
+     * @param charge            - array of n values to write the charges to, -1 for pixels
+     *                              without calibration. It can be the `tot` array.
+     * @param approximate       - use the vectorisable approximation of the Lambert W function
+     *                              (see ToTCalibrationFunctions::LambertW0())
+     */
+    void Eval(unsigned int n, const int* pixels, const double* tot, double* charge,
+              bool approximate = false) const;
+
+private:
+    //size of the arrays as stored in the binary file behind the header:
+    static const size_t datasize = 2 * P_NumParameters * numpixels * sizeof(float) + numpixels;
+
+    void SetPointers(char* data);
+
+    float*             parameters[P_NumParameters];
+    float*             errors[P_NumParameters];
+    unsigned char*     status;
+    unsigned int       numcalibrated;
+
+    std::vector<float> buffer;      //owned arrays (float for the alignment), empty if mapped
+    FileMapping        file;
+};
+
+inline int ToTCalibration::GetIndex(int column, int row)
+{
+    if(column < 0 || column >= columns || row < 0 || row >= rows)
+        return -1;
+
+    return column * rows + row;
+}
+
+inline double ToTCalibration::Eval(int column, int row, double tot) const
+{
+    const int index = GetIndex(column, row);
+    if(index < 0 || (status[index] & S_Calibrated) == 0)
+        return -1;
+
+    return ToTCalibrationFunctions::InvToT(tot, parameters[P_LnScale][index],
+                                           parameters[P_X0][index], parameters[P_Linear][index],
+                                           parameters[P_Offset][index]);
+}
+
+namespace ToTCalibrationFunctions {
+
+    /**
+     * @brief LoadText reads the calibration from the text file written by the injection scan
+     *      fits. Every pixel starts with a line "# Pixel (column|row)" followed by lines of the
+     *      form "name value +- error" for the parameters lnscale, x0, linear and offset.
+     * @param filename          - the file to read
+     * @param calibration       - the table to fill, it is cleared before
+     * @return                  - false if the file could not be opened
+     */
+    bool LoadText(std::string filename, ToTCalibration& calibration);
+
+    /**
+     * @brief ConvertText converts a text calibration file (see LoadText()) to a binary one
+     * @param textfile          - the file to read
+     * @param binaryfile        - the file to write
+     * @return                  - false if reading or writing failed
+     */
+    bool ConvertText(std::string textfile, std::string binaryfile);
+
+}
+
+#endif //__TOTCALIBRATION
@@ -0,0 +1,296 @@
+#ifndef totcalibrationfitsources
+#define totcalibrationfitsources
+
+#include "totcalibrationfit.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <atomic>
+
+double ToTScanPoint::GetMean() const
+{
+    return (entries > 0)?sum / entries:0;
+}
+
+double ToTScanPoint::GetError() const
+{
+    if(entries <= 0)
+        return 0;
+
+    double variance = sum2 / entries - GetMean() * GetMean();
+    if(variance < 1. / 12)
+        variance = 1. / 12;
+
+    return std::sqrt(variance / entries);
+}
+
+//------------------------------------------------------------------------------------------------
+
+ToTScan::ToTScan() : points(ToTCalibration::numpixels), numpixels(0)
+{
+
+}
+
+bool ToTScan::Add(int column, int row, double charge, double tot, double count)
+{
+    const int index = ToTCalibration::GetIndex(column, row);
+    if(index < 0)
+        return false;
+
+    //the charges are kept sorted, a scan has only a few tens of them:
+    std::vector<ToTScanPoint>& pixel = points[index];
+    if(pixel.size() == 0)
+        ++numpixels;
+    auto it = std::lower_bound(pixel.begin(), pixel.end(), charge,
+                               [](const ToTScanPoint& point, double charge) {
+                                    return point.charge < charge;
+                                });
+    if(it == pixel.end() || it->charge != charge)
+        it = pixel.insert(it, ToTScanPoint(charge));
+
+    it->entries += count;
+    it->sum     += tot * count;
+    it->sum2    += tot * tot * count;
+
+    return true;
+}
+
+bool ToTScan::Load(std::string filename)
+{
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::in);
+    if(!f.is_open())
+        return false;
+
+    std::string line;
+    while(std::getline(f, line))
+    {
+        if(line.size() == 0 || line[0] == '#')
+            continue;
+
+        std::stringstream s(line);
+        int column, row;
+        double charge, tot;
+        double count = 1;
+        s >> column >> row >> charge >> tot;
+        if(s.fail())
+            continue;
+        s >> count;
+        if(s.fail())
+            count = 1;
+
+        Add(column, row, charge, tot, count);
+    }
+
+    return true;
+}
+
+void ToTScan::Clear()
+{
+    for(auto& it : points)
+        it.clear();
+    numpixels = 0;
+}
+
+const std::vector<ToTScanPoint>& ToTScan::GetPoints(int index) const
+{
+    return points[index];
+}
+
+unsigned int ToTScan::GetNumPixels() const
+{
+    return numpixels;
+}
+
+//------------------------------------------------------------------------------------------------
+
+ToTPixelFit::ToTPixelFit() : chi2(0), ndf(0), numpoints(0), status(0)
+{
+    for(int i = 0; i < ToTCalibration::P_NumParameters; ++i)
+    {
+        parameters[i] = 0;
+        errors[i]     = 0;
+    }
+}
+
+ToTPixelFit ToTCalibrationFitFunctions::FitPixel(const std::vector<ToTScanPoint>& points,
+                                                 const LMSettings& settings)
+{
+    ToTPixelFit result;
+
+    std::vector<double> charges;
+    std::vector<double> tots;
+    std::vector<double> sigmas;
+    for(auto& it : points)
+    {
+        if(it.entries <= 0 || !(it.charge > 0))
+            continue;
+        charges.push_back(it.charge);
+        tots.push_back(it.GetMean());
+        sigmas.push_back(it.GetError());
+    }
+    result.numpoints = charges.size();
+    if(charges.size() < ToTCalibration::P_NumParameters)
+        return result;
+
+    const double mincharge = *std::min_element(charges.begin(), charges.end());
+
+    //start values: for fixed x0 the function is linear in the other parameters:
+    std::vector<double> start(ToTCalibration::P_NumParameters, 0);
+    double bestchi2 = std::numeric_limits<double>::max();
+    for(int step = 1; step < 20; ++step)
+    {
+        const double x0 = mincharge * step / 20.;
+
+        std::vector<double> matrix(9, 0);
+        std::vector<double> vector(3, 0);
+        for(unsigned int i = 0; i < charges.size(); ++i)
+        {
+            const double weight = 1. / (sigmas[i] * sigmas[i]);
+            const double basis[3] = {std::log((charges[i] - x0) / x0), charges[i], 1};
+            for(int j = 0; j < 3; ++j)
+            {
+                vector[j] += weight * basis[j] * tots[i];
+                for(int k = 0; k < 3; ++k)
+                    matrix[j * 3 + k] += weight * basis[j] * basis[k];
+            }
+        }
+        if(!LMFitFunctions::Solve(matrix, vector))
+            continue;
+
+        double parameters[ToTCalibration::P_NumParameters];
+        parameters[ToTCalibration::P_LnScale] = vector[0];
+        parameters[ToTCalibration::P_X0]      = x0;
+        parameters[ToTCalibration::P_Linear]  = vector[1];
+        parameters[ToTCalibration::P_Offset]  = vector[2];
+        //the inverse function requires positive scales:
+        if(vector[0] <= 0 || vector[1] <= 0)
+            continue;
+
+        double chi2 = 0;
+        for(unsigned int i = 0; i < charges.size(); ++i)
+        {
+            const double residual = (tots[i] - ToT(charges[i], parameters)) / sigmas[i];
+            chi2 += residual * residual;
+        }
+        if(chi2 < bestchi2)
+        {
+            bestchi2 = chi2;
+            start.assign(parameters, parameters + ToTCalibration::P_NumParameters);
+        }
+    }
+    if(bestchi2 == std::numeric_limits<double>::max())
+    {
+        result.status = ToTCalibration::S_NotConverged;
+        return result;
+    }
+
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<double> lower(ToTCalibration::P_NumParameters, -infinity);
+    std::vector<double> upper(ToTCalibration::P_NumParameters, infinity);
+    lower[ToTCalibration::P_LnScale] = 1e-12;
+    lower[ToTCalibration::P_Linear]  = 1e-12;
+    lower[ToTCalibration::P_X0]      = mincharge * 1e-6;
+    upper[ToTCalibration::P_X0]      = mincharge * (1 - 1e-9);
+
+    LMResult fit = LMFitFunctions::Fit(ToT, charges.data(), tots.data(), sigmas.data(),
+                                       charges.size(), start, lower, upper, settings);
+
+    for(int i = 0; i < ToTCalibration::P_NumParameters; ++i)
+    {
+        result.parameters[i] = fit.parameters[i];
+        result.errors[i]     = (fit.errors.size() > unsigned(i))?fit.errors[i]:0;
+    }
+    result.chi2 = fit.chi2;
+    result.ndf  = fit.ndf;
+
+    if(fit.Converged())
+        result.status = ToTCalibration::S_Calibrated;
+    else
+        result.status = ToTCalibration::S_NotConverged;
+    if(fit.atlimit)
+        result.status |= ToTCalibration::S_AtLimit;
+
+    return result;
+}
+
+std::vector<ToTPixelFit> ToTCalibrationFitFunctions::Fit(const ToTScan& scan,
+                                                         ToTCalibration& calibration,
+                                                         unsigned int numthreads,
+                                                         const LMSettings& settings)
+{
+    std::vector<ToTPixelFit> results(ToTCalibration::numpixels);
+
+    std::vector<int> pixels;
+    for(int i = 0; i < ToTCalibration::numpixels; ++i)
+        if(scan.GetPoints(i).size() > 0)
+            pixels.push_back(i);
+
+    //the pixels are handed out in blocks to keep the contention on the counter low:
+    const unsigned int blocksize = 64;
+    numthreads = ThreadFunctions::GetNumThreads(numthreads);
+    if(numthreads > (pixels.size() + blocksize - 1) / blocksize)
+        numthreads = (pixels.size() + blocksize - 1) / blocksize;
+
+    std::atomic<unsigned int> nextblock(0);
+    auto worker = [&]()
+    {
+        unsigned int block;
+        while((block = nextblock++) * blocksize < pixels.size())
+        {
+            const unsigned int end = std::min<unsigned int>((block + 1) * blocksize,
+                                                            pixels.size());
+            for(unsigned int i = block * blocksize; i < end; ++i)
+                results[pixels[i]] = FitPixel(scan.GetPoints(pixels[i]), settings);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int i = 1; i < numthreads; ++i)
+        threads.push_back(std::thread(worker));
+    worker();
+    for(auto& it : threads)
+        it.join();
+
+    calibration.Clear();
+    for(auto index : pixels)
+        calibration.Set(index / ToTCalibration::rows, index % ToTCalibration::rows,
+                        results[index].parameters, results[index].errors,
+                        results[index].status);
+
+    return results;
+}
+
+bool ToTCalibrationFitFunctions::WriteFailureMap(std::string filename,
+                                                 const std::vector<ToTPixelFit>& fits)
+{
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::out);
+    if(!f.is_open())
+        return false;
+
+    f << "# column row status chi2 ndf numpoints\n"
+      << "# status: 0 too few points, " << int(ToTCalibration::S_NotConverged)
+      << " not converged, " << int(ToTCalibration::S_AtLimit) << " parameter at limit (+ "
+      << int(ToTCalibration::S_Calibrated) << " if calibrated)\n";
+
+    for(unsigned int i = 0; i < fits.size(); ++i)
+    {
+        const ToTPixelFit& fit = fits[i];
+        if(fit.numpoints == 0 || fit.status == ToTCalibration::S_Calibrated)
+            continue;
+
+        f << (i / ToTCalibration::rows) << " " << (i % ToTCalibration::rows) << " "
+          << int(fit.status) << " " << fit.chi2 << " " << fit.ndf << " " << fit.numpoints
+          << "\n";
+    }
+
+    f.flush();
+    return f.good();
+}
+
+#endif //totcalibrationfitsources
@@ -0,0 +1,150 @@
+#ifndef __TOTCALIBRATIONFIT
+#define __TOTCALIBRATIONFIT
+
+#include <string>
+#include <vector>
+#include <cmath>
+
+#include "totcalibration.h"
+#include "lmfit.h"
+#include "threads.h"
+
+/*
+ * Generation of the per-pixel ToT calibration from injection scans. ToTScan collects the ToT
+ * values measured for the injected charges in every pixel. The ToT function (the inverse of
+ * ToTCalibrationFunctions::InvToT()) is fitted to the mean ToT per charge of every pixel with
+ * the Levenberg-Marquardt fitter of lmfit.h, which does not use ROOT, so the pixels are fitted
+ * on several threads. The result is stored in a ToTCalibration, including the fit status of
+ * every pixel.
+ */
+
+/**
+ * @brief ToTScanPoint accumulates the ToT values measured for one injected charge in one pixel
+ */
+struct ToTScanPoint
+{
+    ToTScanPoint(double charge = 0) : charge(charge), entries(0), sum(0), sum2(0) {}
+
+    double charge;
+    double entries;
+    double sum;
+    double sum2;
+
+    double GetMean() const;
+    /**
+     * @brief GetError calculates the uncertainty of the mean ToT. The variance is at least the
+     *      one of the ToT digitisation (1/12).
+     * @return                  - the standard error of the mean
+     */
+    double GetError() const;
+};
+
+/**
+ * @brief ToTScan holds the measured ToT values of all pixels of a matrix
+ */
+class ToTScan
+{
+public:
+    ToTScan();
+
+    /**
+     * @brief Add adds ToT values measured for an injected charge
+     * @param column            - column of the pixel
+     * @param row               - row of the pixel
+     * @param charge            - the injected charge
+     * @param tot               - the ToT value measured
+     * @param count             - number of times the value was measured (e.g. the content of a
+     *                              ToT spectrum bin)
+     * @return                  - false if the pixel is outside of the matrix
+     */
+    bool Add(int column, int row, double charge, double tot, double count = 1);
+    /**
+     * @brief Load reads scan data from a text file with one line
+     *      "column row charge tot [count]" per measurement. Lines starting with '#' are ignored.
+     * @param filename          - the file to read
+     * @return                  - false if the file could not be opened
+     */
+    bool Load(std::string filename);
+    void Clear();
+
+    /**
+     * @brief GetPoints gives the data of a pixel
+     * @param index             - index of the pixel (see ToTCalibration::GetIndex())
+     * @return                  - the charges with their accumulated ToT values, sorted by charge
+     */
+    const std::vector<ToTScanPoint>& GetPoints(int index) const;
+    unsigned int                     GetNumPixels() const;
+
+private:
+    std::vector<std::vector<ToTScanPoint> > points;
+    unsigned int                             numpixels;
+};
+
+/**
+ * @brief ToTPixelFit contains the result of the fit for one pixel
+ */
+struct ToTPixelFit
+{
+    ToTPixelFit();
+
+    double        parameters[ToTCalibration::P_NumParameters];
+    double        errors[ToTCalibration::P_NumParameters];
+    double        chi2;
+    unsigned int  ndf;
+    unsigned int  numpoints;    //number of charges with data, 0 for pixels without data
+    unsigned char status;       //see ToTCalibration::Status
+};
+
+namespace ToTCalibrationFitFunctions {
+
+    /**
+     * @brief ToT is the ToT function fitted to the scans:
+     *      lnscale * log((charge - x0) / x0) + linear * charge + offset
+     * @param charge            - the injected charge (> x0)
+     * @param parameters        - the parameters in the order of ToTCalibration::Parameter
+     * @return                  - the expected ToT
+     */
+    inline double ToT(double charge, const double* parameters)
+    {
+        return parameters[ToTCalibration::P_LnScale]
+                    * std::log((charge - parameters[ToTCalibration::P_X0])
+                                / parameters[ToTCalibration::P_X0])
+                + parameters[ToTCalibration::P_Linear] * charge
+                + parameters[ToTCalibration::P_Offset];
+    }
+
+    /**
+     * @brief FitPixel fits the ToT function to the data of one pixel. The start values are
+     *      found by solving the linear problem for a set of thresholds x0 below the smallest
+     *      charge.
+     * @param points            - the scan data of the pixel
+     * @param settings          - steering parameters of the fit
+     * @return                  - the fit result, S_Calibrated is only set for converged fits
+     */
+    ToTPixelFit FitPixel(const std::vector<ToTScanPoint>& points,
+                         const LMSettings& settings = LMSettings());
+
+    /**
+     * @brief Fit fits all pixels with data on several threads and stores the results
+     * @param scan              - the scan data
+     * @param calibration       - the calibration to write the results to (cleared before)
+     * @param numthreads        - maximum number of threads, 0 for one per CPU core
+     * @param settings          - steering parameters of the fits
+     * @return                  - the fit results for all pixels, indexed as the calibration
+     */
+    std::vector<ToTPixelFit> Fit(const ToTScan& scan, ToTCalibration& calibration,
+                                 unsigned int numthreads = 0,
+                                 const LMSettings& settings = LMSettings());
+
+    /**
+     * @brief WriteFailureMap writes the pixels with data which are not calibrated or have a
+     *      parameter at a limit to a text file ("column row status chi2 ndf numpoints")
+     * @param filename          - the file to write
+     * @param fits              - the results of Fit()
+     * @return                  - false if the file could not be written
+     */
+    bool WriteFailureMap(std::string filename, const std::vector<ToTPixelFit>& fits);
+
+}
+
+#endif //__TOTCALIBRATIONFIT
@@ -0,0 +1,230 @@
+#ifndef totspectrumsources
+#define totspectrumsources
+
+#include "totspectrum.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+const int ToTSpectra::layers;
+const int ToTSpectra::columns;
+const int ToTSpectra::rows;
+const int ToTSpectra::bins;
+const int ToTSpectra::numpixels;
+
+ToTSpectrumFileHeader::ToTSpectrumFileHeader() : version(ToTSpectrumFileVersion),
+    layers(ToTSpectra::layers), columns(ToTSpectra::columns), rows(ToTSpectra::rows),
+    bins(ToTSpectra::bins), ts1div(1), ts2div(2), countersize(4), numpixels(0), reserved(0),
+    numentries(0), numrejected(0)
+{
+    std::memcpy(magic, "AP3TOTS", sizeof(magic));
+}
+
+//------------------------------------------------------------------------------------------------
+
+ToTSpectra::ToTSpectra(int ts1div, int ts2div) : calculator(ts1div, ts2div),
+    binwidth((calculator.GetOverflow() + bins - 1) / bins), counters(size_t(numpixels) * bins, 0),
+    numentries(0), numrejected(0)
+{
+
+}
+
+void ToTSpectra::Clear()
+{
+    std::fill(counters.begin(), counters.end(), 0);
+    numentries  = 0;
+    numrejected = 0;
+}
+
+void ToTSpectra::Fill(const Dataset* hits, unsigned int numhits)
+{
+    const unsigned int blocksize = 1024;
+    short ts1[blocksize];
+    short ts2[blocksize];
+    int   tots[blocksize];
+
+    for(unsigned int start = 0; start < numhits; start += blocksize)
+    {
+        const unsigned int size = (numhits - start < blocksize)?(numhits - start):blocksize;
+
+        for(unsigned int i = 0; i < size; ++i)
+        {
+            ts1[i] = hits[start + i].shortts;
+            ts2[i] = hits[start + i].shortts2;
+        }
+        calculator.Calculate(size, ts1, ts2, tots);
+
+        for(unsigned int i = 0; i < size; ++i)
+            Fill(hits[start + i].layer, hits[start + i].column, hits[start + i].row, tots[i]);
+    }
+}
+
+bool ToTSpectra::Fill(int layer, int column, int row, int tot)
+{
+    const int index = GetIndex(layer, column, row);
+    if(index < 0 || tot < 0 || tot >= bins * binwidth)
+    {
+        ++numrejected;
+        return false;
+    }
+
+    ++counters[size_t(index) * bins + tot / binwidth];
+    ++numentries;
+
+    return true;
+}
+
+bool ToTSpectra::Merge(const ToTSpectra& other)
+{
+    if(other.GetTS1Divider() != GetTS1Divider() || other.GetTS2Divider() != GetTS2Divider())
+        return false;
+
+    for(size_t i = 0; i < counters.size(); ++i)
+        counters[i] += other.counters[i];
+    numentries  += other.numentries;
+    numrejected += other.numrejected;
+
+    return true;
+}
+
+const uint32_t* ToTSpectra::GetSpectrum(int layer, int column, int row) const
+{
+    const int index = GetIndex(layer, column, row);
+    if(index < 0)
+        return nullptr;
+
+    return &counters[size_t(index) * bins];
+}
+
+int ToTSpectra::GetBinWidth() const
+{
+    return binwidth;
+}
+
+int ToTSpectra::GetTS1Divider() const
+{
+    return calculator.GetTS1Divider();
+}
+
+int ToTSpectra::GetTS2Divider() const
+{
+    return calculator.GetTS2Divider();
+}
+
+uint64_t ToTSpectra::GetNumEntries() const
+{
+    return numentries;
+}
+
+uint64_t ToTSpectra::GetNumRejected() const
+{
+    return numrejected;
+}
+
+bool ToTSpectra::Save(std::string filename) const
+{
+    if(filename == "")
+        return false;
+
+    ToTSpectrumFileHeader header;
+    header.ts1div      = GetTS1Divider();
+    header.ts2div      = GetTS2Divider();
+    header.numentries  = numentries;
+    header.numrejected = numrejected;
+
+    uint32_t maximum = 0;
+    for(int i = 0; i < numpixels; ++i)
+    {
+        const uint32_t* spectrum = &counters[size_t(i) * bins];
+        const uint32_t  pixelmax = *std::max_element(spectrum, spectrum + bins);
+        if(pixelmax > 0)
+            ++header.numpixels;
+        maximum = std::max(maximum, pixelmax);
+    }
+    header.countersize = (maximum <= 0xffff)?2:4;
+
+    AtomicFileWriter file;
+    if(!file.Open(filename))
+        return false;
+    std::fstream& f = file.stream();
+
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint16_t shortcounters[bins];
+    for(int i = 0; i < numpixels; ++i)
+    {
+        const uint32_t* spectrum = &counters[size_t(i) * bins];
+        if(*std::max_element(spectrum, spectrum + bins) == 0)
+            continue;
+
+        const uint32_t index = i;
+        f.write(reinterpret_cast<const char*>(&index), sizeof(index));
+        if(header.countersize == 2)
+        {
+            std::copy(spectrum, spectrum + bins, shortcounters);
+            f.write(reinterpret_cast<const char*>(shortcounters), sizeof(shortcounters));
+        }
+        else
+            f.write(reinterpret_cast<const char*>(spectrum), bins * sizeof(uint32_t));
+    }
+
+    return file.Commit();
+}
+
+bool ToTSpectra::Load(std::string filename)
+{
+    Clear();
+
+    std::fstream f;
+    f.open(filename.c_str(), std::ios::in | std::ios::binary);
+    if(!f.is_open())
+        return false;
+
+    ToTSpectrumFileHeader header;
+    ToTSpectrumFileHeader expected;
+    f.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!f.good() || std::strncmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+            || header.version != ToTSpectrumFileVersion || header.layers != expected.layers
+            || header.columns != expected.columns || header.rows != expected.rows
+            || header.bins != expected.bins || header.ts1div < 1 || header.ts2div < 1
+            || (header.countersize != 2 && header.countersize != 4)
+            || header.numpixels > uint32_t(numpixels))
+        return false;
+
+    calculator = ToTCalculator(header.ts1div, header.ts2div);
+    binwidth   = (calculator.GetOverflow() + bins - 1) / bins;
+
+    uint16_t shortcounters[bins];
+    for(uint32_t k = 0; k < header.numpixels; ++k)
+    {
+        uint32_t index;
+        f.read(reinterpret_cast<char*>(&index), sizeof(index));
+        if(!f.good() || index >= uint32_t(numpixels))
+        {
+            Clear();
+            return false;
+        }
+
+        uint32_t* spectrum = &counters[size_t(index) * bins];
+        if(header.countersize == 2)
+        {
+            f.read(reinterpret_cast<char*>(shortcounters), sizeof(shortcounters));
+            std::copy(shortcounters, shortcounters + bins, spectrum);
+        }
+        else
+            f.read(reinterpret_cast<char*>(spectrum), bins * sizeof(uint32_t));
+    }
+    if(!f.good())
+    {
+        Clear();
+        return false;
+    }
+
+    numentries  = header.numentries;
+    numrejected = header.numrejected;
+
+    return true;
+}
+
+#endif //totspectrumsources
@@ -0,0 +1,146 @@
+#ifndef __TOTSPECTRUM
+#define __TOTSPECTRUM
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "binaryfile.h"
+#include "dataset.h"
+#include "totcalculation.h"
+
+/*
+ * Per-pixel ToT spectra of the four telescope layers, accumulated by the decoder while the hits
+ * are written. Every pixel has 128 bins covering the ToT range of the clock dividers, so the
+ * counters of all pixels take 4 x 132 x 372 x 128 x 4 bytes (about 100 MB). The spectra are
+ * saved to a binary file which only contains the pixels with entries and uses 16 bit counters
+ * if they are sufficient, so calibration and equalisation studies do not need to reload the
+ * decoded text file.
+ */
+
+/**
+ * @brief ToTSpectrumFileHeader is the fixed size (64 bytes) header of a ToT spectrum file. It is
+ *      followed by one record per pixel with entries: the pixel index (uint32_t, see
+ *      ToTSpectra::GetIndex()) and the `bins` counters of `countersize` bytes each.
+ */
+struct ToTSpectrumFileHeader
+{
+    ToTSpectrumFileHeader();
+
+    char     magic[8];          //"AP3TOTS" + '\0'
+    uint32_t version;           //format version, see ToTSpectrumFileVersion
+    uint32_t layers;
+    uint32_t columns;
+    uint32_t rows;
+    uint32_t bins;
+    uint32_t ts1div;            //clock dividers the ToT was calculated with
+    uint32_t ts2div;
+    uint32_t countersize;       //2 or 4 bytes
+    uint32_t numpixels;         //number of pixel records
+    uint32_t reserved;
+    uint64_t numentries;        //number of hits filled
+    uint64_t numrejected;       //number of hits with an address outside of the matrices
+};
+
+const uint32_t ToTSpectrumFileVersion = 1;
+
+/**
+ * @brief ToTSpectra holds the ToT spectra of all pixels of the four layers
+ */
+class ToTSpectra
+{
+public:
+    static const int layers    = 4;
+    static const int columns   = 132;
+    static const int rows      = 372;
+    static const int bins      = 128;
+    static const int numpixels = layers * columns * rows;
+
+    /**
+     * @brief ToTSpectra creates empty spectra
+     * @param ts1div            - clock divider of TS1 (1 for the base clock)
+     * @param ts2div            - clock divider of TS2
+     */
+    ToTSpectra(int ts1div = 1, int ts2div = 2);
+
+    void Clear();
+
+    /**
+     * @brief Fill adds the ToT of hits to the spectra of their pixels. The ToT is calculated
+     *      for blocks of hits with ToTCalculator.
+     * @param hits              - the hits to add
+     * @param numhits           - number of hits in the array
+     */
+    void Fill(const Dataset* hits, unsigned int numhits);
+    /**
+     * @brief Fill adds one ToT value
+     * @param layer             - layer of the hit (1 to 4)
+     * @param column            - column of the hit
+     * @param row               - row of the hit
+     * @param tot               - the ToT in units of the base clock
+     * @return                  - false if the address is outside of the matrices
+     */
+    bool Fill(int layer, int column, int row, int tot);
+
+    /**
+     * @brief Merge adds the spectra of another object (e.g. filled in another thread)
+     * @param other             - the spectra to add
+     * @return                  - false if the clock dividers are different
+     */
+    bool Merge(const ToTSpectra& other);
+
+    /**
+     * @brief GetSpectrum gives the counters of a pixel
+     * @param layer             - layer of the pixel (1 to 4)
+     * @param column            - column of the pixel
+     * @param row               - row of the pixel
+     * @return                  - the `bins` counters or nullptr for an address outside of the
+     *                              matrices
+     */
+    const uint32_t* GetSpectrum(int layer, int column, int row) const;
+    int             GetBinWidth() const;
+    int             GetTS1Divider() const;
+    int             GetTS2Divider() const;
+    uint64_t        GetNumEntries() const;
+    uint64_t        GetNumRejected() const;
+
+    /**
+     * @brief Save writes the spectra to a binary file. The file only gets its final name after it
+     *      was written completely.
+     * @param filename          - the file to write
+     * @return                  - true on success
+     */
+    bool Save(std::string filename) const;
+    /**
+     * @brief Load reads the spectra from a binary file, the clock dividers are taken from the file
+     * @param filename          - the file to read
+     * @return                  - false if the file could not be read, the spectra are empty then
+     */
+    bool Load(std::string filename);
+
+    /**
+     * @brief GetIndex calculates the position of a pixel in the spectra
+     * @param layer             - layer of the pixel (1 to 4)
+     * @param column            - column of the pixel
+     * @param row               - row of the pixel
+     * @return                  - the index or -1 for an address outside of the matrices
+     */
+    static int GetIndex(int layer, int column, int row);
+
+private:
+    ToTCalculator         calculator;
+    int                   binwidth;
+    std::vector<uint32_t> counters;     //numpixels x bins
+    uint64_t              numentries;
+    uint64_t              numrejected;
+};
+
+inline int ToTSpectra::GetIndex(int layer, int column, int row)
+{
+    if(layer < 1 || layer > layers || column < 0 || column >= columns || row < 0 || row >= rows)
+        return -1;
+
+    return ((layer - 1) * columns + column) * rows + row;
+}
+
+#endif //__TOTSPECTRUM